@@ -0,0 +1,592 @@
+#include "pch.h"
+#include "benchmark.h"
+#include <chrono>
+#include <random>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include "utils/threadPool.h"
+#include "path/voxelAStar.h"
+#include "path/voxelHpa.h"
+#include "path/voxelRegion.h"
+#include "path/voxelRaycast.h"
+#include "path/pathSmooth.h"
+
+// 查询类项目每轮的次数
+static const uint32_t QueryCount = 1 << 20;
+// 掩码查询的半径
+static const uint8_t MaskRadius[] = { 0, 1, 2, 4, 8, 20 };
+// 移动的代理数和每轮步数
+static const uint32_t MoveUnits = 4096;
+static const uint32_t MoveSteps = 16;
+// 寻路的起终点对数和最大间距(格子)
+static const uint32_t PathPairs = 64;
+static const uint32_t PathRange = 64;
+// 射线数和最大长度(格子), 视线高度
+static const uint32_t RayCount = 1 << 16;
+static const uint32_t RayRange = 32;
+static const float RayEyeHight = 170.f;
+
+bool Benchmark::Enabled(const char* name) const
+{
+	if (m_config.filter.empty())
+		return true;
+	for (const auto& f : m_config.filter)
+		if (strstr(name, f.c_str()))
+			return true;
+	return false;
+}
+
+void Benchmark::Add(const MapGen::Param& param, const char* name, const char* unit, double value, uint64_t count)
+{
+	m_results.push_back(Result{ MapGen::KindName(param.kind), param.size, param.maxLayers, name, unit, value, count });
+}
+
+template<typename Fn>
+double Benchmark::Measure(Fn fn, uint64_t& count) const
+{
+	double best = 0.;
+	for (uint32_t round = 0; round < std::max(1u, m_config.rounds); ++round)
+	{
+		auto start = std::chrono::steady_clock::now();
+		uint64_t n = std::max<uint64_t>(1, fn());
+		double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / double(n);
+		if (round == 0 || ns < best)
+			best = ns;
+		count = n;
+	}
+	return best;
+}
+
+void Benchmark::Run(std::ostream& log)
+{
+	for (auto kind : m_config.kinds)
+		for (auto size : m_config.sizes)
+			for (auto layers : m_config.layers)
+			{
+				size_t first = m_results.size();
+				MapGen::Param param;
+				param.kind = kind;
+				param.size = size;
+				param.maxLayers = layers;
+				param.seed = m_config.seed;
+				RunMap(param);
+				for (size_t i = first; i < m_results.size(); ++i)
+				{
+					const auto& r = m_results[i];
+					log << r.map << ' ' << r.size << 'x' << r.size << " L" << uint32_t(r.layers) << ' '
+						<< r.name << ' ' << std::fixed << std::setprecision(1) << r.value << ' ' << r.unit << std::endl;
+				}
+			}
+}
+
+void Benchmark::RunMap(const MapGen::Param& param)
+{
+	auto start = std::chrono::steady_clock::now();
+	auto terr = MapGen::Create(param);
+	double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+	if (Enabled("Generate"))
+		Add(param, "Generate", "ns", ns, 1);
+	if (Enabled("Memory"))
+		Add(param, "Memory", "bytes", double(terr->GetMemoryStats().Total()), 1);
+	if (Enabled("MemoryDedup"))
+	{
+		// 合并后的占用, 在副本上合并, 不影响后面的测试
+		TerrainData dedup(*terr);
+		dedup.Dedup();
+		Add(param, "MemoryDedup", "bytes", double(dedup.GetMemoryStats().Total()), 1);
+	}
+
+	RunIO(param, *terr);
+	RunQuery(param, *terr);
+	RunMove(param, *terr);
+	RunPath(param, *terr);
+}
+
+void Benchmark::RunIO(const MapGen::Param& param, TerrainData& terr)
+{
+	uint64_t count = 0;
+	if (Enabled("Export") || Enabled("Import"))
+	{
+		std::string text;
+		double ns = Measure([&]() {
+			std::ostringstream os;
+			terr.Export(os);
+			text = os.str();
+			return 1;
+		}, count);
+		if (Enabled("Export"))
+			Add(param, "Export", "ns", ns, count);
+		// 导入包括构建附近关系
+		ns = Measure([&]() {
+			std::istringstream is(text);
+			TerrainData t(1, 1, 1);
+			t.Import(is);
+			m_sink += t.ChunkCount();
+			return 1;
+		}, count);
+		if (Enabled("Import"))
+			Add(param, "Import", "ns", ns, count);
+	}
+
+	if (Enabled("ExportBinary") || Enabled("ImportBinary"))
+	{
+		std::string binary;
+		double ns = Measure([&]() {
+			std::ostringstream os;
+			terr.ExportBinary(os);
+			binary = os.str();
+			return 1;
+		}, count);
+		if (Enabled("ExportBinary"))
+			Add(param, "ExportBinary", "ns", ns, count);
+		// 二进制格式要求对齐
+		std::vector<uint64_t> image((binary.size() + 7) / 8);
+		memcpy(image.data(), binary.data(), binary.size());
+		ns = Measure([&]() {
+			TerrainData t(1, 1, 1);
+			m_sink += t.ImportBinary((const char*)image.data(), binary.size()) ? 1 : 0;
+			return 1;
+		}, count);
+		if (Enabled("ImportBinary"))
+			Add(param, "ImportBinary", "ns", ns, count);
+	}
+
+	if (Enabled("BuildNeighbor"))
+	{
+		double ns = Measure([&]() {
+			terr.BuildNeighbor();
+			return 1;
+		}, count);
+		Add(param, "BuildNeighbor", "ns", ns, count);
+		ThreadPool pool;
+		ns = Measure([&]() {
+			terr.BuildNeighbor(pool);
+			return 1;
+		}, count);
+		Add(param, "BuildNeighborParallel", "ns", ns, count);
+	}
+}
+
+void Benchmark::RunQuery(const MapGen::Param& param, TerrainData& terr)
+{
+	std::mt19937 rng(m_config.seed);
+	uint64_t count = 0;
+	const uint32_t size = param.size;
+
+	if (Enabled("GetLayer"))
+	{
+		std::vector<TerrainData::Voxels> vols(QueryCount);
+		std::vector<uint32_t> xs(QueryCount), ys(QueryCount);
+		std::vector<float> hights(QueryCount);
+		uint32_t maxHight = param.maxLayers * MapGen::StoryHeight + 800;
+		for (uint32_t i = 0; i < QueryCount; ++i)
+		{
+			xs[i] = rng() % size;
+			ys[i] = rng() % size;
+			vols[i] = terr.GetVoxels(xs[i], ys[i]);
+			hights[i] = float(rng() % maxHight) * terr.SpanMeasure();
+		}
+		double ns = Measure([&]() {
+			uint64_t sum = 0;
+			for (uint32_t i = 0; i < QueryCount; ++i)
+				sum += terr.GetLayer(vols[i], hights[i]);
+			m_sink += sum;
+			return QueryCount;
+		}, count);
+		Add(param, "GetLayer", "ns", ns, count);
+		ns = Measure([&]() {
+			uint64_t sum = 0;
+			for (uint32_t i = 0; i < QueryCount; ++i)
+				sum += terr.GetLayerByScan(vols[i], hights[i]);
+			m_sink += sum;
+			return QueryCount;
+		}, count);
+		Add(param, "GetLayerScan", "ns", ns, count);
+		// 从坐标开始查找, 包含读取Column的开销, 与寻路和移动的用法一致
+		ns = Measure([&]() {
+			uint64_t sum = 0;
+			for (uint32_t i = 0; i < QueryCount; ++i)
+				sum += terr.GetLayer(terr.GetVoxels(xs[i], ys[i]), hights[i]);
+			m_sink += sum;
+			return QueryCount;
+		}, count);
+		Add(param, "GetLayerAt", "ns", ns, count);
+	}
+
+	if (Enabled("IsMask"))
+	{
+		std::vector<VoxelPos> queries(QueryCount);
+		for (auto& q : queries)
+		{
+			q.x = rng() % size;
+			q.y = rng() % size;
+			q.layer = uint8_t(rng() % terr.GetVoxels(q.x, q.y).count);
+		}
+		// 平均每cellsPer格一个占用, 半径0到3
+		auto run = [&](const char* prefix, uint32_t cellsPer) {
+			TerrainInstance inst(&terr);
+			for (uint32_t i = 0; i < size * size / cellsPer; ++i)
+			{
+				uint32_t x = rng() % size, y = rng() % size;
+				inst.AddMask(x, y, uint8_t(rng() % terr.GetVoxels(x, y).count), uint8_t(rng() % 4));
+			}
+			for (uint8_t radius : MaskRadius)
+			{
+				double ns = Measure([&]() {
+					uint64_t sum = 0;
+					for (const auto& q : queries)
+						sum += inst.IsMask(q.x, q.y, q.layer, radius) ? 1 : 0;
+					m_sink += sum;
+					return QueryCount;
+				}, count);
+				std::string name = prefix + std::to_string(radius);
+				Add(param, name.c_str(), "ns", ns, count);
+			}
+		};
+		run("IsMask/r", 64);
+		// 占用稀疏时多数查询为空, 大半径要经过更多的空分块
+		run("IsMaskSparse/r", 4096);
+	}
+
+	if (Enabled("Raycast"))
+	{
+		// 站在随机layer上表面的视线, 终点在附近随机格子的随机layer上, 按随机顺序给出
+		const float gridSize = terr.GridSize();
+		auto randomEye = [&](uint32_t x, uint32_t y) {
+			auto vols = terr.GetVoxels(x, y);
+			return Location((x + 0.5f) * gridSize, (y + 0.5f) * gridSize, terr.GetHight(vols, uint8_t(rng() % vols.count)) + RayEyeHight);
+		};
+		std::vector<VoxelRaycast::Ray> rays(RayCount);
+		for (auto& ray : rays)
+		{
+			uint32_t x = rng() % size, y = rng() % size;
+			ray.from = randomEye(x, y);
+			x = uint32_t(std::min<int64_t>(std::max<int64_t>(int64_t(x) + int64_t(rng() % (RayRange * 2 + 1)) - RayRange, 0), size - 1));
+			y = uint32_t(std::min<int64_t>(std::max<int64_t>(int64_t(y) + int64_t(rng() % (RayRange * 2 + 1)) - RayRange, 0), size - 1));
+			ray.to = randomEye(x, y);
+		}
+		std::vector<VoxelRaycast::Hit> hits(RayCount);
+		double ns = Measure([&]() {
+			uint64_t sum = 0;
+			for (uint32_t i = 0; i < RayCount; ++i)
+				sum += VoxelRaycast::Cast(terr, rays[i]).blocked ? 1 : 0;
+			m_sink += sum;
+			return RayCount;
+		}, count);
+		Add(param, "Raycast", "ns", ns, count);
+		ns = Measure([&]() {
+			VoxelRaycast::CastBatch(terr, rays.data(), RayCount, hits.data());
+			m_sink += hits[0].blocked ? 1 : 0;
+			return RayCount;
+		}, count);
+		Add(param, "RaycastBatch", "ns", ns, count);
+	}
+}
+
+void Benchmark::RunMove(const MapGen::Param& param, TerrainData& terr)
+{
+	if (!Enabled("MoveTo"))
+		return;
+	std::mt19937 rng(m_config.seed);
+	const uint32_t size = param.size;
+	const float gridSize = terr.GridSize();
+	TerrainInstance inst(&terr);
+	for (uint32_t i = 0; i < size * size / 64; ++i)
+	{
+		uint32_t x = rng() % size, y = rng() % size;
+		inst.AddMask(x, y, uint8_t(rng() % terr.GetVoxels(x, y).count));
+	}
+
+	std::vector<std::unique_ptr<VoxelProxy>> proxies;
+	std::vector<float> angles;
+	for (uint32_t i = 0; i < MoveUnits; ++i)
+	{
+		uint32_t x = rng() % size, y = rng() % size;
+		auto vols = terr.GetVoxels(x, y);
+		float z = terr.GetHight(vols, uint8_t(rng() % vols.count));
+		proxies.emplace_back(new VoxelProxy(&inst, Location((x + 0.5f) * gridSize, (y + 0.5f) * gridSize, z)));
+		angles.push_back(float(rng() % 360) * 0.0174532925f);
+	}
+
+	// 每步走1.5格, 被挡住或走出地图时转向
+	const float step = gridSize * 1.5f;
+	const float limit = size * gridSize - 1.f;
+	uint64_t count = 0;
+	double ns = Measure([&]() {
+		uint64_t blocked = 0;
+		for (uint32_t s = 0; s < MoveSteps; ++s)
+			for (uint32_t i = 0; i < MoveUnits; ++i)
+			{
+				auto& pxy = *proxies[i];
+				Location to = pxy.GetLocation();
+				to.x = std::min(std::max(to.x + std::cos(angles[i]) * step, 0.f), limit);
+				to.y = std::min(std::max(to.y + std::sin(angles[i]) * step, 0.f), limit);
+				if (!pxy.MoveTo(to) || to.x <= 0.f || to.y <= 0.f || to.x >= limit || to.y >= limit)
+				{
+					angles[i] += 2.f;
+					++blocked;
+				}
+			}
+		m_sink += blocked;
+		return uint64_t(MoveSteps) * MoveUnits;
+	}, count);
+	Add(param, "MoveTo", "ns", ns, count);
+}
+
+void Benchmark::RunPath(const MapGen::Param& param, TerrainData& terr)
+{
+	if (!Enabled("Region") && !Enabled("FindPath") && !Enabled("PathSmooth") && !Enabled("Hpa"))
+		return;
+	std::mt19937 rng(m_config.seed);
+	const uint32_t size = param.size;
+	TerrainInstance inst(&terr);
+	uint64_t count = 0;
+
+	VoxelRegion region(inst);
+	double ns = Measure([&]() {
+		region.Build();
+		return 1;
+	}, count);
+	if (Enabled("Region"))
+		Add(param, "RegionBuild", "ns", ns, count);
+
+	// 只取连通区域判断可达的起终点, 避免把大部分时间花在不可达的搜索上
+	std::vector<std::pair<VoxelPos, VoxelPos>> pairs;
+	for (uint32_t attempt = 0; attempt < PathPairs * 100 && pairs.size() < PathPairs; ++attempt)
+	{
+		VoxelPos start{ uint32_t(rng() % size), uint32_t(rng() % size), 0 };
+		start.layer = uint8_t(rng() % terr.GetVoxels(start.x, start.y).count);
+		uint32_t gx = uint32_t(std::min<int64_t>(std::max<int64_t>(int64_t(start.x) + int64_t(rng() % (PathRange * 2 + 1)) - PathRange, 0), size - 1));
+		uint32_t gy = uint32_t(std::min<int64_t>(std::max<int64_t>(int64_t(start.y) + int64_t(rng() % (PathRange * 2 + 1)) - PathRange, 0), size - 1));
+		VoxelPos goal{ gx, gy, uint8_t(rng() % terr.GetVoxels(gx, gy).count) };
+		if (start != goal && region.IsReachable(start, goal))
+			pairs.emplace_back(start, goal);
+	}
+	if (pairs.empty())
+		return;
+
+	std::vector<VoxelPos> path;
+	VoxelAStar astar;
+	auto findPath = [&](const char* name, VoxelAStar::Mode mode) {
+		if (!Enabled(name))
+			return;
+		astar.SetMode(mode);
+		double ns = Measure([&]() {
+			for (const auto& pair : pairs)
+			{
+				astar.FindPath(inst, pair.first, pair.second, path);
+				m_sink += path.size();
+			}
+			return pairs.size();
+		}, count);
+		Add(param, name, "ns", ns, count);
+	};
+	findPath("FindPathAStar", VoxelAStar::Mode::AStar);
+	findPath("FindPathJps", VoxelAStar::Mode::JumpPoint);
+
+	if (Enabled("PathSmooth"))
+	{
+		// 平滑耗时和原始路点数与平滑后路点数的比值
+		std::vector<std::vector<VoxelPos>> paths;
+		astar.SetMode(VoxelAStar::Mode::AStar);
+		for (const auto& pair : pairs)
+		{
+			astar.FindPath(inst, pair.first, pair.second, path);
+			if (path.size() > 1)
+				paths.push_back(path);
+		}
+		auto center = [&](const VoxelPos& cell) {
+			return Location((cell.x + 0.5f) * terr.GridSize(), (cell.y + 0.5f) * terr.GridSize(), terr.GetHight(terr.GetVoxels(cell.x, cell.y), cell.layer));
+		};
+		std::vector<Location> points;
+		// 跟随者按默认速度和16ms一步沿路点MoveTo, 与SysVoxelFindPath一样最后一步直接到达路点
+		// 平滑失败, 中途被挡或最后不在终点格子和layer上的路径计入lost
+		auto follow = [&](const std::vector<VoxelPos>& p) {
+			const float step = 100.f * 0.016f;
+			VoxelProxy follower(&inst, center(p.front()));
+			for (const auto& target : points)
+			{
+				for (;;)
+				{
+					Location cur = follower.GetLocation();
+					float dx = target.x - cur.x;
+					float dy = target.y - cur.y;
+					float dist = std::sqrt(dx * dx + dy * dy);
+					Location next = dist > step ? Location(cur.x + dx / dist * step, cur.y + dy / dist * step, cur.z) : Location(target.x, target.y, cur.z);
+					if (!follower.MoveTo(next))
+						return false;
+					if (dist <= step)
+						break;
+				}
+			}
+			const auto& goal = p.back();
+			return follower.GetGridX() == goal.x && follower.GetGridY() == goal.y && follower.GetLayer() == goal.layer;
+		};
+		auto smooth = [&](const char* name, PathSmooth::Mode mode) {
+			uint64_t raw = 0, smoothed = 0;
+			double ns = Measure([&]() {
+				raw = smoothed = 0;
+				for (const auto& p : paths)
+				{
+					PathSmooth::Smooth(inst, p.data(), uint32_t(p.size()), center(p.front()), center(p.back()), 0, mode, points);
+					raw += p.size() - 1;
+					smoothed += points.size();
+				}
+				m_sink += smoothed;
+				return paths.size();
+			}, count);
+			Add(param, name, "ns", ns, count);
+			std::string ratio = std::string(name) + "/ratio";
+			Add(param, ratio.c_str(), "x", smoothed > 0 ? double(raw) / smoothed : 0., paths.size());
+
+			uint64_t lost = 0;
+			for (const auto& p : paths)
+			{
+				if (!PathSmooth::Smooth(inst, p.data(), uint32_t(p.size()), center(p.front()), center(p.back()), 0, mode, points) || !follow(p))
+					++lost;
+			}
+			std::string lostName = std::string(name) + "/lost";
+			Add(param, lostName.c_str(), "paths", double(lost), paths.size());
+		};
+		smooth("PathSmooth", PathSmooth::Mode::StringPull);
+		smooth("PathSmoothFunnel", PathSmooth::Mode::Funnel);
+	}
+
+	if (!Enabled("Hpa"))
+		return;
+	VoxelHpa hpa(inst);
+	ns = Measure([&]() {
+		hpa.Build();
+		return 1;
+	}, count);
+	Add(param, "HpaBuild", "ns", ns, count);
+	ns = Measure([&]() {
+		for (const auto& pair : pairs)
+		{
+			hpa.FindPath(pair.first, pair.second, path);
+			m_sink += path.size();
+		}
+		return pairs.size();
+	}, count);
+	Add(param, "FindPathHpa", "ns", ns, count);
+}
+
+void Benchmark::WriteJson(std::ostream& os) const
+{
+	os << "{\n\t\"seed\": " << m_config.seed << ",\n\t\"rounds\": " << m_config.rounds << ",\n\t\"checksum\": " << m_sink << ",\n\t\"results\": [";
+	for (size_t i = 0; i < m_results.size(); ++i)
+	{
+		const auto& r = m_results[i];
+		os << (i == 0 ? "\n" : ",\n") << "\t\t{ \"map\": \"" << r.map << "\", \"size\": " << r.size
+			<< ", \"layers\": " << uint32_t(r.layers) << ", \"name\": \"" << r.name << "\", \"unit\": \"" << r.unit
+			<< "\", \"value\": " << std::fixed << std::setprecision(3) << r.value << ", \"count\": " << r.count << " }";
+	}
+	os << "\n\t]\n}\n";
+}
+
+// 逗号分隔的列表
+static std::vector<std::string> SplitList(const char* arg)
+{
+	std::vector<std::string> parts;
+	std::stringstream ss(arg);
+	std::string part;
+	while (std::getline(ss, part, ','))
+		if (!part.empty())
+			parts.push_back(part);
+	return parts;
+}
+
+bool Benchmark::ParseUInt(const std::string& s, uint32_t minValue, uint32_t maxValue, uint32_t& value)
+{
+	char* end = nullptr;
+	unsigned long v = strtoul(s.c_str(), &end, 10);
+	if (s.empty() || *end != '\0' || v < minValue || v > maxValue)
+		return false;
+	value = uint32_t(v);
+	return true;
+}
+
+int Benchmark::Main(int argc, char** argv)
+{
+	Config config;
+	const char* out = nullptr;
+	for (int i = 0; i < argc; ++i)
+	{
+		std::string key = argv[i];
+		if (i + 1 >= argc)
+		{
+			std::cerr << "missing value for " << key << std::endl;
+			return 1;
+		}
+		const char* value = argv[++i];
+		bool ok = true;
+		uint32_t v = 0;
+		if (key == "--kinds")
+		{
+			config.kinds.clear();
+			for (const auto& s : SplitList(value))
+			{
+				MapGen::Kind kind;
+				ok = ok && MapGen::ParseKind(s.c_str(), kind);
+				config.kinds.push_back(kind);
+			}
+		}
+		else if (key == "--sizes")
+		{
+			// 建筑地图要求边长大于最大建筑
+			config.sizes.clear();
+			for (const auto& s : SplitList(value))
+			{
+				ok = ok && ParseUInt(s, 64, 4096, v);
+				config.sizes.push_back(v);
+			}
+		}
+		else if (key == "--layers")
+		{
+			config.layers.clear();
+			for (const auto& s : SplitList(value))
+			{
+				ok = ok && ParseUInt(s, 1, 8, v);
+				config.layers.push_back(uint8_t(v));
+			}
+		}
+		else if (key == "--seed")
+			ok = ParseUInt(value, 0, 0xFFFFFFFF, config.seed);
+		else if (key == "--rounds")
+			ok = ParseUInt(value, 1, 1000, config.rounds);
+		else if (key == "--filter")
+			config.filter = SplitList(value);
+		else if (key == "--out")
+			out = value;
+		else
+			ok = false;
+		if (!ok)
+		{
+			std::cerr << "invalid argument " << key << ' ' << value << std::endl;
+			return 1;
+		}
+	}
+
+	// 进度输出到stderr, 不写文件时JSON输出到stdout
+	Benchmark bench(config);
+	bench.Run(std::cerr);
+	if (!out)
+	{
+		bench.WriteJson(std::cout);
+		return 0;
+	}
+	std::ofstream ofs(out);
+	if (!ofs)
+	{
+		std::cerr << "cannot open " << out << std::endl;
+		return 1;
+	}
+	bench.WriteJson(ofs);
+	return 0;
+}
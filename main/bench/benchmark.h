@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <ostream>
+#include "mapGen.h"
+
+// 性能基准: 按配置生成测试地图, 对导入导出, 附近关系, layer和掩码查询, 移动和寻路计时
+// 每项多轮取最快的一轮, 结果输出为JSON, 用于比较不同版本之间的性能变化
+class Benchmark
+{
+public:
+	struct Config
+	{
+		std::vector<MapGen::Kind> kinds = { MapGen::Kind::Flat, MapGen::Kind::Buildings, MapGen::Kind::Caves };
+		std::vector<uint32_t> sizes = { 256, 1024 };
+		std::vector<uint8_t> layers = { 1, 4, 8 };
+		uint32_t seed = 1;
+		uint32_t rounds = 3;
+		// 不为空时只运行名称包含其中之一的项目
+		std::vector<std::string> filter;
+	};
+
+	struct Result
+	{
+		std::string map;
+		uint32_t size;
+		uint8_t layers;
+		std::string name;
+		// 耗时为每次操作的ns, 内存为字节数
+		std::string unit;
+		double value;
+		// 每轮的操作次数
+		uint64_t count;
+	};
+
+private:
+	Config m_config;
+	std::vector<Result> m_results;
+	// 累加查询结果, 避免被优化掉
+	uint64_t m_sink = 0;
+
+	bool Enabled(const char* name) const;
+	void Add(const MapGen::Param& param, const char* name, const char* unit, double value, uint64_t count);
+
+	// 执行fn多轮, 返回最快一轮中每次操作的耗时(ns), fn返回本轮的操作次数
+	template<typename Fn>
+	double Measure(Fn fn, uint64_t& count) const;
+
+	void RunMap(const MapGen::Param& param);
+	void RunIO(const MapGen::Param& param, TerrainData& terr);
+	void RunQuery(const MapGen::Param& param, TerrainData& terr);
+	void RunMove(const MapGen::Param& param, TerrainData& terr);
+	void RunPath(const MapGen::Param& param, TerrainData& terr);
+
+public:
+	explicit Benchmark(const Config& config) : m_config(config) {}
+
+	// 运行全部地图, 进度输出到log
+	void Run(std::ostream& log);
+
+	const std::vector<Result>& Results() const { return m_results; }
+	void WriteJson(std::ostream& os) const;
+
+	// 命令行入口, 参数为bench之后的部分:
+	// [--kinds flat,buildings,caves] [--sizes 256,1024] [--layers 1,4,8] [--seed n] [--rounds n] [--filter a,b] [--out file]
+	static int Main(int argc, char** argv);
+
+	// 解析 [minValue, maxValue] 内的十进制整数, 命令行参数共用
+	static bool ParseUInt(const std::string& s, uint32_t minValue, uint32_t maxValue, uint32_t& value);
+};
@@ -0,0 +1,305 @@
+#include "pch.h"
+#include "loadTest.h"
+#include <chrono>
+#include <random>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <fstream>
+#include <cmath>
+#include "benchmark.h"
+#include "single_include/entt/entt.hpp"
+#include "compScene.h"
+#include "compDest.h"
+#include "compVoxelProxy.h"
+#include "compPath.h"
+#include "compFlow.h"
+#include "sysMoveByVelocity.h"
+#include "sysVoxelFindPath.h"
+#include "sysVoxelFlowMove.h"
+#include "sysScheduler.h"
+#include "path/pathService.h"
+#include "path/flowField.h"
+#include "utils/spatialIndex.h"
+#include "utils/profiler.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+// 爬坡的代理数上限
+static const uint32_t MaxAgents = 1 << 22;
+
+// 进程的峰值常驻内存
+static size_t PeakMemoryBytes()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return counters.PeakWorkingSetSize;
+	return 0;
+#else
+	rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+#ifdef __APPLE__
+	return size_t(usage.ru_maxrss);
+#else
+	return size_t(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+// 排好序的耗时中第p分位的值(最近秩)
+static double Percentile(const std::vector<double>& sorted, double p)
+{
+	if (sorted.empty())
+		return 0.;
+	size_t rank = size_t(std::ceil(p * sorted.size()));
+	return sorted[std::min(sorted.size(), std::max<size_t>(rank, 1)) - 1];
+}
+
+LoadTest::LoadTest(const Config& config)
+	: m_config(config), m_terr(MapGen::Create(config.map))
+{
+}
+
+LoadTest::Report LoadTest::Run(uint32_t agents)
+{
+	const TerrainData& terr = *m_terr;
+	const uint32_t size = terr.Length();
+	const float gridSize = terr.GridSize();
+	std::mt19937 rng(m_config.map.seed);
+
+	// 以 (cx, cy) 为中心range格以内的随机格子, 随机选一个layer站在上表面
+	auto randomLoc = [&](uint32_t cx, uint32_t cy, uint32_t range) {
+		uint32_t x = std::min(uint32_t(std::max<int64_t>(int64_t(cx) + int64_t(rng() % (range * 2 + 1)) - range, 0)), size - 1);
+		uint32_t y = std::min(uint32_t(std::max<int64_t>(int64_t(cy) + int64_t(rng() % (range * 2 + 1)) - range, 0)), size - 1);
+		auto vols = terr.GetVoxels(x, y);
+		return Location((x + 0.5f) * gridSize, (y + 0.5f) * gridSize, terr.GetHight(vols, uint8_t(rng() % vols.count)));
+	};
+
+	TerrainInstance inst(m_terr.get());
+	// 系统调度和异步寻路共用, 在寻路服务之后析构
+	ThreadPool pool(m_config.threads);
+	PathService pathService(inst, pool);
+	FlowFieldCache flowCache;
+	SysMoveByVelocity::Scratch moveScratch;
+	SpatialIndex spatial(terr.Length(), terr.Width(), gridSize);
+	entt::registry registry;
+	// 在索引之前析构, 析构时从索引中移除
+	std::vector<std::unique_ptr<VoxelProxy>> proxies;
+	proxies.reserve(agents);
+	for (uint32_t i = 0; i < agents; ++i)
+	{
+		auto entity = registry.create();
+		Location loc = randomLoc(uint32_t(rng() % size), uint32_t(rng() % size), 0);
+		registry.assign<CompScene>(entity, loc, Vector3(0.f, 0.f, 0.f));
+		registry.assign<CompDest>(entity);
+		proxies.emplace_back(new VoxelProxy(&inst, loc));
+		proxies.back()->Attach(&spatial, uint64_t(entity));
+		registry.assign<CompVexelProxy>(entity, proxies.back().get());
+		registry.assign<CompPath>(entity);
+	}
+
+	// 系统组合与TestECS一致, 随机目标改为在当前位置附近选取
+	SysScheduler scheduler(pool, m_config.step);
+	const uint32_t range = m_config.destRange;
+	scheduler.Add("RandMove", SysScheduler::Access().Read<CompScene>().Write<CompDest>(), [&](float) {
+		VOXEL_PROFILE_SCOPE("RandMove");
+		registry.view<CompScene, CompDest>().each([&](auto& scene, auto& dest) {
+			if (!dest.m_arrived)
+				return;
+			dest.m_loc = randomLoc(uint32_t(scene.m_loc.x / gridSize), uint32_t(scene.m_loc.y / gridSize), range);
+			dest.m_arrived = false;
+		});
+	});
+	scheduler.Add("FindPath", SysScheduler::Access().Read<CompVexelProxy, VoxelProxy>().Write<CompScene, CompDest, CompPath, PathService>(), [&registry, &pathService](float dt) {
+		SysVoxelFindPath::Update(dt, registry, pathService);
+	});
+	scheduler.Add("FlowMove", SysScheduler::Access().Read<CompVexelProxy, VoxelProxy, CompFlow>().Write<CompScene, CompDest, FlowFieldCache>(), [&registry, &flowCache](float dt) {
+		SysVoxelFlowMove::Update(dt, registry, flowCache);
+	});
+	scheduler.Add("MoveByVelocity", SysScheduler::Access().Read<CompVexelProxy>().Write<CompScene, VoxelProxy, SpatialIndex>(), [&registry, &pool, &moveScratch](float dt) {
+		SysMoveByVelocity::Update(dt, registry, pool, moveScratch);
+	});
+
+	// 不等待, 连续执行, 预热后开始统计
+	std::vector<double> times;
+	times.reserve(m_config.ticks);
+	scheduler.SetProfile(true);
+	auto begin = std::chrono::steady_clock::now();
+	for (uint32_t tick = 0; tick < m_config.warmup + m_config.ticks; ++tick)
+	{
+		if (tick == m_config.warmup)
+		{
+			scheduler.ResetProfile();
+#if VOXEL_PROFILE
+			Profiler::Instance().Reset();
+			if (!m_config.trace.empty())
+				Profiler::Instance().StartTrace();
+#endif
+			begin = std::chrono::steady_clock::now();
+		}
+		auto start = std::chrono::steady_clock::now();
+		scheduler.Run(m_config.step);
+		if (tick >= m_config.warmup)
+			times.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+	pathService.Wait();
+
+	Report report;
+	report.agents = agents;
+	report.ticks = m_config.ticks;
+	report.seconds = seconds;
+	report.ticksPerSecond = seconds > 0. ? m_config.ticks / seconds : 0.;
+	std::sort(times.begin(), times.end());
+	report.p50 = Percentile(times, 0.5);
+	report.p99 = Percentile(times, 0.99);
+	report.p999 = Percentile(times, 0.999);
+	report.max = times.empty() ? 0. : times.back();
+	double total = 0.;
+	for (uint32_t i = 0; i < scheduler.SystemCount(); ++i)
+		total += scheduler.SystemSeconds(i);
+	for (uint32_t i = 0; i < scheduler.SystemCount(); ++i)
+	{
+		double sec = scheduler.SystemSeconds(i);
+		report.systems.push_back(SystemTime{ scheduler.SystemName(i), m_config.ticks > 0 ? sec * 1000. / m_config.ticks : 0., total > 0. ? sec / total : 0. });
+	}
+	report.peakMemory = PeakMemoryBytes();
+#if VOXEL_PROFILE
+	auto& profiler = Profiler::Instance();
+	for (uint32_t c = 0; c < Profiler::CounterCount; ++c)
+		report.counters.emplace_back(Profiler::CounterName(Profiler::Counter(c)), double(profiler.Total(Profiler::Counter(c))) / std::max<uint64_t>(1, profiler.TickCount()));
+	if (!m_config.trace.empty())
+	{
+		profiler.StopTrace();
+		std::ofstream ofs(m_config.trace);
+		profiler.WriteChromeTrace(ofs);
+	}
+#endif
+	return report;
+}
+
+uint32_t LoadTest::Ramp(std::vector<Report>& reports)
+{
+	uint32_t good = 0;
+	uint32_t bad = 0;
+	for (uint32_t agents = std::max(1u, m_config.agents); ; agents *= 2)
+	{
+		reports.push_back(Run(agents));
+		if (!reports.back().InBudget(m_config.step))
+		{
+			bad = agents;
+			break;
+		}
+		good = agents;
+		if (agents >= MaxAgents)
+			return good;
+	}
+	// 二分到区间小于上界的5%
+	while (bad - good > std::max(1u, bad / 20))
+	{
+		uint32_t mid = good + (bad - good) / 2;
+		reports.push_back(Run(mid));
+		if (reports.back().InBudget(m_config.step))
+			good = mid;
+		else
+			bad = mid;
+	}
+	return good;
+}
+
+void LoadTest::Print(std::ostream& os, const Report& report)
+{
+	os << std::fixed << std::setprecision(3)
+		<< "agents " << report.agents << " ticks " << report.ticks << " tps " << std::setprecision(1) << report.ticksPerSecond
+		<< std::setprecision(3) << " p50 " << report.p50 << " p99 " << report.p99 << " p999 " << report.p999 << " max " << report.max
+		<< " ms, peak " << std::setprecision(1) << report.peakMemory / (1024. * 1024.) << " MB" << std::endl;
+	for (const auto& sys : report.systems)
+		os << "  " << std::left << std::setw(16) << sys.name << std::right << std::setprecision(3) << sys.ms << " ms "
+			<< std::setprecision(1) << sys.share * 100. << '%' << std::endl;
+	if (report.counters.empty())
+		return;
+	os << "  per tick:";
+	for (const auto& counter : report.counters)
+		os << ' ' << counter.first << ' ' << std::setprecision(1) << counter.second;
+	os << std::endl;
+}
+
+int LoadTest::Main(int argc, char** argv)
+{
+	Config config;
+	config.map.kind = MapGen::Kind::Buildings;
+	config.map.size = 1024;
+	config.map.maxLayers = 4;
+	for (int i = 0; i < argc; ++i)
+	{
+		std::string key = argv[i];
+		if (key == "--ramp")
+		{
+			config.ramp = true;
+			continue;
+		}
+		if (i + 1 >= argc)
+		{
+			std::cerr << "missing value for " << key << std::endl;
+			return 1;
+		}
+		std::string value = argv[++i];
+		bool ok = true;
+		uint32_t v = 0;
+		if (key == "--kind")
+			ok = MapGen::ParseKind(value.c_str(), config.map.kind);
+		else if (key == "--size")
+			ok = Benchmark::ParseUInt(value, 64, 4096, config.map.size);
+		else if (key == "--layers")
+		{
+			ok = Benchmark::ParseUInt(value, 1, 8, v);
+			config.map.maxLayers = uint8_t(v);
+		}
+		else if (key == "--seed")
+			ok = Benchmark::ParseUInt(value, 0, 0xFFFFFFFF, config.map.seed);
+		else if (key == "--agents")
+			ok = Benchmark::ParseUInt(value, 1, MaxAgents, config.agents);
+		else if (key == "--ticks")
+			ok = Benchmark::ParseUInt(value, 1, 1000000, config.ticks);
+		else if (key == "--warmup")
+			ok = Benchmark::ParseUInt(value, 0, 1000000, config.warmup);
+		else if (key == "--threads")
+			ok = Benchmark::ParseUInt(value, 0, 256, config.threads);
+		else if (key == "--trace")
+			config.trace = value;
+		else
+			ok = false;
+		if (!ok)
+		{
+			std::cerr << "invalid argument " << key << ' ' << value << std::endl;
+			return 1;
+		}
+	}
+
+#if !VOXEL_PROFILE
+	if (!config.trace.empty())
+		std::cerr << "--trace needs VOXEL_PROFILE=1, ignored" << std::endl;
+#endif
+	LoadTest test(config);
+	std::cout << MapGen::KindName(config.map.kind) << ' ' << config.map.size << 'x' << config.map.size
+		<< " L" << uint32_t(config.map.maxLayers) << ", step " << config.step * 1000.f << " ms" << std::endl;
+	if (!config.ramp)
+	{
+		Print(std::cout, test.Run(config.agents));
+		return 0;
+	}
+	std::vector<Report> reports;
+	uint32_t best = test.Ramp(reports);
+	for (const auto& report : reports)
+		Print(std::cout, report);
+	std::cout << "max agents within budget (p99): " << best << std::endl;
+	return 0;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <ostream>
+#include "mapGen.h"
+
+// 无界面的负载测试: 在生成的地图上创建代理, 按TestECS的系统组合连续执行固定的tick数, 不等待
+// 统计每秒tick数, tick耗时分位数, 各系统的耗时占比和峰值内存
+// 爬坡模式逐步增加代理数, 寻找p99 tick耗时仍在步长预算内的最大代理数
+class LoadTest
+{
+public:
+	struct Config
+	{
+		MapGen::Param map;
+		uint32_t agents = 1000;
+		uint32_t ticks = 600;
+		// 不计入统计的预热tick数
+		uint32_t warmup = 60;
+		float step = 1.f / 60.f;
+		// 系统线程池的线程数, 0为硬件线程数
+		uint32_t threads = 0;
+		// 随机目标离当前位置的最大距离(格子)
+		uint32_t destRange = 32;
+		bool ramp = false;
+		// 不为空时写入Chrome trace, 需要VOXEL_PROFILE, 爬坡时为最后一次运行
+		std::string trace;
+	};
+
+	struct SystemTime
+	{
+		std::string name;
+		// 每tick的平均耗时(ms)
+		double ms;
+		// 占全部系统耗时的比例
+		double share;
+	};
+
+	struct Report
+	{
+		uint32_t agents = 0;
+		uint32_t ticks = 0;
+		double seconds = 0.;
+		double ticksPerSecond = 0.;
+		// tick耗时(ms)
+		double p50 = 0.;
+		double p99 = 0.;
+		double p999 = 0.;
+		double max = 0.;
+		std::vector<SystemTime> systems;
+		// 每tick的平均计数, 需要VOXEL_PROFILE
+		std::vector<std::pair<std::string, double>> counters;
+		// 进程的峰值内存, 只增不减, 爬坡时为到目前为止的峰值
+		size_t peakMemory = 0;
+
+		bool InBudget(float step) const { return p99 <= step * 1000.; }
+	};
+
+private:
+	Config m_config;
+	std::unique_ptr<TerrainData> m_terr;
+
+public:
+	explicit LoadTest(const Config& config);
+
+	// 以agents个代理运行一次
+	Report Run(uint32_t agents);
+
+	// 从config.agents开始翻倍直到超出预算, 再二分到5%以内, 每次的结果追加到reports, 返回最大的在预算内的代理数
+	uint32_t Ramp(std::vector<Report>& reports);
+
+	static void Print(std::ostream& os, const Report& report);
+
+	// 命令行入口, 参数为load之后的部分:
+	// [--kind buildings] [--size 1024] [--layers 4] [--seed n] [--agents n] [--ticks n] [--warmup n] [--threads n] [--ramp] [--trace file]
+	static int Main(int argc, char** argv);
+};
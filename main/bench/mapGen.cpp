@@ -0,0 +1,187 @@
+#include "pch.h"
+#include "mapGen.h"
+#include <random>
+#include <vector>
+#include <cstring>
+
+const char* MapGen::KindName(Kind kind)
+{
+	switch (kind)
+	{
+	case Kind::Flat:
+		return "flat";
+	case Kind::Buildings:
+		return "buildings";
+	case Kind::Caves:
+		return "caves";
+	default:
+		return "unknown";
+	}
+}
+
+bool MapGen::ParseKind(const char* name, Kind& kind)
+{
+	for (auto k : { Kind::Flat, Kind::Buildings, Kind::Caves })
+	{
+		if (strcmp(name, KindName(k)) == 0)
+		{
+			kind = k;
+			return true;
+		}
+	}
+	return false;
+}
+
+std::unique_ptr<TerrainData> MapGen::Create(const Param& param)
+{
+	std::unique_ptr<TerrainData> terr(new TerrainData(param.size, param.size, 65535));
+	switch (param.kind)
+	{
+	case Kind::Flat:
+		GenFlat(*terr, param);
+		break;
+	case Kind::Buildings:
+		GenBuildings(*terr, param);
+		break;
+	case Kind::Caves:
+		GenCaves(*terr, param);
+		break;
+	}
+	terr->BuildNeighbor();
+	return terr;
+}
+
+uint32_t MapGen::Hash(uint32_t seed, uint32_t x, uint32_t y)
+{
+	uint32_t h = seed * 0x9E3779B1u ^ x * 0x85EBCA77u ^ y * 0xC2B2AE3Du;
+	h ^= h >> 15;
+	h *= 0x2C1B3C6Du;
+	h ^= h >> 12;
+	h *= 0x297A2D39u;
+	h ^= h >> 15;
+	return h;
+}
+
+uint32_t MapGen::Noise(uint32_t seed, uint32_t x, uint32_t y, uint32_t cell)
+{
+	uint32_t gx = x / cell, gy = y / cell;
+	int32_t fx = int32_t(x % cell), fy = int32_t(y % cell);
+	int32_t a = int32_t(Hash(seed, gx, gy) & 255);
+	int32_t b = int32_t(Hash(seed, gx + 1, gy) & 255);
+	int32_t c = int32_t(Hash(seed, gx, gy + 1) & 255);
+	int32_t d = int32_t(Hash(seed, gx + 1, gy + 1) & 255);
+	// 先沿x插值, 结果放大cell倍, 再沿y插值
+	int32_t top = a * int32_t(cell) + (b - a) * fx;
+	int32_t bottom = c * int32_t(cell) + (d - c) * fx;
+	return uint32_t((top * int32_t(cell) + (bottom - top) * fy) / int32_t(cell * cell));
+}
+
+void MapGen::GenFlat(TerrainData& terr, const Param& param)
+{
+	uint16_t spans[15];
+	for (uint8_t i = 0; i < param.maxLayers; ++i)
+	{
+		if (i > 0)
+			spans[i * 2 - 1] = uint16_t(i * StoryHeight - FloorThick);
+		spans[i * 2] = uint16_t(i * StoryHeight);
+	}
+	for (uint32_t y = 0; y < param.size; ++y)
+		for (uint32_t x = 0; x < param.size; ++x)
+			terr.AddVoxels(x, y, param.maxLayers, spans);
+}
+
+void MapGen::GenBuildings(TerrainData& terr, const Param& param)
+{
+	const uint32_t size = param.size;
+	std::mt19937 rng(param.seed);
+	// 每格所在建筑的层数(0为室外), 地基高度和是否为墙
+	std::vector<uint8_t> stories(size_t(size) * size, 0);
+	std::vector<uint16_t> base(size_t(size) * size, 0);
+	std::vector<uint8_t> wall(size_t(size) * size, 0);
+	auto ground = [&](uint32_t x, uint32_t y) { return uint16_t(Noise(param.seed, x, y, 64) / 8); };
+
+	// 平均每32x32格一栋, 后放的建筑覆盖先放的
+	uint32_t count = size * size / 1024;
+	for (uint32_t n = 0; n < count; ++n)
+	{
+		uint32_t w = 8 + rng() % 24;
+		uint32_t h = 8 + rng() % 24;
+		uint32_t bx = rng() % (size - w);
+		uint32_t by = rng() % (size - h);
+		uint8_t floors = uint8_t(param.maxLayers > 1 ? 2 + rng() % (param.maxLayers - 1) : 1);
+		uint16_t floor = ground(bx, by);
+		for (uint32_t y = by; y < by + h; ++y)
+			for (uint32_t x = bx; x < bx + w; ++x)
+			{
+				size_t index = size_t(y) * size + x;
+				bool edge = x == bx || x == bx + w - 1 || y == by || y == by + h - 1;
+				bool door = x == bx + w / 2 || y == by + h / 2;
+				stories[index] = floors;
+				base[index] = floor;
+				wall[index] = edge && !door;
+			}
+	}
+
+	uint16_t spans[15];
+	for (uint32_t y = 0; y < size; ++y)
+		for (uint32_t x = 0; x < size; ++x)
+		{
+			size_t index = size_t(y) * size + x;
+			uint8_t floors = stories[index];
+			if (floors == 0)
+			{
+				spans[0] = ground(x, y);
+				terr.AddVoxels(x, y, 1, spans);
+			}
+			else if (wall[index])
+			{
+				// 墙是到屋顶的实心柱
+				spans[0] = uint16_t(base[index] + floors * StoryHeight);
+				terr.AddVoxels(x, y, 1, spans);
+			}
+			else
+			{
+				spans[0] = base[index];
+				for (uint8_t i = 1; i < floors; ++i)
+				{
+					spans[i * 2 - 1] = uint16_t(base[index] + i * StoryHeight - FloorThick);
+					spans[i * 2] = uint16_t(base[index] + i * StoryHeight);
+				}
+				terr.AddVoxels(x, y, floors, spans);
+			}
+		}
+}
+
+void MapGen::GenCaves(TerrainData& terr, const Param& param)
+{
+	// 洞穴的净空, 小于层高, 保证洞顶低于上一层的地面
+	const uint16_t clearance = 250;
+	uint8_t levels = uint8_t(param.maxLayers - 1);
+	uint16_t spans[15];
+	for (uint32_t y = 0; y < param.size; ++y)
+		for (uint32_t x = 0; x < param.size; ++x)
+		{
+			uint8_t layerNum = 0;
+			uint16_t ceiling = 0;
+			auto push = [&](uint16_t upper, uint16_t top) {
+				if (layerNum > 0)
+					spans[layerNum * 2 - 1] = ceiling;
+				spans[layerNum * 2] = upper;
+				ceiling = top;
+				++layerNum;
+			};
+			// 噪声值落在中间一段的格子连成蜿蜒的通道, 每层用不同的种子
+			for (uint8_t i = 0; i < levels; ++i)
+			{
+				uint32_t band = Noise(param.seed + 1 + i, x, y, 32);
+				if (band >= 112 && band < 144)
+				{
+					uint16_t floor = uint16_t(i * StoryHeight + Noise(param.seed + 101 + i, x, y, 64) / 4);
+					push(floor, uint16_t(floor + clearance));
+				}
+			}
+			uint16_t surface = uint16_t(levels * StoryHeight + 100 + Noise(param.seed, x, y, 64) / 2 + Noise(param.seed + 97, x, y, 16) / 8);
+			push(surface, 0);
+			terr.AddVoxels(x, y, layerNum, spans);
+		}
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+#include <memory>
+#include "voxel.h"
+
+// 可重复的测试地图, 相同参数在任何平台上生成相同的地形
+// 只使用整数运算和std::mt19937的原始输出, 不依赖标准库分布的实现
+class MapGen
+{
+public:
+	enum class Kind : uint8_t
+	{
+		// 每格maxLayers层等间距的平台
+		Flat,
+		// 起伏地面上随机放置多层建筑, 建筑内每层一个layer, 四周是墙, 每面墙中间有门
+		Buildings,
+		// 起伏地面下有多层蜿蜒的洞穴
+		Caves,
+	};
+
+	struct Param
+	{
+		Kind kind = Kind::Flat;
+		// 地图边长, 单位为格子
+		uint32_t size = 256;
+		// 每格最多的layer数, 1到8
+		uint8_t maxLayers = 1;
+		uint32_t seed = 1;
+	};
+
+	// 层高和楼板厚度, 单位为span
+	static const uint16_t StoryHeight = 400;
+	static const uint16_t FloorThick = 40;
+
+	static const char* KindName(Kind kind);
+	// 名称不匹配返回false
+	static bool ParseKind(const char* name, Kind& kind);
+
+	// 按参数生成地形并建立附近关系
+	static std::unique_ptr<TerrainData> Create(const Param& param);
+
+private:
+	static uint32_t Hash(uint32_t seed, uint32_t x, uint32_t y);
+	// 格点间距为cell的值噪声, 整数双线性插值, 返回 [0, 256)
+	static uint32_t Noise(uint32_t seed, uint32_t x, uint32_t y, uint32_t cell);
+
+	static void GenFlat(TerrainData& terr, const Param& param);
+	static void GenBuildings(TerrainData& terr, const Param& param);
+	static void GenCaves(TerrainData& terr, const Param& param);
+};
@@ -0,0 +1,7 @@
+#pragma once
+
+// 沿共享流场移动, 代替CompPath
+struct CompFlow
+{
+	float m_speed = 100.f;
+};
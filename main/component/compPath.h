@@ -0,0 +1,19 @@
+#pragma once
+
+#include "typedef.h"
+#include <vector>
+
+struct CompPath
+{
+	// 路点对应的目标, 与CompDest不同时重新寻路
+	Location m_dest;
+	// 路点, 最后一个为目标位置
+	std::vector<Location> m_points;
+	uint32_t m_index = 0;
+	bool m_valid = false;
+	// 进行中的寻路请求, 0表示没有
+	uint32_t m_request = 0;
+	// 寻路请求的优先级, 越大越先处理
+	uint8_t m_priority = 0;
+	float m_speed = 100.f;
+};
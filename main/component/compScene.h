@@ -6,4 +6,6 @@ struct CompScene
 {
 	Location m_loc;
 	Vector3 m_velocity;
+	// 上一次按速度移动时被挡住, 停在挡住处
+	bool m_blocked = false;
 };
\ No newline at end of file
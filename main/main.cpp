@@ -6,15 +6,31 @@
 #include "voxel.h"
 #include <sstream>
 #include <streambuf>
+#include <cstring>
 #include "single_include/entt/entt.hpp"
 #include "utils/rand.h"
 #include "utils/math.h"
 #include "compScene.h"
 #include "compDest.h"
 #include "compVoxelProxy.h"
+#include "compPath.h"
+#include "compFlow.h"
 #include <thread>
 #include <chrono>
 #include "sysMoveByVelocity.h"
+#include "sysVoxelFindPath.h"
+#include "sysVoxelFlowMove.h"
+#include "sysScheduler.h"
+#include "path/pathService.h"
+#include "path/flowField.h"
+#include "path/voxelRegion.h"
+#include "path/voxelAStar.h"
+#include "path/voxelHpa.h"
+#include "bench/mapGen.h"
+#include <random>
+#include <unordered_map>
+#include "bench/benchmark.h"
+#include "bench/loadTest.h"
 
 
 
@@ -34,8 +50,12 @@ void TestVoxel()
 	{
 		TerrainData terr(3, 3, 3);
 		std::istream is(&sb);
-		terr.Import(is);
-		auto& voxel = terr.GetVoxels(1, 1);
+		if (!terr.Import(is))
+		{
+			std::cout << "import failed" << std::endl;
+			return;
+		}
+		auto voxel = terr.GetVoxels(1, 1);
 		auto layer = terr.GetLayer(voxel, 10.f);
 		for (uint8_t dir = 0; dir <= uint8_t(Direction::LF); dir++)
 		{
@@ -48,6 +68,300 @@ void TestVoxel()
 
 }
 
+// 相同的列合并span前后的内存占用
+void TestCompactTerrain()
+{
+	auto print = [](const char* name, const TerrainData::MemoryStats& stats) {
+		std::cout << name << ": grid " << stats.gridBytes << " span " << stats.spanBytes
+			<< " neighbor " << stats.neighborBytes << " total " << stats.Total() << std::endl;
+	};
+	float spans[] = { 0.f, 100.f, 300.f };
+	TerrainData terr(256, 256, 3);
+	for (uint32_t i = 0; i < terr.Length(); ++i)
+		for (uint32_t j = 0; j < terr.Width(); ++j)
+			terr.AddVoxels(i, j, 2, spans);
+	terr.BuildNeighbor();
+	print("plain", terr.GetMemoryStats());
+	std::cout << "dedup saved " << terr.Dedup() << std::endl;
+	print("dedup", terr.GetMemoryStats());
+
+	TerrainData compact(256, 256, 3);
+	compact.SetCompactBuild(true);
+	for (uint32_t i = 0; i < compact.Length(); ++i)
+		for (uint32_t j = 0; j < compact.Width(); ++j)
+			compact.AddVoxels(i, j, 2, spans);
+	compact.SetCompactBuild(false);
+	compact.BuildNeighbor();
+	print("compact build", compact.GetMemoryStats());
+}
+
+// 增量修改地形: SetVoxels后的附近关系与从相同体素全部重建的结果一致
+void TestIncrementalNeighbor()
+{
+	MapGen::Param param;
+	param.kind = MapGen::Kind::Caves;
+	param.size = 64;
+	param.maxLayers = 4;
+	param.seed = 3;
+	auto terr = MapGen::Create(param);
+	std::mt19937 rng(1);
+
+	uint32_t diff = 0;
+	for (uint32_t round = 0; round < 20; ++round)
+	{
+		// 每轮随机修改一些小矩形, 层数1到4
+		for (uint32_t i = 0; i < 50; ++i)
+		{
+			uint8_t layerNum = uint8_t(1 + rng() % 4);
+			uint16_t spans[8];
+			for (uint32_t k = 0; k < 8; ++k)
+				spans[k] = uint16_t(k * 200 + rng() % 100);
+			uint32_t x = uint32_t(rng() % terr->Length());
+			uint32_t y = uint32_t(rng() % terr->Width());
+			GridRect rect{ x, y, std::min(x + uint32_t(rng() % 3), terr->Length() - 1), std::min(y + uint32_t(rng() % 3), terr->Width() - 1) };
+			terr->SetVoxels(rect, layerNum, spans);
+		}
+
+		TerrainData full(terr->Length(), terr->Width(), terr->Height());
+		for (uint32_t x = 0; x < terr->Length(); ++x)
+			for (uint32_t y = 0; y < terr->Width(); ++y)
+			{
+				auto vols = terr->GetVoxels(x, y);
+				full.AddVoxels(x, y, vols.count, vols.spans);
+			}
+		full.BuildNeighbor();
+		for (uint32_t x = 0; x < terr->Length(); ++x)
+			for (uint32_t y = 0; y < terr->Width(); ++y)
+			{
+				auto a = terr->GetVoxels(x, y);
+				auto b = full.GetVoxels(x, y);
+				if (a.count != b.count)
+				{
+					++diff;
+					continue;
+				}
+				for (uint8_t layer = 0; layer < a.count; ++layer)
+					if (terr->GetHight(a, layer) != full.GetHight(b, layer) || terr->GetNeighborLayer(a, layer) != full.GetNeighborLayer(b, layer))
+						++diff;
+			}
+	}
+	std::cout << "incremental neighbor diff " << diff << std::endl;
+}
+
+// 连通区域: 增量Update与重新Build的划分一致, 能找到路径的两点一定IsReachable
+void TestRegion()
+{
+	MapGen::Param param;
+	param.kind = MapGen::Kind::Caves;
+	param.size = 64;
+	param.maxLayers = 4;
+	param.seed = 3;
+	auto data = MapGen::Create(param);
+	TerrainInstance terr(data.get());
+	VoxelRegion region(terr);
+	region.Build();
+	std::mt19937 rng(1);
+
+	// 区域号可以不同, 两边的区域必须一一对应
+	auto samePartition = [&terr, &data](const VoxelRegion& a) {
+		VoxelRegion b(terr);
+		b.Build();
+		std::unordered_map<uint32_t, uint32_t> ab, ba;
+		for (uint32_t x = 0; x < data->Length(); ++x)
+			for (uint32_t y = 0; y < data->Width(); ++y)
+				for (uint8_t layer = 0; layer < data->GetVoxels(x, y).count; ++layer)
+				{
+					uint32_t ra = a.Region(VoxelPos{ x, y, layer });
+					uint32_t rb = b.Region(VoxelPos{ x, y, layer });
+					if ((ra == VoxelRegion::NoRegion) != (rb == VoxelRegion::NoRegion))
+						return false;
+					if (ra == VoxelRegion::NoRegion)
+						continue;
+					if (ab.emplace(ra, rb).first->second != rb || ba.emplace(rb, ra).first->second != ra)
+						return false;
+				}
+		return true;
+	};
+	auto randomPos = [&rng, &data]() {
+		uint32_t x = uint32_t(rng() % data->Length());
+		uint32_t y = uint32_t(rng() % data->Width());
+		return VoxelPos{ x, y, uint8_t(rng() % data->GetVoxels(x, y).count) };
+	};
+
+	// 随机放置和移除墙, 每步检查
+	std::vector<VoxelPos> walls;
+	uint32_t mismatch = 0, unreachable = 0;
+	VoxelAStar astar;
+	std::vector<VoxelPos> path;
+	for (uint32_t step = 0; step < 64; ++step)
+	{
+		if (walls.empty() || rng() % 3 != 0)
+		{
+			// 横竖一条, 容易切断洞穴
+			VoxelPos pos = randomPos();
+			bool horz = rng() % 2 == 0;
+			for (uint32_t i = 0; i < 8; ++i)
+			{
+				VoxelPos cell{ horz ? std::min(pos.x + i, data->Length() - 1) : pos.x, horz ? pos.y : std::min(pos.y + i, data->Width() - 1), pos.layer };
+				if (cell.layer >= data->GetVoxels(cell.x, cell.y).count)
+					continue;
+				terr.AddMask(cell.x, cell.y, cell.layer);
+				region.Update(GridRect{ cell.x, cell.y, cell.x, cell.y });
+				walls.push_back(cell);
+			}
+		}
+		else
+		{
+			for (uint32_t i = 0; i < 8 && !walls.empty(); ++i)
+			{
+				VoxelPos cell = walls.back();
+				walls.pop_back();
+				terr.DecMask(cell.x, cell.y, cell.layer);
+				region.Update(GridRect{ cell.x, cell.y, cell.x, cell.y });
+			}
+		}
+		if (!samePartition(region))
+			++mismatch;
+		for (uint32_t i = 0; i < 16; ++i)
+		{
+			VoxelPos from = randomPos(), to = randomPos();
+			if (astar.FindPath(terr, from, to, path) == VoxelAStar::Result::Found && !region.IsReachable(from, to))
+				++unreachable;
+		}
+	}
+	std::cout << "region mismatch " << mismatch << " unreachable " << unreachable << std::endl;
+}
+
+// 分层寻路: 随机修改掩码后增量重建的结果与重新Build一致, 路径每一步都能走通
+void TestHpa()
+{
+	for (auto kind : { MapGen::Kind::Flat, MapGen::Kind::Buildings, MapGen::Kind::Caves })
+	{
+		MapGen::Param param;
+		param.kind = kind;
+		param.size = 128;
+		param.maxLayers = 2;
+		auto data = MapGen::Create(param);
+		TerrainInstance terr(data.get());
+		VoxelHpa hpa(terr);
+		std::mt19937 rng(1);
+		auto randomPos = [&rng, &data]() {
+			uint32_t x = uint32_t(rng() % data->Length());
+			uint32_t y = uint32_t(rng() % data->Width());
+			return VoxelPos{ x, y, uint8_t(rng() % data->GetVoxels(x, y).count) };
+		};
+		// 相邻两格都要按StepOnce一步走到, 终点正确
+		auto legal = [&terr](const std::vector<VoxelPos>& path, const VoxelPos& start, const VoxelPos& goal) {
+			if (path.empty() || path.front() != start || path.back() != goal)
+				return false;
+			for (size_t i = 1; i < path.size(); ++i)
+			{
+				uint8_t dir = 0;
+				while (dir < 8 && (int64_t(path[i - 1].x) + TerrainData::DirectionOffsetX[dir] != int64_t(path[i].x) || int64_t(path[i - 1].y) + TerrainData::DirectionOffsetY[dir] != int64_t(path[i].y)))
+					++dir;
+				VoxelPos out;
+				if (dir == 8 || !VoxelAStar::StepOnce(terr, path[i - 1], dir, 0, out) || out != path[i])
+					return false;
+			}
+			return true;
+		};
+
+		uint32_t queries = 0, found = 0, bad = 0, mismatch = 0;
+		std::vector<VoxelPos> path, freshPath;
+		for (uint32_t round = 0; round < 30; ++round)
+		{
+			for (uint32_t i = 0; i < 40; ++i)
+			{
+				VoxelPos pos = randomPos();
+				terr.AddMask(pos.x, pos.y, pos.layer);
+			}
+			VoxelHpa fresh(terr);
+			for (uint32_t i = 0; i < 30; ++i)
+			{
+				VoxelPos start = randomPos(), goal = randomPos();
+				auto result = hpa.FindPath(start, goal, path);
+				auto freshResult = fresh.FindPath(start, goal, freshPath);
+				++queries;
+				if (result != freshResult)
+					++mismatch;
+				if (result != VoxelAStar::Result::Found)
+					continue;
+				++found;
+				if (!legal(path, start, goal))
+					++bad;
+			}
+		}
+		std::cout << "hpa " << MapGen::KindName(kind) << " queries " << queries << " found " << found << " bad " << bad << " mismatch " << mismatch << std::endl;
+	}
+}
+
+// 掩码增量: 副本每tick应用主实例的增量后查询结果一致, 截断和重复的增量被拒绝
+void TestMaskDelta()
+{
+	MapGen::Param param;
+	param.kind = MapGen::Kind::Flat;
+	param.size = 96;
+	param.maxLayers = 2;
+	auto data = MapGen::Create(param);
+	TerrainInstance master(data.get());
+	TerrainInstance replica(data.get());
+	std::mt19937 rng(1);
+
+	struct Mask
+	{
+		uint32_t x, y;
+		uint8_t layer, radius;
+	};
+	std::vector<Mask> masks;
+	std::vector<uint8_t> delta;
+	uint32_t mismatch = 0, badApply = 0;
+	size_t bytes = 0;
+	for (uint32_t tick = 0; tick < 200; ++tick)
+	{
+		auto base = master.TakeSnapshot();
+		auto baseMasks = masks;
+		for (uint32_t i = 0; i < 16; ++i)
+		{
+			if (masks.empty() || rng() % 3 != 0)
+			{
+				Mask m{ uint32_t(rng() % data->Length()), uint32_t(rng() % data->Width()), uint8_t(rng() % 2), uint8_t(rng() % 3) };
+				master.AddMask(m.x, m.y, m.layer, m.radius);
+				masks.push_back(m);
+			}
+			else
+			{
+				std::swap(masks[rng() % masks.size()], masks.back());
+				const Mask& m = masks.back();
+				master.DecMask(m.x, m.y, m.layer, m.radius);
+				masks.pop_back();
+			}
+		}
+		// 偶尔回滚本tick的修改
+		if (rng() % 8 == 0)
+		{
+			master.Restore(base);
+			masks = baseMasks;
+		}
+
+		delta.clear();
+		master.EncodeDelta(base, delta);
+		bytes += delta.size();
+		if (replica.ApplyDelta(delta.data(), delta.size() - 1))
+			++badApply;
+		if (!replica.ApplyDelta(delta.data(), delta.size()))
+			++badApply;
+		if (replica.ApplyDelta(delta.data(), delta.size()) || replica.MaskVersion() != master.MaskVersion())
+			++badApply;
+
+		for (uint32_t x = 0; x < data->Length(); ++x)
+			for (uint32_t y = 0; y < data->Width(); ++y)
+				for (uint8_t layer = 0; layer < 2; ++layer)
+					for (uint8_t radius = 0; radius < 2; ++radius)
+						if (master.IsMask(x, y, layer, radius) != replica.IsMask(x, y, layer, radius))
+							++mismatch;
+	}
+	std::cout << "delta mismatch " << mismatch << " bad apply " << badApply << " bytes/tick " << bytes / 200 << std::endl;
+}
 
 void UpdateRandMove(entt::registry& registry)
 {
@@ -58,6 +372,7 @@ void UpdateRandMove(entt::registry& registry)
 			dest.m_loc.x = Rand::RandFloat(0.f, 145.f);
 			dest.m_loc.y = Rand::RandFloat(0.f, 145.f);
 			dest.m_loc.z = 10.f;
+			dest.m_arrived = false;
 		}
 
 	});
@@ -73,6 +388,13 @@ void TestECS()
 	terr.BuildNeighbor();
 
 	TerrainInstance terr_ins(&terr);
+	// 系统调度和异步寻路共用, 在寻路服务之后析构
+	ThreadPool pool;
+	PathService path_service(terr_ins, pool);
+	FlowFieldCache flow_cache;
+	SysMoveByVelocity::Scratch move_scratch;
+
+	SpatialIndex spatial(terr.Length(), terr.Width(), terr.GridSize());
 
 	entt::registry registry;
 	float dt = 0.016f;
@@ -81,20 +403,51 @@ void TestECS()
 		auto entity = registry.create();
 		registry.assign<CompScene>(entity, Location(1.f, 1.f, 1.f), Vector3(10.f, 0.f, 0.f));
 		registry.assign<CompDest>(entity);
-		registry.assign<CompVexelProxy>(entity, new VoxelProxy(&terr_ins, Location(1.f, 1.f, 1.f)));
+		auto pxy = new VoxelProxy(&terr_ins, Location(1.f, 1.f, 1.f));
+		pxy->Attach(&spatial, uint64_t(entity));
+		registry.assign<CompVexelProxy>(entity, pxy);
+		registry.assign<CompPath>(entity);
 	}
 
+	// 组件和服务的读写声明决定执行顺序, 不冲突的系统并行执行
+	SysScheduler scheduler(pool, dt);
+	scheduler.Add("RandMove", SysScheduler::Access().Read<CompScene>().Write<CompDest>(), [&registry](float) {
+		UpdateRandMove(registry);
+	});
+	scheduler.Add("FindPath", SysScheduler::Access().Read<CompVexelProxy, VoxelProxy>().Write<CompScene, CompDest, CompPath, PathService>(), [&registry, &path_service](float dt) {
+		SysVoxelFindPath::Update(dt, registry, path_service);
+	});
+	scheduler.Add("FlowMove", SysScheduler::Access().Read<CompVexelProxy, VoxelProxy, CompFlow>().Write<CompScene, CompDest, FlowFieldCache>(), [&registry, &flow_cache](float dt) {
+		SysVoxelFlowMove::Update(dt, registry, flow_cache);
+	});
+	scheduler.Add("MoveByVelocity", SysScheduler::Access().Read<CompVexelProxy>().Write<CompScene, VoxelProxy, SpatialIndex>(), [&registry, &pool, &move_scratch](float dt) {
+		SysMoveByVelocity::Update(dt, registry, pool, move_scratch);
+	});
+
+	// 固定步长推进, 落后时补帧, 空闲时等到下一步
+	auto last = std::chrono::steady_clock::now();
 	for (;;)
 	{
-		//UpdateRandMove(registry);
-		SysMoveByVelocity::Update(dt, registry);
-		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		auto now = std::chrono::steady_clock::now();
+		scheduler.Advance(std::chrono::duration<float>(now - last).count());
+		last = now;
+		std::this_thread::sleep_for(std::chrono::duration<float>(scheduler.Remaining()));
 	}
 }
 
-int main()
+int main(int argc, char** argv)
 {
+	// main bench [参数], 见Benchmark::Main; main load [参数], 见LoadTest::Main
+	if (argc > 1 && strcmp(argv[1], "bench") == 0)
+		return Benchmark::Main(argc - 2, argv + 2);
+	if (argc > 1 && strcmp(argv[1], "load") == 0)
+		return LoadTest::Main(argc - 2, argv + 2);
 // 	TestVoxel();
+// 	TestCompactTerrain();
+// 	TestIncrementalNeighbor();
+// 	TestRegion();
+// 	TestHpa();
+// 	TestMaskDelta();
 	TestECS();
     std::cout << "Hello World!\n"; 
 }
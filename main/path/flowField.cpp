@@ -0,0 +1,162 @@
+#include "pch.h"
+#include "flowField.h"
+#include "voxelAStar.h"
+#include <queue>
+#include <functional>
+
+FlowField::FlowField(const TerrainInstance& terr, const VoxelPos& goal, uint8_t radius)
+	: m_data(&terr.GetData()), m_goal(goal), m_radius(radius), m_rect(GridRect::Empty())
+{
+	const auto& data = *m_data;
+	m_chunkBase.resize(data.ChunkCount() + 1);
+	uint32_t base = 0;
+	for (uint32_t c = 0; c < data.ChunkCount(); ++c)
+	{
+		m_chunkBase[c] = base;
+		base += data.SlotCount(c);
+	}
+	m_chunkBase.back() = base;
+	m_dirs.assign(base, NoDir);
+	if (!data.IsValidGrid(goal.x, goal.y) || goal.layer >= data.GetVoxels(goal.x, goal.y).count)
+		return;
+
+	// 反向扩展: 弹出v后找所有能一步走到v的u, u的方向指向v
+	typedef std::pair<float, uint32_t> Entry;
+	std::vector<float> dist(base, -1.f);
+	std::vector<VoxelPos> cells;
+	std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> open;
+	uint32_t goalSlot = Slot(goal);
+	dist[goalSlot] = 0.f;
+	m_dirs[goalSlot] = GoalDir;
+	cells.push_back(goal);
+	open.emplace(0.f, 0);
+	while (!open.empty())
+	{
+		Entry top = open.top();
+		open.pop();
+		const VoxelPos v = cells[top.second];
+		if (top.first > dist[Slot(v)])
+			continue;
+		m_rect.Merge(GridRect{ v.x, v.y, v.x, v.y });
+		// 被掩码占住的格子不能走进去, 只记录从它出发的方向; 目标被占住时与VoxelAStar一样不可达
+		if (terr.IsMask(v.x, v.y, v.layer, radius))
+			continue;
+
+		for (uint8_t dir = 0; dir < 8; ++dir)
+		{
+			// u沿dir走到v
+			uint32_t ux = v.x, uy = v.y;
+			data.CalcDirectionGrid(Direction((dir + 4) & 7), ux, uy);
+			if (!data.IsValidGrid(ux, uy))
+				continue;
+			auto vols = data.GetVoxels(ux, uy);
+			for (uint8_t layer = 0; layer < vols.count; ++layer)
+			{
+				// 同VoxelAStar::StepOnce, v的掩码已在上面检查
+				auto rel = data.GetNeighborLayerRelation(vols, layer, Direction(dir));
+				if (rel == LayerRelation::Unknow || TerrainData::RelationToLayer(layer, rel) != v.layer)
+					continue;
+				VoxelPos u{ ux, uy, layer };
+				// 斜向不能穿过墙角
+				if ((dir & 1) && !VoxelAStar::CornerFree(terr, u, dir, radius, v))
+					continue;
+				float d = top.first + ((dir & 1) ? VoxelAStar::DiagonalCost : VoxelAStar::StraightCost);
+				uint32_t slot = Slot(u);
+				if (dist[slot] >= 0.f && dist[slot] <= d)
+					continue;
+				dist[slot] = d;
+				m_dirs[slot] = dir;
+				cells.push_back(u);
+				open.emplace(d, (uint32_t)cells.size() - 1);
+			}
+		}
+	}
+}
+
+uint32_t FlowField::Slot(const VoxelPos& pos) const
+{
+	auto vols = m_data->GetVoxels(pos.x, pos.y);
+	return m_chunkBase[m_data->ChunkIndex(pos.x, pos.y)] + vols.slot + pos.layer;
+}
+
+bool FlowField::IsValid(const TerrainData& data) const
+{
+	if (&data != m_data || m_chunkBase.size() != data.ChunkCount() + 1)
+		return false;
+	// 分块的layer数变化后全局序号错位
+	uint32_t base = 0;
+	for (uint32_t c = 0; c < data.ChunkCount(); ++c)
+	{
+		if (m_chunkBase[c] != base)
+			return false;
+		base += data.SlotCount(c);
+	}
+	return m_chunkBase.back() == base;
+}
+
+bool FlowField::IsAffected(const GridRect& rect) const
+{
+	// 带半径的掩码会影响周围radius格
+	GridRect r = rect.Expand(m_radius, UINT32_MAX, UINT32_MAX);
+	// 区域外修改也可能打通新的通路, 只要与可达范围相邻就受影响
+	return r.Intersects(m_rect.Expand(1, UINT32_MAX, UINT32_MAX));
+}
+
+uint8_t FlowField::GetDir(const VoxelPos& pos) const
+{
+	if (!m_rect.Contains(pos.x, pos.y) || pos.layer >= m_data->GetVoxels(pos.x, pos.y).count)
+		return NoDir;
+	return m_dirs[Slot(pos)];
+}
+
+bool FlowField::Next(const TerrainInstance& terr, const VoxelPos& pos, VoxelPos& next) const
+{
+	uint8_t dir = GetDir(pos);
+	if (dir >= 8)
+		return false;
+	// 方向由地形关系决定, 走一步得到目标layer
+	return VoxelAStar::StepOnce(terr, pos, dir, 0, next);
+}
+
+std::shared_ptr<const FlowField> FlowFieldCache::Get(const TerrainInstance& terr, const VoxelPos& goal, uint8_t radius)
+{
+	Key key{ goal, radius };
+	auto it = m_map.find(key);
+	if (it != m_map.end())
+	{
+		auto& entry = *it->second;
+		bool valid = entry.terr == &terr && entry.changeCount == terr.ChangeCount();
+		if (!valid && entry.terr == &terr && entry.field->IsValid(terr.GetData()))
+		{
+			bool affected = false;
+			valid = terr.ForEachChange(entry.changeCount, [&](const GridRect& rect) {
+				affected = affected || entry.field->IsAffected(rect);
+			}) && !affected;
+		}
+		if (valid)
+		{
+			entry.changeCount = terr.ChangeCount();
+			m_list.splice(m_list.begin(), m_list, it->second);
+			return entry.field;
+		}
+		m_list.erase(it->second);
+		m_map.erase(it);
+	}
+
+	auto field = std::make_shared<const FlowField>(terr, goal, radius);
+	++m_buildCount;
+	m_list.push_front(Entry{ key, field, &terr, terr.ChangeCount() });
+	m_map[key] = m_list.begin();
+	while (m_list.size() > m_capacity)
+	{
+		m_map.erase(m_list.back().key);
+		m_list.pop_back();
+	}
+	return field;
+}
+
+void FlowFieldCache::Clear()
+{
+	m_list.clear();
+	m_map.clear();
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <vector>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include "voxel.h"
+
+// 流场: 从目标 (x, y, layer) 反向做一次Dijkstra, 每个可达的 (x, y, layer) 记录朝目标走的下一步方向
+// 走向同一目标的实体共用一个流场, 每tick查表即可
+class FlowField
+{
+public:
+	// GetDir的特殊返回值
+	static constexpr uint8_t NoDir = 0xFF;
+	static constexpr uint8_t GoalDir = 0xFE;
+
+private:
+	const TerrainData* m_data = nullptr;
+	VoxelPos m_goal;
+	uint8_t m_radius;
+	// 每个分块第一个layer的全局序号, 与VoxelAStar的访问表相同
+	std::vector<uint32_t> m_chunkBase;
+	// 每个layer的方向, 下标为全局序号
+	std::vector<uint8_t> m_dirs;
+	// 可达格子的范围
+	GridRect m_rect;
+
+	uint32_t Slot(const VoxelPos& pos) const;
+
+public:
+	// radius为占用半径, 规则与VoxelAStar一致
+	FlowField(const TerrainInstance& terr, const VoxelPos& goal, uint8_t radius = 0);
+
+	const VoxelPos& Goal() const { return m_goal; }
+	uint8_t Radius() const { return m_radius; }
+	const GridRect& Rect() const { return m_rect; }
+
+	// 是否基于data生成且分块布局没有变化, 区域内的修改由FlowFieldCache按修改记录判断
+	bool IsValid(const TerrainData& data) const;
+
+	// rect内的掩码或地形修改是否可能改变流场
+	bool IsAffected(const GridRect& rect) const;
+
+	// pos处应走的方向, 位于目标返回GoalDir, 不可达返回NoDir
+	uint8_t GetDir(const VoxelPos& pos) const;
+
+	// 沿流场走一步, 位于目标或不可达返回false
+	bool Next(const TerrainInstance& terr, const VoxelPos& pos, VoxelPos& next) const;
+};
+
+// 按目标缓存流场, 超过容量时淘汰最久未使用的
+class FlowFieldCache
+{
+	struct Key
+	{
+		VoxelPos goal;
+		uint8_t radius;
+
+		bool operator==(const Key& o) const { return goal == o.goal && radius == o.radius; }
+	};
+
+	struct KeyHash
+	{
+		size_t operator()(const Key& k) const
+		{
+			return std::hash<uint64_t>()((uint64_t(k.goal.x) << 32 | k.goal.y) ^ (uint64_t(k.goal.layer) << 56) ^ (uint64_t(k.radius) << 48));
+		}
+	};
+
+	struct Entry
+	{
+		Key key;
+		std::shared_ptr<const FlowField> field;
+		// 生成或上次检查时的实例和修改次数
+		const TerrainInstance* terr;
+		uint32_t changeCount;
+	};
+
+	typedef std::list<Entry> List;
+
+	uint32_t m_capacity;
+	// 最近使用的在前
+	List m_list;
+	std::unordered_map<Key, List::iterator, KeyHash> m_map;
+	uint32_t m_buildCount = 0;
+
+public:
+	explicit FlowFieldCache(uint32_t capacity = 16) : m_capacity(capacity) {}
+
+	// 取流场, 不存在或已失效时生成; 返回的流场在淘汰后仍然有效
+	// 按terr的修改记录检查上次之后的修改, 影响到流场时重新生成
+	std::shared_ptr<const FlowField> Get(const TerrainInstance& terr, const VoxelPos& goal, uint8_t radius = 0);
+
+	void Clear();
+
+	uint32_t Size() const { return (uint32_t)m_list.size(); }
+	// 累计生成流场的次数
+	uint32_t BuildCount() const { return m_buildCount; }
+};
@@ -0,0 +1,111 @@
+#include "pch.h"
+#include "pathService.h"
+#include "utils/threadPool.h"
+#include <thread>
+
+PathService::PathService(const TerrainInstance& terr, ThreadPool& pool, uint32_t budget)
+	: m_terr(terr), m_pool(pool), m_budget(budget)
+{
+}
+
+PathService::~PathService()
+{
+	Wait();
+}
+
+uint32_t PathService::Submit(entt::entity entity, const VoxelPos& start, const VoxelPos& goal, uint8_t radius, uint8_t priority)
+{
+	uint32_t id = m_nextId++;
+	if (m_nextId == 0)
+		m_nextId = 1;
+	m_queue.push(Request{ entity, id, start, goal, radius, priority });
+	m_live.insert(id);
+	return id;
+}
+
+void PathService::Cancel(uint32_t id)
+{
+	m_live.erase(id);
+}
+
+void PathService::Solve(const std::shared_ptr<const TerrainInstance>& snapshot, const Request& req)
+{
+	VOXEL_PROFILE_SCOPE("PathService::Solve");
+	std::unique_ptr<VoxelAStar> solver;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (!m_solvers.empty())
+		{
+			solver = std::move(m_solvers.back());
+			m_solvers.pop_back();
+		}
+	}
+	if (!solver)
+		solver.reset(new VoxelAStar());
+
+	Result res{ req.entity, req.id, VoxelAStar::Result::NotFound, {} };
+	res.result = solver->FindPath(*snapshot, req.start, req.goal, res.cells, req.radius);
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_solvers.push_back(std::move(solver));
+	m_done.push_back(std::move(res));
+	--m_running;
+}
+
+void PathService::Dispatch()
+{
+	if (m_queue.empty())
+		return;
+	if (!m_snapshot || m_snapshotVersion != m_terr.MaskVersion())
+	{
+		m_snapshot = std::make_shared<TerrainInstance>(m_terr);
+		m_snapshotVersion = m_terr.MaskVersion();
+	}
+
+	for (uint32_t count = 0; count < m_budget && !m_queue.empty(); )
+	{
+		Request req = m_queue.top();
+		m_queue.pop();
+		if (m_live.find(req.id) == m_live.end())
+			continue;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			++m_running;
+		}
+		auto snapshot = m_snapshot;
+		m_pool.Post([this, snapshot, req] { Solve(snapshot, req); });
+		++count;
+	}
+}
+
+void PathService::Sync(const std::function<void(Result&)>& fn)
+{
+	std::vector<Result> done;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		done.swap(m_done);
+	}
+	for (auto& res : done)
+	{
+		auto it = m_live.find(res.id);
+		if (it == m_live.end())
+			continue;
+		m_live.erase(it);
+		fn(res);
+	}
+}
+
+void PathService::Wait()
+{
+	// 请求可能排在其它系统的任务后面, 同ThreadPool::ParallelFor边等边执行
+	for (;;)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_running == 0)
+				return;
+		}
+		if (!m_pool.RunOne())
+			std::this_thread::yield();
+	}
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <vector>
+#include <queue>
+#include <memory>
+#include <mutex>
+#include <unordered_set>
+#include <functional>
+#include "single_include/entt/entt.hpp"
+#include "voxel.h"
+#include "voxelAStar.h"
+
+class ThreadPool;
+
+// 异步寻路服务: 系统在tick中提交请求, Dispatch按优先级和每tick预算交给工作线程
+// 与调度器共用线程池, 寻路任务和系统任务在同一组工作线程上执行
+// 工作线程只读TerrainData和掩码快照, 完成的结果在主线程Sync时取回
+// 地形修改(SetVoxels等)前必须先Wait, 掩码修改不需要, 下次Dispatch时重新取快照
+class PathService
+{
+public:
+	struct Request
+	{
+		entt::entity entity;
+		uint32_t id;
+		VoxelPos start;
+		VoxelPos goal;
+		uint8_t radius;
+		// 越大越先处理, 相同时先提交的先处理
+		uint8_t priority;
+	};
+
+	struct Result
+	{
+		entt::entity entity;
+		uint32_t id;
+		VoxelAStar::Result result;
+		// 包含首尾的格子序列
+		std::vector<VoxelPos> cells;
+	};
+
+private:
+	struct Order
+	{
+		bool operator()(const Request& a, const Request& b) const
+		{
+			return a.priority < b.priority || (a.priority == b.priority && a.id > b.id);
+		}
+	};
+
+	const TerrainInstance& m_terr;
+	ThreadPool& m_pool;
+	uint32_t m_budget;
+	uint32_t m_nextId = 1;
+
+	std::priority_queue<Request, std::vector<Request>, Order> m_queue;
+	// 排队或执行中且未取消的请求
+	std::unordered_set<uint32_t> m_live;
+
+	// 掩码快照, 执行中的请求持有引用, 掩码版本变化时重新复制
+	std::shared_ptr<const TerrainInstance> m_snapshot;
+	uint32_t m_snapshotVersion = 0;
+
+	// 以下由工作线程访问
+	std::mutex m_mutex;
+	std::vector<Result> m_done;
+	std::vector<std::unique_ptr<VoxelAStar>> m_solvers;
+	uint32_t m_running = 0;
+
+	void Solve(const std::shared_ptr<const TerrainInstance>& snapshot, const Request& req);
+
+public:
+	// budget为每次Dispatch最多交给工作线程的请求数; pool需比服务后析构
+	PathService(const TerrainInstance& terr, ThreadPool& pool, uint32_t budget = 64);
+	~PathService();
+
+	// 提交请求, 返回请求id, 不会为0
+	uint32_t Submit(entt::entity entity, const VoxelPos& start, const VoxelPos& goal, uint8_t radius = 0, uint8_t priority = 0);
+
+	// 取消请求, 未开始的不再执行, 已完成的结果在Sync时丢弃
+	void Cancel(uint32_t id);
+
+	// 按优先级交给工作线程, 不超过预算, 剩余的留到下次
+	void Dispatch();
+
+	// 同步点, 在主线程对已完成且未取消的请求调用fn
+	void Sync(const std::function<void(Result&)>& fn);
+
+	// 等待执行中的请求全部完成, 等待时执行线程池中的任务, 可以在工作线程中调用
+	void Wait();
+
+	void SetBudget(uint32_t budget) { m_budget = budget; }
+	uint32_t QueuedCount() const { return (uint32_t)m_queue.size(); }
+};
@@ -0,0 +1,146 @@
+#include "pch.h"
+#include "pathSmooth.h"
+#include <cmath>
+#include "voxelAStar.h"
+
+bool PathSmooth::Walkable(const TerrainInstance& terr, const Location& from, const VoxelPos& start, const Location& to, const VoxelPos& goal, uint8_t radius)
+{
+	const auto& data = terr.GetData();
+	const float size = data.GridSize();
+	float dx = to.x - from.x;
+	float dy = to.y - from.y;
+	float len = std::sqrt(dx * dx + dy * dy);
+
+	// 与VoxelProxy::MoveTo相同的遍历
+	int stepX = dx > 0.f ? 1 : dx < 0.f ? -1 : 0;
+	int stepY = dy > 0.f ? 1 : dy < 0.f ? -1 : 0;
+	uint8_t dirX = uint8_t(stepX > 0 ? Direction::Front : Direction::Back);
+	uint8_t dirY = uint8_t(stepY > 0 ? Direction::Right : Direction::Left);
+	float maxX = stepX > 0 ? ((start.x + 1) * size - from.x) / dx : stepX < 0 ? (start.x * size - from.x) / dx : FLT_MAX;
+	float maxY = stepY > 0 ? ((start.y + 1) * size - from.y) / dy : stepY < 0 ? (start.y * size - from.y) / dy : FLT_MAX;
+	float deltaX = stepX != 0 ? size / std::fabs(dx) : FLT_MAX;
+	float deltaY = stepY != 0 ? size / std::fabs(dy) : FLT_MAX;
+
+	VoxelPos cur = start;
+	while (cur.x != goal.x || cur.y != goal.y)
+	{
+		bool alongX = maxX <= maxY;
+		float t = alongX ? maxX : maxY;
+		if (t > 1.f)
+			return false;
+		// 靠近墙角时跟随者的偏差可能改变先跨哪条边界, 两种顺序都要能到达同一个格子
+		if (stepX != 0 && stepY != 0 && std::fmax(maxX, maxY) <= 1.f && std::fabs(maxX - maxY) * len < CornerMargin * size)
+		{
+			VoxelPos a, b, diag;
+			if (!VoxelAStar::StepOnce(terr, cur, dirX, radius, a) || !VoxelAStar::StepOnce(terr, a, dirY, radius, diag)
+				|| !VoxelAStar::StepOnce(terr, cur, dirY, radius, b) || !VoxelAStar::StepOnce(terr, b, dirX, radius, b) || b != diag)
+				return false;
+			cur = diag;
+			maxX += deltaX;
+			maxY += deltaY;
+			continue;
+		}
+		if (!VoxelAStar::StepOnce(terr, cur, alongX ? dirX : dirY, radius, cur))
+			return false;
+		if (alongX)
+			maxX += deltaX;
+		else
+			maxY += deltaY;
+	}
+	return cur.layer == goal.layer;
+}
+
+Location PathSmooth::Center(const TerrainData& data, const VoxelPos& cell)
+{
+	return Location((cell.x + 0.5f) * data.GridSize(), (cell.y + 0.5f) * data.GridSize(), data.GetHight(data.GetVoxels(cell.x, cell.y), cell.layer));
+}
+
+bool PathSmooth::SideStep(const TerrainInstance& terr, const VoxelPos& from, const VoxelPos& to, uint8_t radius, VoxelPos& side)
+{
+	if (from.x == to.x || from.y == to.y)
+		return false;
+	uint8_t dirX = uint8_t(to.x > from.x ? Direction::Front : Direction::Back);
+	uint8_t dirY = uint8_t(to.y > from.y ? Direction::Right : Direction::Left);
+	VoxelPos diag;
+	if (VoxelAStar::StepOnce(terr, from, dirX, radius, side) && VoxelAStar::StepOnce(terr, side, dirY, radius, diag) && diag == to)
+		return true;
+	return VoxelAStar::StepOnce(terr, from, dirY, radius, side) && VoxelAStar::StepOnce(terr, side, dirX, radius, diag) && diag == to;
+}
+
+bool PathSmooth::Step(const TerrainInstance& terr, const Location& fromLoc, const VoxelPos& from, const Location& toLoc, const VoxelPos& to, uint8_t radius, std::vector<Location>& points)
+{
+	if (Walkable(terr, fromLoc, from, toLoc, to, radius))
+		return true;
+	// 寻路的斜向一步按MoveTo先走x可能走不通, 改为先经过侧面的格子
+	VoxelPos side;
+	if (!SideStep(terr, from, to, radius, side))
+		return false;
+	Location sideLoc = Center(terr.GetData(), side);
+	if (!Walkable(terr, fromLoc, from, sideLoc, side, radius) || !Walkable(terr, sideLoc, side, toLoc, to, radius))
+		return false;
+	points.push_back(sideLoc);
+	return true;
+}
+
+bool PathSmooth::Smooth(const TerrainInstance& terr, const VoxelPos* cells, uint32_t count, const Location& from, const Location& to, uint8_t radius, Mode mode, std::vector<Location>& points)
+{
+	points.clear();
+	if (count < 2)
+		return true;
+	const auto& data = terr.GetData();
+	auto location = [&](uint32_t i) {
+		Location loc = Center(data, cells[i]);
+		if (i + 1 == count)
+		{
+			loc.x = to.x;
+			loc.y = to.y;
+		}
+		return loc;
+	};
+
+	uint32_t anchor = 0;
+	Location anchorLoc = from;
+	while (anchor + 1 < count)
+	{
+		// 本段的终点: 下一个必经路点或MaxSpan
+		uint32_t limit = std::min(count - 1, anchor + MaxSpan);
+		if (mode == Mode::Funnel)
+		{
+			for (uint32_t i = anchor + 1; i < limit; ++i)
+			{
+				if (cells[i].layer != cells[i - 1].layer || cells[i].layer != cells[i + 1].layer)
+				{
+					limit = i;
+					break;
+				}
+			}
+		}
+		// 从相邻的格子开始向后找, 第一次走不通时停止
+		uint32_t next = anchor + 1;
+		for (uint32_t i = anchor + 2; i <= limit; ++i)
+		{
+			if (!Walkable(terr, anchorLoc, cells[anchor], location(i), cells[i], radius))
+				break;
+			next = i;
+		}
+		if (next == anchor + 1 && !Step(terr, anchorLoc, cells[anchor], location(next), cells[next], radius, points))
+		{
+			// 起点和终点不在格子中心时改为经过格子中心, 同一格内的移动不改变格子和layer
+			Location a = Center(data, cells[anchor]);
+			Location b = Center(data, cells[next]);
+			if (a.x != anchorLoc.x || a.y != anchorLoc.y)
+				points.push_back(a);
+			if (!Step(terr, a, cells[anchor], b, cells[next], radius, points))
+			{
+				points.clear();
+				return false;
+			}
+			if (next + 1 == count && (b.x != to.x || b.y != to.y))
+				points.push_back(b);
+		}
+		anchor = next;
+		anchorLoc = location(anchor);
+		points.push_back(anchorLoc);
+	}
+	return true;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <vector>
+#include "voxel.h"
+
+// 路径平滑(拉绳): 从当前路点出发, 只要能按VoxelProxy::MoveTo的规则直线走到后面的格子就跳过中间的格子
+// 直线检查逐格沿LayerRelation走, 与寻路一样检查掩码和半径, 靠近墙角时要求两侧都能通过
+class PathSmooth
+{
+public:
+	enum class Mode : uint8_t
+	{
+		// 只保留直线走不通处的格子
+		StringPull,
+		// layer变化处的两个格子作为必经路点, 分段拉绳, 上下层只从寻路给出的位置经过
+		Funnel,
+	};
+
+	// 单段直线检查的最大格子数, 限制长路径上的检查次数
+	static const uint32_t MaxSpan = 64;
+	// 离墙角小于该比例的格子边长时视为同时跨过两条边界
+	static constexpr float CornerMargin = 0.1f;
+
+private:
+	// 格子中心, 高度为layer的上表面
+	static Location Center(const TerrainData& data, const VoxelPos& cell);
+
+	// from到to为斜向一步时, 找一个先直线走一步再转向能到达to的侧面格子
+	static bool SideStep(const TerrainInstance& terr, const VoxelPos& from, const VoxelPos& to, uint8_t radius, VoxelPos& side);
+
+	// 从fromLoc走到相邻格子to中的toLoc, 直线走不通时经过侧面格子的中心, 中间路点追加到points
+	static bool Step(const TerrainInstance& terr, const Location& fromLoc, const VoxelPos& from, const Location& toLoc, const VoxelPos& to, uint8_t radius, std::vector<Location>& points);
+
+public:
+	// 从from直线走到to是否与MoveTo结果一致且不被挡住, start/goal为两点所在的格子和layer
+	static bool Walkable(const TerrainInstance& terr, const Location& from, const VoxelPos& start, const Location& to, const VoxelPos& goal, uint8_t radius = 0);
+
+	// cells为寻路结果, 第一个为起点格子; from为起点位置, to为终点位置
+	// 结果写入points, 不含起点, 中间路点为格子中心, 最后一个为to, 高度为所在layer的上表面
+	// 每段都通过Walkable检查; 寻路结果的某一步走不通时(如掩码在寻路后变化)返回false, points为空, 调用者应重新寻路
+	static bool Smooth(const TerrainInstance& terr, const VoxelPos* cells, uint32_t count, const Location& from, const Location& to, uint8_t radius, Mode mode, std::vector<Location>& points);
+};
@@ -0,0 +1,608 @@
+#include "pch.h"
+#include "voxelAStar.h"
+#include <cmath>
+#include <algorithm>
+
+VoxelAStar::VoxelAStar(uint32_t maxNodes)
+{
+	m_nodes.resize(maxNodes);
+	m_heap.resize(maxNodes);
+}
+
+void VoxelAStar::PrepareVisit(const TerrainData& data)
+{
+	bool changed = m_data != &data || m_chunkBase.size() != data.ChunkCount() + 1;
+	uint32_t base = 0;
+	for (uint32_t c = 0; !changed && c < data.ChunkCount(); ++c)
+	{
+		changed = m_chunkBase[c] != base;
+		base += data.SlotCount(c);
+	}
+	changed = changed || m_chunkBase.back() != base;
+	if (!changed)
+		return;
+
+	m_data = &data;
+	m_chunkBase.resize(data.ChunkCount() + 1);
+	base = 0;
+	for (uint32_t c = 0; c < data.ChunkCount(); ++c)
+	{
+		m_chunkBase[c] = base;
+		base += data.SlotCount(c);
+	}
+	m_chunkBase.back() = base;
+	if (m_visit.size() < base)
+		m_visit.resize(base, Visit{ 0, 0 });
+}
+
+uint32_t VoxelAStar::Slot(const TerrainData& data, const VoxelPos& pos) const
+{
+	auto vols = data.GetVoxels(pos.x, pos.y);
+	return m_chunkBase[data.ChunkIndex(pos.x, pos.y)] + vols.slot + pos.layer;
+}
+
+uint32_t VoxelAStar::Touch(uint32_t slot, const VoxelPos& pos, bool& isNew)
+{
+	auto& visit = m_visit[slot];
+	isNew = visit.generation != m_generation;
+	if (!isNew)
+		return visit.node;
+	if (m_nodeCount >= m_nodes.size())
+		return NoParent;
+	visit.generation = m_generation;
+	visit.node = m_nodeCount++;
+	auto& node = m_nodes[visit.node];
+	node.pos = pos;
+	node.parent = NoParent;
+	node.heapIndex = ClosedIndex;
+	node.dir = NoDir;
+	node.skip = 0;
+	return visit.node;
+}
+
+bool VoxelAStar::Less(uint32_t a, uint32_t b) const
+{
+	const auto& na = m_nodes[a];
+	const auto& nb = m_nodes[b];
+	// f相同时优先g大的, 即离目标更近的节点
+	return na.f < nb.f || (na.f == nb.f && na.g > nb.g);
+}
+
+void VoxelAStar::HeapPush(uint32_t node)
+{
+	m_heap[m_heapSize] = node;
+	m_nodes[node].heapIndex = m_heapSize;
+	HeapUp(m_heapSize++);
+}
+
+uint32_t VoxelAStar::HeapPop()
+{
+	uint32_t top = m_heap[0];
+	m_nodes[top].heapIndex = ClosedIndex;
+	if (--m_heapSize > 0)
+	{
+		m_heap[0] = m_heap[m_heapSize];
+		m_nodes[m_heap[0]].heapIndex = 0;
+		HeapDown(0);
+	}
+	return top;
+}
+
+void VoxelAStar::HeapUp(uint32_t index)
+{
+	uint32_t node = m_heap[index];
+	while (index > 0)
+	{
+		uint32_t parent = (index - 1) >> 1;
+		if (!Less(node, m_heap[parent]))
+			break;
+		m_heap[index] = m_heap[parent];
+		m_nodes[m_heap[index]].heapIndex = index;
+		index = parent;
+	}
+	m_heap[index] = node;
+	m_nodes[node].heapIndex = index;
+}
+
+void VoxelAStar::HeapDown(uint32_t index)
+{
+	uint32_t node = m_heap[index];
+	for (;;)
+	{
+		uint32_t child = index * 2 + 1;
+		if (child >= m_heapSize)
+			break;
+		if (child + 1 < m_heapSize && Less(m_heap[child + 1], m_heap[child]))
+			++child;
+		if (!Less(m_heap[child], node))
+			break;
+		m_heap[index] = m_heap[child];
+		m_nodes[m_heap[index]].heapIndex = index;
+		index = child;
+	}
+	m_heap[index] = node;
+	m_nodes[node].heapIndex = index;
+}
+
+float VoxelAStar::Heuristic(const VoxelPos& a, const VoxelPos& b)
+{
+	// 八方向距离
+	float dx = std::fabs(float(a.x) - float(b.x));
+	float dy = std::fabs(float(a.y) - float(b.y));
+	return StraightCost * (dx + dy) + (DiagonalCost - 2 * StraightCost) * std::fmin(dx, dy);
+}
+
+uint8_t VoxelAStar::GetWalkableNeighbors(const TerrainInstance& terr, const VoxelPos& pos, uint8_t radius, VoxelPos neighbors[8], Direction dirs[8])
+{
+	const auto& data = terr.GetData();
+	auto vols = data.GetVoxels(pos.x, pos.y);
+	bool walkable[8];
+	VoxelPos target[8];
+	TerrainData::NeighborLayer rels[8];
+	for (uint8_t dir = 0; dir < 8; ++dir)
+	{
+		walkable[dir] = false;
+		auto rel = data.GetNeighborLayerRelation(vols, pos.layer, Direction(dir));
+		if (rel == LayerRelation::Unknow)
+			continue;
+		uint32_t x = pos.x, y = pos.y;
+		data.CalcDirectionGrid(Direction(dir), x, y);
+		if (!data.IsValidGrid(x, y))
+			continue;
+		uint8_t layer = TerrainData::RelationToLayer(pos.layer, rel);
+		auto next = data.GetVoxels(x, y);
+		if (layer >= next.count || terr.IsMask(x, y, layer, radius))
+			continue;
+		walkable[dir] = true;
+		target[dir] = VoxelPos{ x, y, layer };
+		rels[dir] = data.GetNeighborLayer(next, layer);
+	}
+
+	uint8_t count = 0;
+	for (uint8_t dir = 0; dir < 8; ++dir)
+	{
+		if (!walkable[dir])
+			continue;
+		// 斜向不能穿过墙角
+		if ((dir & 1) && (!walkable[dir - 1] || !walkable[(dir + 1) & 7] || !SidesMeet(rels[dir - 1], target[dir - 1].layer, rels[(dir + 1) & 7], target[(dir + 1) & 7].layer, dir, target[dir].layer)))
+			continue;
+		neighbors[count] = target[dir];
+		dirs[count] = Direction(dir);
+		++count;
+	}
+	return count;
+}
+
+VoxelAStar::Result VoxelAStar::Search(const TerrainInstance& terr, const VoxelPos& start, const VoxelPos* goal, uint8_t radius, const GridRect* bounds, uint32_t& goalNode)
+{
+	const auto& data = terr.GetData();
+	PrepareVisit(data);
+	if (++m_generation == 0)
+	{
+		for (auto& visit : m_visit)
+			visit.generation = 0;
+		m_generation = 1;
+	}
+	m_nodeCount = 0;
+	m_heapSize = 0;
+
+	bool isNew;
+	uint32_t startNode = Touch(Slot(data, start), start, isNew);
+	m_nodes[startNode].g = 0.f;
+	m_nodes[startNode].f = goal ? Heuristic(start, *goal) : 0.f;
+	HeapPush(startNode);
+
+	Result result = goal ? Result::NotFound : Result::Found;
+	goalNode = NoParent;
+	VoxelPos neighbors[8];
+	Direction dirs[8];
+	while (m_heapSize > 0)
+	{
+		uint32_t cur = HeapPop();
+		const VoxelPos pos = m_nodes[cur].pos;
+		if (goal && pos == *goal)
+		{
+			goalNode = cur;
+			result = Result::Found;
+			break;
+		}
+		++m_expanded;
+
+		uint8_t count = GetWalkableNeighbors(terr, pos, radius, neighbors, dirs);
+		for (uint8_t i = 0; i < count; ++i)
+		{
+			if (bounds && !bounds->Contains(neighbors[i].x, neighbors[i].y))
+				continue;
+			uint32_t next = Touch(Slot(data, neighbors[i]), neighbors[i], isNew);
+			if (next == NoParent)
+			{
+				result = Result::NodeLimit;
+				break;
+			}
+			auto& node = m_nodes[next];
+			if (!isNew && node.heapIndex == ClosedIndex)
+				continue;
+			float g = m_nodes[cur].g + ((uint8_t(dirs[i]) & 1) ? DiagonalCost : StraightCost);
+			if (!isNew && g >= node.g)
+				continue;
+			node.g = g;
+			node.f = goal ? g + Heuristic(neighbors[i], *goal) : g;
+			node.parent = cur;
+			if (isNew)
+				HeapPush(next);
+			else
+				HeapUp(node.heapIndex);
+		}
+		if (result == Result::NodeLimit)
+			break;
+	}
+	return result;
+}
+
+bool VoxelAStar::StepOnce(const TerrainInstance& terr, const VoxelPos& pos, uint8_t dir, uint8_t radius, VoxelPos& out)
+{
+	const auto& data = terr.GetData();
+	auto rel = data.GetNeighborLayerRelation(data.GetVoxels(pos.x, pos.y), pos.layer, Direction(dir));
+	if (rel == LayerRelation::Unknow)
+		return false;
+	uint32_t x = pos.x, y = pos.y;
+	data.CalcDirectionGrid(Direction(dir), x, y);
+	if (!data.IsValidGrid(x, y))
+		return false;
+	uint8_t layer = TerrainData::RelationToLayer(pos.layer, rel);
+	if (layer >= data.GetVoxels(x, y).count || terr.IsMask(x, y, layer, radius))
+		return false;
+	out = VoxelPos{ x, y, layer };
+	return true;
+}
+
+bool VoxelAStar::CornerFree(const TerrainInstance& terr, const VoxelPos& pos, uint8_t dir, uint8_t radius, const VoxelPos& target)
+{
+	const auto& data = terr.GetData();
+	VoxelPos back, fwd;
+	if (!StepOnce(terr, pos, dir - 1, radius, back) || !StepOnce(terr, pos, (dir + 1) & 7, radius, fwd))
+		return false;
+	return SidesMeet(data.GetNeighborLayer(data.GetVoxels(back.x, back.y), back.layer), back.layer,
+		data.GetNeighborLayer(data.GetVoxels(fwd.x, fwd.y), fwd.layer), fwd.layer, dir, target.layer);
+}
+
+void VoxelAStar::LoadAround(const TerrainInstance& terr, const VoxelPos& pos, uint8_t radius, const GridRect* bounds, Around& around)
+{
+	const auto& data = terr.GetData();
+	// 同StepOnce, 8个方向的关系一次取出
+	auto relations = data.GetNeighborLayer(data.GetVoxels(pos.x, pos.y), pos.layer);
+	uint8_t open = 0;
+	around.pos = pos;
+	around.plain = relations == 0 && !terr.IsMask(pos.x, pos.y, pos.layer, radius);
+	around.plainDirs = 0;
+	for (uint8_t dir = 0; dir < 8; ++dir)
+	{
+		auto rel = LayerRelation((relations >> (dir * 2)) & 0x03);
+		if (rel == LayerRelation::Unknow)
+			continue;
+		uint32_t x = pos.x, y = pos.y;
+		data.CalcDirectionGrid(Direction(dir), x, y);
+		if (!data.IsValidGrid(x, y))
+			continue;
+		uint8_t layer = TerrainData::RelationToLayer(pos.layer, rel);
+		auto next = data.GetVoxels(x, y);
+		if (layer >= next.count || terr.IsMask(x, y, layer, radius))
+			continue;
+		around.target[dir] = VoxelPos{ x, y, layer };
+		around.rels[dir] = data.GetNeighborLayer(next, layer);
+		open |= 1 << dir;
+		if (around.rels[dir] == 0)
+			around.plainDirs |= 1 << dir;
+	}
+	around.walk = 0;
+	for (uint8_t dir = 0; dir < 8; ++dir)
+	{
+		if (!(open & (1 << dir)))
+			continue;
+		// 斜向不能穿过墙角, bounds只限制目标格子
+		if ((dir & 1) && (!(open & (1 << (dir - 1))) || !(open & (1 << ((dir + 1) & 7)))
+			|| !SidesMeet(around.rels[dir - 1], around.target[dir - 1].layer, around.rels[(dir + 1) & 7], around.target[(dir + 1) & 7].layer, dir, around.target[dir].layer)))
+			continue;
+		if (bounds && !bounds->Contains(around.target[dir].x, around.target[dir].y))
+			continue;
+		around.walk |= 1 << dir;
+	}
+}
+
+void VoxelAStar::OpenAround(const VoxelPos& pos, Around& around)
+{
+	around.pos = pos;
+	around.walk = 0xFF;
+	around.plain = true;
+	around.plainDirs = 0xFF;
+	for (uint8_t dir = 0; dir < 8; ++dir)
+	{
+		around.target[dir] = VoxelPos{ uint32_t(int32_t(pos.x) + TerrainData::DirectionOffsetX[dir]), uint32_t(int32_t(pos.y) + TerrainData::DirectionOffsetY[dir]), pos.layer };
+		around.rels[dir] = 0;
+	}
+}
+
+bool VoxelAStar::IsOpen(const TerrainInstance& terr, const VoxelPos& pos, uint8_t radius, const GridRect* bounds, uint8_t dir)
+{
+	const auto& data = terr.GetData();
+	if (pos.x == 0 || pos.y == 0 || pos.x + 1 >= data.Length() || pos.y + 1 >= data.Width())
+		return false;
+	if (bounds && (pos.x <= bounds->minX || pos.y <= bounds->minY || pos.x >= bounds->maxX || pos.y >= bounds->maxY))
+		return false;
+	auto plain = [&](uint32_t x, uint32_t y) {
+		auto vols = data.GetVoxels(x, y);
+		return pos.layer < vols.count && data.GetNeighborLayer(vols, pos.layer) == 0 && (radius == 0 || !terr.IsMask(x, y, pos.layer, radius));
+	};
+	// 只检查前方新进入的一列和一行
+	int32_t dx = TerrainData::DirectionOffsetX[dir];
+	int32_t dy = TerrainData::DirectionOffsetY[dir];
+	if (dx != 0)
+	{
+		uint32_t x = pos.x + dx;
+		if (!plain(x, pos.y - 1) || !plain(x, pos.y) || !plain(x, pos.y + 1))
+			return false;
+	}
+	if (dy != 0)
+	{
+		uint32_t y = pos.y + dy;
+		for (uint32_t x = pos.x - 1; x <= pos.x + 1; ++x)
+			if ((dx == 0 || int32_t(x - pos.x) != dx) && !plain(x, y))
+				return false;
+	}
+	// 没有半径时3x3的掩码用一次位图查询
+	return radius != 0 || !terr.IsMaskRect(GridRect{ pos.x - 1, pos.y - 1, pos.x + 1, pos.y + 1 }, pos.layer);
+}
+
+bool VoxelAStar::Advance(const TerrainInstance& terr, Scan& scan, uint8_t dir, uint8_t radius, const GridRect* bounds)
+{
+	VoxelPos prev = scan.pos;
+	if (scan.from)
+	{
+		const Around& from = *scan.from;
+		if (!(from.walk & (1 << dir)))
+			return false;
+		scan.pos = from.target[dir];
+		// 与起点重叠的格子用已取出的关系判断: 起点, 前方及两侧前方, 直线时还有两侧
+		uint8_t need = (1 << dir) | (1 << ((dir - 1) & 7)) | (1 << ((dir + 1) & 7));
+		if (!(dir & 1))
+			need |= (1 << ((dir + 2) & 7)) | (1 << ((dir + 6) & 7));
+		scan.open = from.plain && (from.plainDirs & need) == need;
+		scan.from = nullptr;
+	}
+	else
+	{
+		// 上一格开阔, 邻居都在同一layer且可走
+		terr.GetData().CalcDirectionGrid(Direction(dir), scan.pos.x, scan.pos.y);
+	}
+	++scan.steps;
+	scan.open = scan.open && prev.layer == scan.pos.layer && IsOpen(terr, scan.pos, radius, bounds, dir);
+	return true;
+}
+
+bool VoxelAStar::JumpStraight(const TerrainInstance& terr, const Around& from, uint8_t dir, const VoxelPos& goal, uint8_t radius, const GridRect* bounds, uint32_t limit, VoxelPos& out, uint32_t& steps)
+{
+	Scan scan(from);
+	do
+	{
+		if (!Advance(terr, scan, dir, radius, bounds))
+			return false;
+	} while (scan.open && scan.pos != goal && scan.steps < limit);
+	out = scan.pos;
+	steps = scan.steps;
+	return true;
+}
+
+bool VoxelAStar::JumpDiagonal(const TerrainInstance& terr, uint32_t parent, const Around& from, uint8_t dir, const VoxelPos& goal, uint8_t radius, const GridRect* bounds)
+{
+	const auto& data = terr.GetData();
+	const float g = m_nodes[parent].g;
+	const uint8_t sides[2] = { uint8_t(dir - 1), uint8_t((dir + 1) & 7) };
+	Scan scan(from);
+	Around around;
+	uint32_t node;
+	while (Advance(terr, scan, dir, radius, bounds))
+	{
+		float cost = g + scan.steps * DiagonalCost;
+		if (!scan.open || scan.pos == goal || scan.steps >= m_jumpLimit)
+			return PushJump(data, parent, scan.pos, goal, cost, dir, 0, node);
+		// 直线扫描走满限制也算结果, 加入当前格子作为它们的父节点, 斜线从当前格子出堆后继续
+		OpenAround(scan.pos, around);
+		VoxelPos out[2];
+		uint32_t steps[2];
+		bool found[2];
+		for (uint8_t i = 0; i < 2; ++i)
+			found[i] = JumpStraight(terr, around, sides[i], goal, radius, bounds, m_jumpLimit, out[i], steps[i]);
+		if (!found[0] && !found[1])
+			continue;
+		if (!PushJump(data, parent, scan.pos, goal, cost, dir, (1 << sides[0]) | (1 << sides[1]), node))
+			return false;
+		// 当前格子已有更优的代价时, 由它自己出堆时展开
+		if (node == NoParent)
+			return true;
+		uint32_t unused;
+		for (uint8_t i = 0; i < 2; ++i)
+		{
+			if (found[i] && !PushJump(data, node, out[i], goal, cost + steps[i] * StraightCost, sides[i], 0, unused))
+				return false;
+		}
+		return true;
+	}
+	return true;
+}
+
+bool VoxelAStar::PushJump(const TerrainData& data, uint32_t parent, const VoxelPos& pos, const VoxelPos& goal, float g, uint8_t dir, uint8_t skip, uint32_t& node)
+{
+	bool isNew;
+	node = Touch(Slot(data, pos), pos, isNew);
+	if (node == NoParent)
+		return false;
+	auto& n = m_nodes[node];
+	if (!isNew && (n.heapIndex == ClosedIndex || g >= n.g))
+	{
+		node = NoParent;
+		return true;
+	}
+	n.g = g;
+	n.f = g + Heuristic(pos, goal);
+	n.parent = parent;
+	n.dir = dir;
+	n.skip = skip;
+	if (isNew)
+		HeapPush(node);
+	else
+		HeapUp(n.heapIndex);
+	return true;
+}
+
+VoxelAStar::Result VoxelAStar::JumpSearch(const TerrainInstance& terr, const VoxelPos& start, const VoxelPos& goal, uint8_t radius, const GridRect* bounds, uint32_t& goalNode)
+{
+	const auto& data = terr.GetData();
+	PrepareVisit(data);
+	if (++m_generation == 0)
+	{
+		for (auto& visit : m_visit)
+			visit.generation = 0;
+		m_generation = 1;
+	}
+	m_nodeCount = 0;
+	m_heapSize = 0;
+
+	bool isNew;
+	uint32_t startNode = Touch(Slot(data, start), start, isNew);
+	m_nodes[startNode].g = 0.f;
+	m_nodes[startNode].f = Heuristic(start, goal);
+	HeapPush(startNode);
+
+	goalNode = NoParent;
+	Around around;
+	VoxelPos jumpPos;
+	uint32_t steps, next;
+	while (m_heapSize > 0)
+	{
+		uint32_t cur = HeapPop();
+		const Node node = m_nodes[cur];
+		if (node.pos == goal)
+		{
+			goalNode = cur;
+			return Result::Found;
+		}
+		++m_expanded;
+
+		LoadAround(terr, node.pos, radius, bounds, around);
+		// 8个邻居都可走且关系都是Same时满足IsOpen, 还要求从同一layer走来
+		bool open = around.plain && around.plainDirs == 0xFF && around.walk == 0xFF
+			&& (node.dir == NoDir || m_nodes[node.parent].pos.layer == node.pos.layer);
+		if (!open)
+		{
+			for (uint8_t dir = 0; dir < 8; ++dir)
+			{
+				if ((around.walk & (1 << dir)) && !PushJump(data, cur, around.target[dir], goal, node.g + ((dir & 1) ? DiagonalCost : StraightCost), dir, 0, next))
+					return Result::NodeLimit;
+			}
+			continue;
+		}
+
+		// 起点展开所有方向, 其余只展开自然方向
+		uint8_t dirs = 0xFF;
+		if (node.dir != NoDir)
+		{
+			dirs = 1 << node.dir;
+			if (node.dir & 1)
+				dirs |= (1 << (node.dir - 1)) | (1 << ((node.dir + 1) & 7));
+			dirs &= ~node.skip;
+		}
+		for (uint8_t dir = 0; dir < 8; ++dir)
+		{
+			if (!(dirs & (1 << dir)))
+				continue;
+			if (dir & 1)
+			{
+				if (!JumpDiagonal(terr, cur, around, dir, goal, radius, bounds))
+					return Result::NodeLimit;
+			}
+			else if (JumpStraight(terr, around, dir, goal, radius, bounds, m_jumpLimit, jumpPos, steps)
+				&& !PushJump(data, cur, jumpPos, goal, node.g + steps * StraightCost, dir, 0, next))
+				return Result::NodeLimit;
+		}
+	}
+	return Result::NotFound;
+}
+
+VoxelAStar::Result VoxelAStar::FindPath(const TerrainInstance& terr, const VoxelPos& start, const VoxelPos& goal, std::vector<VoxelPos>& path, uint8_t radius, const GridRect* bounds)
+{
+	const auto& data = terr.GetData();
+	path.clear();
+	m_expanded = 0;
+	m_cost = 0.f;
+	if (!data.IsValidGrid(start.x, start.y) || !data.IsValidGrid(goal.x, goal.y)
+		|| start.layer >= data.GetVoxels(start.x, start.y).count
+		|| goal.layer >= data.GetVoxels(goal.x, goal.y).count
+		|| terr.IsMask(goal.x, goal.y, goal.layer, radius)
+		|| (bounds && (!bounds->Contains(start.x, start.y) || !bounds->Contains(goal.x, goal.y))))
+		return Result::NotFound;
+
+	uint32_t goalNode;
+	Result result = m_mode == Mode::JumpPoint ? JumpSearch(terr, start, goal, radius, bounds, goalNode) : Search(terr, start, &goal, radius, bounds, goalNode);
+	VOXEL_COUNT(PathExpanded, m_expanded);
+	if (result != Result::Found)
+		return result;
+	m_cost = m_nodes[goalNode].g;
+	for (uint32_t node = goalNode; node != NoParent; node = m_nodes[node].parent)
+		path.push_back(m_nodes[node].pos);
+	std::reverse(path.begin(), path.end());
+	if (m_mode == Mode::JumpPoint)
+	{
+		// 跳点之间是同一方向的直线, 按原方向逐格补全
+		size_t count = path.size();
+		for (size_t i = 1; i < count; ++i)
+		{
+			const VoxelPos a = path[i - 1];
+			const VoxelPos b = path[i];
+			uint8_t dir = m_nodes[m_visit[Slot(data, b)].node].dir;
+			uint32_t steps = std::max(a.x > b.x ? a.x - b.x : b.x - a.x, a.y > b.y ? a.y - b.y : b.y - a.y);
+			VoxelPos pos = a;
+			for (uint32_t k = 0; k < steps; ++k)
+			{
+				StepOnce(terr, pos, dir, radius, pos);
+				path.push_back(pos);
+			}
+		}
+		// 前count个为跳点, 后面为补全后的完整路径
+		path.erase(path.begin() + 1, path.begin() + count);
+	}
+	return result;
+}
+
+VoxelAStar::Result VoxelAStar::Flood(const TerrainInstance& terr, const VoxelPos& start, uint8_t radius, const GridRect& bounds)
+{
+	const auto& data = terr.GetData();
+	m_expanded = 0;
+	m_cost = 0.f;
+	if (!bounds.Contains(start.x, start.y) || start.layer >= data.GetVoxels(start.x, start.y).count)
+	{
+		// 使FloodCost全部返回不可达
+		PrepareVisit(data);
+		m_nodeCount = 0;
+		if (++m_generation == 0)
+		{
+			for (auto& visit : m_visit)
+				visit.generation = 0;
+			m_generation = 1;
+		}
+		return Result::NotFound;
+	}
+	uint32_t goalNode;
+	Result result = Search(terr, start, nullptr, radius, &bounds, goalNode);
+	VOXEL_COUNT(PathExpanded, m_expanded);
+	return result;
+}
+
+float VoxelAStar::FloodCost(const TerrainData& data, const VoxelPos& pos) const
+{
+	if (&data != m_data || !data.IsValidGrid(pos.x, pos.y) || pos.layer >= data.GetVoxels(pos.x, pos.y).count)
+		return -1.f;
+	const auto& visit = m_visit[Slot(data, pos)];
+	if (visit.generation != m_generation || m_nodes[visit.node].heapIndex != ClosedIndex)
+		return -1.f;
+	return m_nodes[visit.node].g;
+}
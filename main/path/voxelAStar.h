@@ -0,0 +1,187 @@
+#pragma once
+
+#include <vector>
+#include "voxel.h"
+
+// 分层体素上的A*寻路, 节点为 (x, y, layer), 通过GetNeighborLayerRelation扩展邻居
+// 节点池, 索引二叉堆, 按代标记的访问表均预先分配, 单次搜索不分配堆内存
+class VoxelAStar
+{
+public:
+	enum class Result : uint8_t
+	{
+		Found,
+		NotFound,
+		// 节点池耗尽, 目标太远或不可达
+		NodeLimit,
+	};
+
+	enum class Mode : uint8_t
+	{
+		AStar,
+		// 跳点搜索, 开阔地形上只把跳点放入开放列表, 结果与AStar等价
+		// 开阔的单层地形上较快; 多层洞穴和建筑几乎没有开阔格子, 退化为逐格展开, 比AStar稍慢
+		JumpPoint,
+	};
+
+	// 直线和斜线移动代价, 单位为格子
+	static constexpr float StraightCost = 1.f;
+	static constexpr float DiagonalCost = 1.41421356f;
+
+private:
+	struct Node
+	{
+		VoxelPos pos;
+		uint32_t parent;
+		// 在堆中的位置, ClosedIndex表示已关闭
+		uint32_t heapIndex;
+		float g;
+		float f;
+		// 从父节点过来的方向, 跳点搜索用于剪枝
+		uint8_t dir;
+		// 斜线扫描经过时已经展开的直线方向, 出堆后不再重复扫描
+		uint8_t skip;
+	};
+
+	// 每个 (x, y, layer) 的访问标记, generation不是当前代时视为未访问
+	struct Visit
+	{
+		uint32_t generation;
+		uint32_t node;
+	};
+
+	static const uint32_t ClosedIndex = 0xFFFFFFFF;
+	static const uint32_t NoParent = 0xFFFFFFFF;
+	static const uint8_t NoDir = 8;
+
+	Mode m_mode = Mode::AStar;
+	uint32_t m_jumpLimit = 4;
+
+	// 每个分块第一个layer的全局序号, 最后一个元素为总数
+	const TerrainData* m_data = nullptr;
+	std::vector<uint32_t> m_chunkBase;
+
+	std::vector<Visit> m_visit;
+	uint32_t m_generation = 0;
+
+	std::vector<Node> m_nodes;
+	uint32_t m_nodeCount = 0;
+
+	std::vector<uint32_t> m_heap;
+	uint32_t m_heapSize = 0;
+
+	uint32_t m_expanded = 0;
+	float m_cost = 0.f;
+
+	// 地形布局变化时重新计算分块序号, 访问表只增不减
+	void PrepareVisit(const TerrainData& data);
+	uint32_t Slot(const TerrainData& data, const VoxelPos& pos) const;
+
+	// 取节点, 未访问时从节点池分配, 节点池耗尽返回NoParent
+	uint32_t Touch(uint32_t slot, const VoxelPos& pos, bool& isNew);
+
+	bool Less(uint32_t a, uint32_t b) const;
+	void HeapPush(uint32_t node);
+	uint32_t HeapPop();
+	void HeapUp(uint32_t index);
+	void HeapDown(uint32_t index);
+
+	static float Heuristic(const VoxelPos& a, const VoxelPos& b);
+
+	// goal为空时不使用启发, 扩展全部可达节点
+	Result Search(const TerrainInstance& terr, const VoxelPos& start, const VoxelPos* goal, uint8_t radius, const GridRect* bounds, uint32_t& goalNode);
+
+	// 一个格子8个方向单步移动的结果, 跳点搜索时在相邻的两步之间复用
+	struct Around
+	{
+		VoxelPos pos;
+		// 可以移动的方向, 规则与GetWalkableNeighbors一致, bounds只限制目标格子
+		uint8_t walk;
+		// pos的8方向都在同一layer且没有掩码
+		bool plain;
+		// 同上, 每个target一位
+		uint8_t plainDirs;
+		VoxelPos target[8];
+		// 每个target所在layer的8方向关系, 检查斜向墙角时不用再取体素
+		TerrainData::NeighborLayer rels[8];
+	};
+
+	// 沿一个方向逐格前进的状态
+	struct Scan
+	{
+		// 起点的邻居, 走出一步后为空, 之后经过的格子都是开阔的
+		const Around* from;
+		VoxelPos pos;
+		uint32_t steps;
+		// 当前格子满足IsOpen
+		bool open;
+
+		explicit Scan(const Around& around) : from(&around), pos(around.pos), steps(0), open(false) {}
+	};
+
+	// 跳点搜索, 开阔的格子只展开自然方向并沿直线和斜线扫描, 其余格子同AStar逐格展开
+	Result JumpSearch(const TerrainInstance& terr, const VoxelPos& start, const VoxelPos& goal, uint8_t radius, const GridRect* bounds, uint32_t& goalNode);
+	// 从from沿直线dir扫过开阔格子, 停在第一个不开阔的格子, 目标或走满limit格处; 返回是否停在某个格子及前进的格数
+	static bool JumpStraight(const TerrainInstance& terr, const Around& from, uint8_t dir, const VoxelPos& goal, uint8_t radius, const GridRect* bounds, uint32_t limit, VoxelPos& out, uint32_t& steps);
+	// 从parent节点沿斜线dir前进, 每一步向两个分量方向直线扫描; 节点池耗尽时返回false
+	// 直线扫描有结果时把它们和当前格子一起加入, 当前格子出堆后只继续斜走
+	// 斜线停在不开阔的格子, 目标或走满m_jumpLimit格处时加入该格子
+	bool JumpDiagonal(const TerrainInstance& terr, uint32_t parent, const Around& from, uint8_t dir, const VoxelPos& goal, uint8_t radius, const GridRect* bounds);
+	// pos经parent以代价g沿dir到达, 新加入或代价变小时node为其节点, 否则为NoParent; 节点池耗尽时返回false
+	bool PushJump(const TerrainData& data, uint32_t parent, const VoxelPos& pos, const VoxelPos& goal, float g, uint8_t dir, uint8_t skip, uint32_t& node);
+	// 前进一格, 走不通时返回false
+	static bool Advance(const TerrainInstance& terr, Scan& scan, uint8_t dir, uint8_t radius, const GridRect* bounds);
+	// pos及周围8格在同一layer上互相连通且没有掩码, 从同一layer走来时不存在强迫邻居, 只需展开自然方向
+	// 从dir方向走来, 与上一格重叠的部分已经检查过, 只检查新进入的格子
+	static bool IsOpen(const TerrainInstance& terr, const VoxelPos& pos, uint8_t radius, const GridRect* bounds, uint8_t dir);
+	static void LoadAround(const TerrainInstance& terr, const VoxelPos& pos, uint8_t radius, const GridRect* bounds, Around& around);
+	// 开阔格子的8个邻居都在同一layer且可走, 不用取体素
+	static void OpenAround(const VoxelPos& pos, Around& around);
+
+	// 关系为rels的layer沿dir走一步是否落到target层
+	static bool Reaches(TerrainData::NeighborLayer rels, uint8_t layer, uint8_t dir, uint8_t target)
+	{
+		auto rel = LayerRelation((rels >> (dir * 2)) & 0x03);
+		return rel != LayerRelation::Unknow && TerrainData::RelationToLayer(layer, rel) == target;
+	}
+	// 斜向dir一步的两侧直线一步落在back(dir-1)和fwd(dir+1)的layer上, 关系分别为backRels和fwdRels
+	// 从两侧转向都要落到目标的layer, 目标已确定可走, 只比较layer
+	static bool SidesMeet(TerrainData::NeighborLayer backRels, uint8_t backLayer, TerrainData::NeighborLayer fwdRels, uint8_t fwdLayer, uint8_t dir, uint8_t layer)
+	{
+		return Reaches(backRels, backLayer, (dir + 1) & 7, layer) && Reaches(fwdRels, fwdLayer, dir - 1, layer);
+	}
+
+public:
+	explicit VoxelAStar(uint32_t maxNodes = 65536);
+
+	// 搜索start到goal的路径, 成功时path为包含首尾的格子序列; radius为占用半径, 用于掩码检测
+	// bounds不为空时只在区域内搜索
+	Result FindPath(const TerrainInstance& terr, const VoxelPos& start, const VoxelPos& goal, std::vector<VoxelPos>& path, uint8_t radius = 0, const GridRect* bounds = nullptr);
+
+	// 只影响FindPath, Flood始终逐格扩展
+	void SetMode(Mode mode) { m_mode = mode; }
+	Mode GetMode() const { return m_mode; }
+	// 跳点搜索单次最多前进的格数, 开阔地形上限制扫描范围, 走满时加入一个跳点, 不影响结果; 不超过65535
+	void SetJumpLimit(uint32_t limit) { m_jumpLimit = limit < 0xFFFF ? limit : 0xFFFF; }
+
+	// 从start出发计算bounds内所有可达格子的最短代价, 之后用FloodCost查询
+	Result Flood(const TerrainInstance& terr, const VoxelPos& start, uint8_t radius, const GridRect& bounds);
+	// 最近一次Flood到pos的代价, 不可达返回负数
+	float FloodCost(const TerrainData& data, const VoxelPos& pos) const;
+
+	// 最近一次搜索扩展的节点数, 跳点搜索时为扩展的跳点数
+	uint32_t ExpandedCount() const { return m_expanded; }
+	// 最近一次成功搜索的路径代价
+	float PathCost() const { return m_cost; }
+	uint32_t MaxNodes() const { return (uint32_t)m_nodes.size(); }
+
+	// 沿dir走一步, 不检查斜向墙角, 成功时out为目标格子
+	static bool StepOnce(const TerrainInstance& terr, const VoxelPos& pos, uint8_t dir, uint8_t radius, VoxelPos& out);
+
+	// 斜向dir从pos走到target时不能穿过墙角: 先走任一侧的直线再转向, 都要到达同一个格子和layer
+	// target的掩码由调用者检查
+	static bool CornerFree(const TerrainInstance& terr, const VoxelPos& pos, uint8_t dir, uint8_t radius, const VoxelPos& target);
+
+	// 计算 (x, y, layer) 可以走到的邻居, 返回数量; 斜向移动要求满足CornerFree
+	static uint8_t GetWalkableNeighbors(const TerrainInstance& terr, const VoxelPos& pos, uint8_t radius, VoxelPos neighbors[8], Direction dirs[8]);
+};
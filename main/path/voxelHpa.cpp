@@ -0,0 +1,471 @@
+#include "pch.h"
+#include "voxelHpa.h"
+#include <cmath>
+#include <algorithm>
+
+// 入口长度达到该值时在两端各放一个节点, 否则放在中间
+static const uint32_t LongEntrance = 6;
+// 起终点的八方向距离不超过该数量的簇时先用A*
+static const uint32_t ShortQuery = 2;
+// 入口到终点的代价还未计算, 不可达为-1
+static const float NotComputed = -2.f;
+
+VoxelHpa::VoxelHpa(const TerrainInstance& terr, uint32_t clusterSize)
+	: m_terr(terr), m_clusterSize(clusterSize), m_local(clusterSize * clusterSize * 64)
+{
+	const auto& data = terr.GetData();
+	m_clusterLength = (data.Length() + clusterSize - 1) / clusterSize;
+	m_clusterWidth = (data.Width() + clusterSize - 1) / clusterSize;
+	Build();
+}
+
+GridRect VoxelHpa::ClusterRect(uint32_t cluster) const
+{
+	const auto& data = m_terr.GetData();
+	uint32_t x = (cluster % m_clusterLength) * m_clusterSize;
+	uint32_t y = (cluster / m_clusterLength) * m_clusterSize;
+	return GridRect{ x, y, std::min(x + m_clusterSize, data.Length()) - 1, std::min(y + m_clusterSize, data.Width()) - 1 };
+}
+
+float VoxelHpa::Heuristic(const VoxelPos& a, const VoxelPos& b)
+{
+	float dx = std::fabs(float(a.x) - float(b.x));
+	float dy = std::fabs(float(a.y) - float(b.y));
+	return VoxelAStar::StraightCost * (dx + dy) + (VoxelAStar::DiagonalCost - 2 * VoxelAStar::StraightCost) * std::fmin(dx, dy);
+}
+
+uint32_t VoxelHpa::NewNode(const VoxelPos& pos, uint32_t cluster, uint32_t border)
+{
+	uint32_t id;
+	if (!m_freeNodes.empty())
+	{
+		id = m_freeNodes.back();
+		m_freeNodes.pop_back();
+	}
+	else
+	{
+		id = (uint32_t)m_nodes.size();
+		m_nodes.emplace_back();
+	}
+	auto& node = m_nodes[id];
+	node.pos = pos;
+	node.cluster = cluster;
+	node.border = border;
+	node.alive = true;
+	node.edges.clear();
+	return id;
+}
+
+uint8_t VoxelHpa::Transition(const VoxelPos& a, Direction dir, const VoxelPos& b) const
+{
+	if (m_terr.IsMask(a.x, a.y, a.layer) || m_terr.IsMask(b.x, b.y, b.layer))
+		return 0;
+	uint8_t ways = 0;
+	VoxelPos out;
+	if (VoxelAStar::StepOnce(m_terr, a, uint8_t(dir), 0, out) && out == b)
+		ways |= 1;
+	if (VoxelAStar::StepOnce(m_terr, b, (uint8_t(dir) + 4) & 7, 0, out) && out == a)
+		ways |= 2;
+	return ways;
+}
+
+void VoxelHpa::AddTransition(uint32_t border, const VoxelPos& a, const VoxelPos& b, uint8_t ways)
+{
+	// 同一格子在多个入口中出现时共用节点, 如多个layer落到同一格
+	auto node = [this, border](const VoxelPos& pos) {
+		for (auto id : m_borders[border])
+			if (m_nodes[id].pos == pos)
+				return id;
+		uint32_t id = NewNode(pos, ClusterIndex(pos.x, pos.y), border);
+		m_borders[border].push_back(id);
+		return id;
+	};
+	uint32_t na = node(a);
+	uint32_t nb = node(b);
+	if (ways & 1)
+		m_nodes[na].edges.push_back(Edge{ nb, VoxelAStar::StraightCost });
+	if (ways & 2)
+		m_nodes[nb].edges.push_back(Edge{ na, VoxelAStar::StraightCost });
+}
+
+void VoxelHpa::BuildBorder(uint32_t cluster, uint32_t axis)
+{
+	uint32_t border = cluster * 2 + axis;
+	for (auto id : m_borders[border])
+	{
+		m_nodes[id].alive = false;
+		m_nodes[id].edges.clear();
+		m_freeNodes.push_back(id);
+	}
+	m_borders[border].clear();
+
+	const auto& data = m_terr.GetData();
+	GridRect rect = ClusterRect(cluster);
+	Direction dir = axis == 0 ? Direction::Front : Direction::Right;
+	if ((axis == 0 && rect.maxX + 1 >= data.Length()) || (axis == 1 && rect.maxY + 1 >= data.Width()))
+		return;
+
+	// 边界上第i格两侧的格子
+	auto side = [&](uint32_t i, uint8_t layer, uint8_t layerB, VoxelPos& a, VoxelPos& b) {
+		a = VoxelPos{ axis == 0 ? rect.maxX : rect.minX + i, axis == 0 ? rect.minY + i : rect.maxY, layer };
+		b = VoxelPos{ a.x, a.y, layerB };
+		data.CalcDirectionGrid(dir, b.x, b.y);
+	};
+	struct Run
+	{
+		uint8_t layer;
+		uint8_t layerB;
+		uint8_t ways;
+		uint32_t start;
+		uint32_t length;
+	};
+	// 沿边界扫描, 两侧layer和可走方向都相同的连续格子组成一个入口
+	auto close = [&](const Run& run) {
+		VoxelPos a, b;
+		if (run.length >= LongEntrance)
+		{
+			side(run.start, run.layer, run.layerB, a, b);
+			AddTransition(border, a, b, run.ways);
+			side(run.start + run.length - 1, run.layer, run.layerB, a, b);
+			AddTransition(border, a, b, run.ways);
+		}
+		else
+		{
+			// 取入口中间的格子
+			side(run.start + run.length / 2, run.layer, run.layerB, a, b);
+			AddTransition(border, a, b, run.ways);
+		}
+	};
+	uint32_t length = axis == 0 ? rect.maxY - rect.minY + 1 : rect.maxX - rect.minX + 1;
+	std::vector<Run> runs, pairs;
+	for (uint32_t i = 0; i <= length; ++i)
+	{
+		// 第i格的所有入口: 从a的各layer走到b, 以及从b的各layer走回a
+		pairs.clear();
+		if (i < length)
+		{
+			VoxelPos a, b;
+			side(i, 0, 0, a, b);
+			uint8_t countA = data.GetVoxels(a.x, a.y).count;
+			uint8_t countB = data.GetVoxels(b.x, b.y).count;
+			VoxelPos out;
+			for (uint8_t layer = 0; layer < countA; ++layer)
+			{
+				a.layer = layer;
+				if (VoxelAStar::StepOnce(m_terr, a, uint8_t(dir), 0, out))
+					pairs.push_back(Run{ layer, out.layer, 0, i, 1 });
+			}
+			a.layer = 0;
+			for (uint8_t layer = 0; layer < countB; ++layer)
+			{
+				b.layer = layer;
+				if (VoxelAStar::StepOnce(m_terr, b, (uint8_t(dir) + 4) & 7, 0, out)
+					&& std::none_of(pairs.begin(), pairs.end(), [&](const Run& p) { return p.layer == out.layer && p.layerB == layer; }))
+					pairs.push_back(Run{ out.layer, layer, 0, i, 1 });
+			}
+			for (auto& pair : pairs)
+			{
+				side(i, pair.layer, pair.layerB, a, b);
+				pair.ways = Transition(a, dir, b);
+			}
+		}
+		// 延续上一格的入口, 断开的生成节点
+		for (size_t r = 0; r < runs.size(); )
+		{
+			auto it = std::find_if(pairs.begin(), pairs.end(), [&](const Run& p) {
+				return p.ways != 0 && p.layer == runs[r].layer && p.layerB == runs[r].layerB && p.ways == runs[r].ways;
+			});
+			if (it != pairs.end())
+			{
+				++runs[r].length;
+				it->ways = 0;
+				++r;
+				continue;
+			}
+			close(runs[r]);
+			runs.erase(runs.begin() + r);
+		}
+		for (const auto& pair : pairs)
+			if (pair.ways != 0)
+				runs.push_back(pair);
+	}
+}
+
+float VoxelHpa::ClusterCost(uint32_t cluster, const VoxelPos& a, const VoxelPos& b)
+{
+	if (a == b)
+		return 0.f;
+	GridRect rect = ClusterRect(cluster);
+	if (m_astar.FindPath(m_terr, a, b, m_cells, 0, &rect) != Result::Found)
+		return -1.f;
+	return m_astar.PathCost();
+}
+
+void VoxelHpa::BuildCluster(uint32_t cluster)
+{
+	auto& nodes = m_clusters[cluster].nodes;
+	nodes.clear();
+	uint32_t cx = cluster % m_clusterLength;
+	uint32_t cy = cluster / m_clusterLength;
+	const uint32_t borders[4] = {
+		cluster * 2, cluster * 2 + 1,
+		cx > 0 ? (cluster - 1) * 2 : UINT32_MAX,
+		cy > 0 ? (cluster - m_clusterLength) * 2 + 1 : UINT32_MAX,
+	};
+	for (auto border : borders)
+	{
+		if (border == UINT32_MAX)
+			continue;
+		for (auto id : m_borders[border])
+			if (m_nodes[id].cluster == cluster)
+				nodes.push_back(id);
+	}
+
+	// 只保留到同一边界另一侧的边, 重新计算簇内的边
+	// 重建的边界释放的节点号会立即被别的簇复用, 没有重建的边界上的节点仍有指向它们的旧边, 不能只按簇判断
+	for (auto id : nodes)
+	{
+		auto& edges = m_nodes[id].edges;
+		uint32_t border = m_nodes[id].border;
+		edges.erase(std::remove_if(edges.begin(), edges.end(), [this, cluster, border](const Edge& e) {
+			return m_nodes[e.to].cluster == cluster || m_nodes[e.to].border != border;
+		}), edges.end());
+	}
+	// 每个入口做一次簇内的全量搜索得到到其他入口的代价
+	GridRect rect = ClusterRect(cluster);
+	for (auto from : nodes)
+	{
+		m_astar.Flood(m_terr, m_nodes[from].pos, 0, rect);
+		for (auto to : nodes)
+		{
+			if (from == to)
+				continue;
+			float cost = m_astar.FloodCost(m_terr.GetData(), m_nodes[to].pos);
+			if (cost >= 0.f)
+				m_nodes[from].edges.push_back(Edge{ to, cost });
+		}
+	}
+	m_clusters[cluster].dirty = false;
+}
+
+void VoxelHpa::Build()
+{
+	m_clusters.assign(m_clusterLength * m_clusterWidth, Cluster());
+	m_borders.assign(m_clusters.size() * 2, std::vector<uint32_t>());
+	m_nodes.clear();
+	m_freeNodes.clear();
+	for (uint32_t c = 0; c < m_clusters.size(); ++c)
+	{
+		BuildBorder(c, 0);
+		BuildBorder(c, 1);
+	}
+	for (uint32_t c = 0; c < m_clusters.size(); ++c)
+		BuildCluster(c);
+	m_dirty = false;
+	m_changeCount = m_terr.ChangeCount();
+}
+
+void VoxelHpa::Invalidate(const GridRect& rect)
+{
+	if (rect.IsEmpty())
+		return;
+	// 边界上的格子同时影响相邻簇的入口, 向外扩一格
+	GridRect r = rect.Expand(1, m_terr.GetData().Length(), m_terr.GetData().Width());
+	for (uint32_t cy = r.minY / m_clusterSize; cy <= r.maxY / m_clusterSize; ++cy)
+		for (uint32_t cx = r.minX / m_clusterSize; cx <= r.maxX / m_clusterSize; ++cx)
+			m_clusters[cy * m_clusterLength + cx].dirty = true;
+	m_dirty = true;
+}
+
+void VoxelHpa::Rebuild()
+{
+	if (m_changeCount != m_terr.ChangeCount())
+	{
+		if (!m_terr.ForEachChange(m_changeCount, [this](const GridRect& rect) { Invalidate(rect); }))
+			return Build();
+		m_changeCount = m_terr.ChangeCount();
+	}
+	if (!m_dirty)
+		return;
+	// 脏簇的四条边界重建入口, 入口变化的簇都要重算簇内的边
+	std::vector<uint32_t> rebuild;
+	for (uint32_t c = 0; c < m_clusters.size(); ++c)
+	{
+		if (!m_clusters[c].dirty)
+			continue;
+		uint32_t cx = c % m_clusterLength;
+		uint32_t cy = c / m_clusterLength;
+		BuildBorder(c, 0);
+		BuildBorder(c, 1);
+		rebuild.push_back(c);
+		if (cx + 1 < m_clusterLength)
+			rebuild.push_back(c + 1);
+		if (cy + 1 < m_clusterWidth)
+			rebuild.push_back(c + m_clusterLength);
+		if (cx > 0)
+		{
+			BuildBorder(c - 1, 0);
+			rebuild.push_back(c - 1);
+		}
+		if (cy > 0)
+		{
+			BuildBorder(c - m_clusterLength, 1);
+			rebuild.push_back(c - m_clusterLength);
+		}
+	}
+	std::sort(rebuild.begin(), rebuild.end());
+	rebuild.erase(std::unique(rebuild.begin(), rebuild.end()), rebuild.end());
+	for (auto c : rebuild)
+		BuildCluster(c);
+	m_dirty = false;
+}
+
+VoxelHpa::Result VoxelHpa::FindAbstractPath(const VoxelPos& start, const VoxelPos& goal, std::vector<VoxelPos>& waypoints)
+{
+	waypoints.clear();
+	m_expanded = 0;
+	const auto& data = m_terr.GetData();
+	if (!data.IsValidGrid(start.x, start.y) || !data.IsValidGrid(goal.x, goal.y))
+		return Result::NotFound;
+	Rebuild();
+
+	uint32_t startCluster = ClusterIndex(start.x, start.y);
+	uint32_t goalCluster = ClusterIndex(goal.x, goal.y);
+	if (startCluster == goalCluster && ClusterCost(startCluster, start, goal) >= 0.f)
+	{
+		waypoints.push_back(start);
+		waypoints.push_back(goal);
+		return Result::Found;
+	}
+
+	// 起点和终点作为临时节点, 与所在簇的入口相连
+	const auto& startNodes = m_clusters[startCluster].nodes;
+	const auto& goalNodes = m_clusters[goalCluster].nodes;
+	m_startCost.resize(startNodes.size());
+	m_goalCost.resize(goalNodes.size());
+	m_astar.Flood(m_terr, start, 0, ClusterRect(startCluster));
+	for (size_t i = 0; i < startNodes.size(); ++i)
+		m_startCost[i] = m_astar.FloodCost(data, m_nodes[startNodes[i]].pos);
+	// 到终点的代价在入口出堆时才计算, 大多数入口用不到
+	std::fill(m_goalCost.begin(), m_goalCost.end(), NotComputed);
+
+	uint32_t goalId = (uint32_t)m_nodes.size();
+	uint32_t startId = goalId + 1;
+	if (m_generation.size() < m_nodes.size() + 2)
+	{
+		m_generation.resize(m_nodes.size() + 2, 0);
+		m_g.resize(m_nodes.size() + 2);
+		m_parent.resize(m_nodes.size() + 2);
+	}
+	if (++m_curGeneration == 0)
+	{
+		std::fill(m_generation.begin(), m_generation.end(), 0);
+		m_curGeneration = 1;
+	}
+	m_open.clear();
+	auto relax = [this, &goal](uint32_t id, const VoxelPos& pos, uint32_t parent, float g) {
+		if (m_generation[id] == m_curGeneration && m_g[id] <= g)
+			return;
+		m_generation[id] = m_curGeneration;
+		m_g[id] = g;
+		m_parent[id] = parent;
+		m_open.emplace_back(-(g + Heuristic(pos, goal)), id);
+		std::push_heap(m_open.begin(), m_open.end());
+	};
+	for (size_t i = 0; i < startNodes.size(); ++i)
+		if (m_startCost[i] >= 0.f)
+			relax(startNodes[i], m_nodes[startNodes[i]].pos, startId, m_startCost[i]);
+
+	bool found = false;
+	while (!m_open.empty())
+	{
+		std::pop_heap(m_open.begin(), m_open.end());
+		auto top = m_open.back();
+		m_open.pop_back();
+		uint32_t id = top.second;
+		if (id == goalId)
+		{
+			found = true;
+			break;
+		}
+		const auto& node = m_nodes[id];
+		// 已有更短的记录
+		if (-top.first > m_g[id] + Heuristic(node.pos, goal) + 1e-4f)
+			continue;
+		++m_expanded;
+		VOXEL_COUNT(HpaExpanded, 1);
+		for (const auto& e : node.edges)
+			relax(e.to, m_nodes[e.to].pos, id, m_g[id] + e.cost);
+		if (node.cluster == goalCluster)
+		{
+			auto it = std::find(goalNodes.begin(), goalNodes.end(), id);
+			float& cost = m_goalCost[it - goalNodes.begin()];
+			if (cost == NotComputed)
+				cost = ClusterCost(goalCluster, node.pos, goal);
+			if (cost >= 0.f)
+				relax(goalId, goal, id, m_g[id] + cost);
+		}
+	}
+	if (!found)
+		return Result::NotFound;
+
+	waypoints.push_back(goal);
+	for (uint32_t id = m_parent[goalId]; id != startId; id = m_parent[id])
+		waypoints.push_back(m_nodes[id].pos);
+	waypoints.push_back(start);
+	std::reverse(waypoints.begin(), waypoints.end());
+	return Result::Found;
+}
+
+VoxelHpa::Result VoxelHpa::RefineSegment(const VoxelPos& a, const VoxelPos& b, std::vector<VoxelPos>& path)
+{
+	uint32_t ca = ClusterIndex(a.x, a.y);
+	uint32_t cb = ClusterIndex(b.x, b.y);
+	if (ca != cb)
+	{
+		// 跨簇的入口边, 两格相邻且按附近关系一步可达
+		uint8_t dir = 0;
+		while (dir < 8 && (int64_t(a.x) + TerrainData::DirectionOffsetX[dir] != int64_t(b.x) || int64_t(a.y) + TerrainData::DirectionOffsetY[dir] != int64_t(b.y)))
+			++dir;
+		VoxelPos out;
+		if (dir == 8 || !VoxelAStar::StepOnce(m_terr, a, dir, 0, out) || out != b)
+			return Result::NotFound;
+		if (path.empty() || path.back() != a)
+			path.push_back(a);
+		path.push_back(b);
+		return Result::Found;
+	}
+	GridRect rect = ClusterRect(ca);
+	auto result = m_astar.FindPath(m_terr, a, b, m_cells, 0, &rect);
+	if (result != Result::Found)
+		return result;
+	size_t first = !path.empty() && path.back() == a ? 1 : 0;
+	path.insert(path.end(), m_cells.begin() + first, m_cells.end());
+	return result;
+}
+
+VoxelHpa::Result VoxelHpa::FindPath(const VoxelPos& start, const VoxelPos& goal, std::vector<VoxelPos>& path)
+{
+	path.clear();
+	// 近距离的抽象路径绕行入口, 代价明显偏高; A*结果最优, 节点池耗尽说明要绕远, 再用抽象图
+	if (Heuristic(start, goal) <= float(m_clusterSize * ShortQuery))
+	{
+		auto result = m_local.FindPath(m_terr, start, goal, path);
+		if (result != Result::NodeLimit)
+			return result;
+	}
+	std::vector<VoxelPos> waypoints;
+	auto result = FindAbstractPath(start, goal, waypoints);
+	if (result != Result::Found)
+		return result;
+	for (size_t i = 1; i < waypoints.size(); ++i)
+	{
+		result = RefineSegment(waypoints[i - 1], waypoints[i], path);
+		if (result != Result::Found)
+		{
+			path.clear();
+			return result;
+		}
+	}
+	return result;
+}
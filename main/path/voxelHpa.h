@@ -0,0 +1,110 @@
+#pragma once
+
+#include <vector>
+#include "voxel.h"
+#include "voxelAStar.h"
+
+// 分层寻路(HPA*): 地图按clusterSize分簇, 在簇边界上按layer找入口节点, 预先缓存簇内入口间的代价
+// 长距离寻路先在抽象图上搜索, 再只细化用到的路段, 近距离直接用A*
+// 按地形实例的修改记录, 下次寻路前只重建受影响的簇
+class VoxelHpa
+{
+public:
+	typedef VoxelAStar::Result Result;
+
+private:
+	struct Edge
+	{
+		uint32_t to;
+		float cost;
+	};
+
+	// 抽象节点, 位于簇边界的格子上
+	struct Node
+	{
+		VoxelPos pos;
+		uint32_t cluster;
+		// 所在的边界, 跨簇的边只连向同一边界另一侧的节点
+		uint32_t border;
+		bool alive;
+		std::vector<Edge> edges;
+	};
+
+	struct Cluster
+	{
+		std::vector<uint32_t> nodes;
+		bool dirty;
+	};
+
+	const TerrainInstance& m_terr;
+	uint32_t m_clusterSize;
+	uint32_t m_clusterLength;
+	uint32_t m_clusterWidth;
+
+	std::vector<Cluster> m_clusters;
+	// 每个簇与+x(偶数), +y(奇数)方向相邻簇之间的入口节点
+	std::vector<std::vector<uint32_t>> m_borders;
+	std::vector<Node> m_nodes;
+	std::vector<uint32_t> m_freeNodes;
+	bool m_dirty = false;
+	// 已处理到的地形实例修改次数
+	uint32_t m_changeCount = 0;
+
+	// 簇内搜索
+	VoxelAStar m_astar;
+	// 近距离查询的A*, 节点池按簇的大小限制, 耗尽时改用抽象图
+	VoxelAStar m_local;
+	std::vector<VoxelPos> m_cells;
+
+	// 抽象图搜索, 按代标记
+	std::vector<uint32_t> m_generation;
+	std::vector<float> m_g;
+	std::vector<uint32_t> m_parent;
+	std::vector<std::pair<float, uint32_t>> m_open;
+	uint32_t m_curGeneration = 0;
+	std::vector<float> m_startCost;
+	std::vector<float> m_goalCost;
+	uint32_t m_expanded = 0;
+
+	uint32_t ClusterIndex(uint32_t x, uint32_t y) const { return (y / m_clusterSize) * m_clusterLength + x / m_clusterSize; }
+	GridRect ClusterRect(uint32_t cluster) const;
+
+	uint32_t NewNode(const VoxelPos& pos, uint32_t cluster, uint32_t border);
+	// a与dir方向相邻簇中的b之间可走的方向, 1为a到b, 2为b到a, 两格都不能被占用
+	uint8_t Transition(const VoxelPos& a, Direction dir, const VoxelPos& b) const;
+	// 入口可以是单向的, 只添加可走方向的边; 边界上已有的格子复用节点
+	void AddTransition(uint32_t border, const VoxelPos& a, const VoxelPos& b, uint8_t ways);
+	void BuildBorder(uint32_t cluster, uint32_t axis);
+	void BuildCluster(uint32_t cluster);
+
+	// 簇内两点间的代价, 不可达返回负数
+	float ClusterCost(uint32_t cluster, const VoxelPos& a, const VoxelPos& b);
+	static float Heuristic(const VoxelPos& a, const VoxelPos& b);
+
+	// 标记区域内的掩码或地形已修改
+	void Invalidate(const GridRect& rect);
+
+public:
+	VoxelHpa(const TerrainInstance& terr, uint32_t clusterSize = 16);
+
+	// 重建全部抽象图
+	void Build();
+
+	// 按地形实例上次之后的修改记录重建受影响的簇及其边界, 记录已被覆盖时全部重建; 寻路前自动调用
+	void Rebuild();
+
+	// 抽象路径: 起点, 经过的入口节点, 终点
+	Result FindAbstractPath(const VoxelPos& start, const VoxelPos& goal, std::vector<VoxelPos>& waypoints);
+
+	// 细化抽象路径中相邻两点之间的路段, 追加到path, 与path末尾相同的首格不重复追加
+	// 跨簇的两点必须一步可达, 否则返回NotFound
+	Result RefineSegment(const VoxelPos& a, const VoxelPos& b, std::vector<VoxelPos>& path);
+
+	// 近距离时先用A*, 否则或A*节点池耗尽时抽象搜索后细化全部路段
+	Result FindPath(const VoxelPos& start, const VoxelPos& goal, std::vector<VoxelPos>& path);
+
+	uint32_t ClusterSize() const { return m_clusterSize; }
+	uint32_t NodeCount() const { return uint32_t(m_nodes.size() - m_freeNodes.size()); }
+	// 最近一次抽象搜索扩展的节点数
+	uint32_t ExpandedCount() const { return m_expanded; }
+};
@@ -0,0 +1,135 @@
+#include "pch.h"
+#include "voxelRaycast.h"
+#include <cmath>
+#include <algorithm>
+#include "utils/threadPool.h"
+
+bool VoxelRaycast::TestCell(const TerrainData& data, const Ray& ray, uint32_t x, uint32_t y, float t0, float t1, const MaskOption& option, bool end, float& hit)
+{
+	// 格子内线段是直线, 高度区间由两端决定
+	float dz = ray.to.z - ray.from.z;
+	float z0 = ray.from.z + dz * t0;
+	float z1 = ray.from.z + dz * t1;
+	float zmin = std::min(z0, z1);
+	float zmax = std::max(z0, z1);
+
+	auto vols = data.GetVoxels(x, y);
+	uint8_t layer = data.GetLayer(vols, zmin);
+	float upper = data.GetVoxelUpper(vols, layer);
+	// 低点在layer上表面以下, 或高点碰到上一个layer的下表面
+	if (upper > zmin || (layer + 1 < vols.count && zmax > data.GetVoxelDown(vols, layer + 1)))
+	{
+		hit = t0;
+		return true;
+	}
+	if (option.masks && !(option.ignoreEnds && end) && zmin < upper + option.height && option.masks->IsMask(x, y, layer))
+	{
+		hit = t0;
+		return true;
+	}
+	return false;
+}
+
+VoxelRaycast::Hit VoxelRaycast::Cast(const TerrainData& data, const Ray& ray, const MaskOption& option)
+{
+	const float size = data.GridSize();
+	int64_t x = (int64_t)std::floor(ray.from.x / size);
+	int64_t y = (int64_t)std::floor(ray.from.y / size);
+	const int64_t endX = (int64_t)std::floor(ray.to.x / size);
+	const int64_t endY = (int64_t)std::floor(ray.to.y / size);
+	if (x < 0 || y < 0 || !data.IsValidGrid(uint32_t(x), uint32_t(y)))
+		return Hit{ true, 0.f, uint32_t(std::max<int64_t>(x, 0)), uint32_t(std::max<int64_t>(y, 0)) };
+
+	// 与VoxelProxy::MoveTo相同的遍历
+	float dx = ray.to.x - ray.from.x;
+	float dy = ray.to.y - ray.from.y;
+	int stepX = dx > 0.f ? 1 : dx < 0.f ? -1 : 0;
+	int stepY = dy > 0.f ? 1 : dy < 0.f ? -1 : 0;
+	float maxX = stepX > 0 ? ((x + 1) * size - ray.from.x) / dx : stepX < 0 ? (x * size - ray.from.x) / dx : FLT_MAX;
+	float maxY = stepY > 0 ? ((y + 1) * size - ray.from.y) / dy : stepY < 0 ? (y * size - ray.from.y) / dy : FLT_MAX;
+	float deltaX = stepX != 0 ? size / std::fabs(dx) : FLT_MAX;
+	float deltaY = stepY != 0 ? size / std::fabs(dy) : FLT_MAX;
+
+	float t0 = 0.f;
+	bool first = true;
+	while (true)
+	{
+		bool last = x == endX && y == endY;
+		bool alongX = maxX <= maxY;
+		// 浮点误差使终点格子与遍历结果不一致时, 以t到达1为准
+		float t1 = last ? 1.f : std::min(alongX ? maxX : maxY, 1.f);
+		float hit;
+		if (TestCell(data, ray, uint32_t(x), uint32_t(y), t0, t1, option, first || last || t1 >= 1.f, hit))
+			return Hit{ true, hit, uint32_t(x), uint32_t(y) };
+		if (last || t1 >= 1.f)
+			break;
+
+		int64_t nx = x, ny = y;
+		if (alongX)
+		{
+			nx += stepX;
+			maxX += deltaX;
+		}
+		else
+		{
+			ny += stepY;
+			maxY += deltaY;
+		}
+		// 离开地图, 报告最后一个格子
+		if (nx < 0 || ny < 0 || !data.IsValidGrid(uint32_t(nx), uint32_t(ny)))
+			return Hit{ true, t1, uint32_t(x), uint32_t(y) };
+		x = nx;
+		y = ny;
+		t0 = t1;
+		first = false;
+	}
+	return Hit{ false, 1.f, uint32_t(endX), uint32_t(endY) };
+}
+
+void VoxelRaycast::SortRays(const TerrainData& data, const Ray* rays, uint32_t count, std::vector<uint32_t>& order)
+{
+	order.resize(count);
+	if (count < SortThreshold)
+	{
+		for (uint32_t i = 0; i < count; ++i)
+			order[i] = i;
+		return;
+	}
+	// 高32位为分块序号和块内格子序号, 低32位为射线序号, 地图外的起点排在最后
+	const float size = data.GridSize();
+	std::vector<uint64_t> keys(count);
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		int64_t x = (int64_t)std::floor(rays[i].from.x / size);
+		int64_t y = (int64_t)std::floor(rays[i].from.y / size);
+		uint32_t key = UINT32_MAX;
+		if (x >= 0 && y >= 0 && data.IsValidGrid(uint32_t(x), uint32_t(y)))
+		{
+			const uint32_t mask = TerrainData::ChunkSize - 1;
+			key = (data.ChunkIndex(uint32_t(x), uint32_t(y)) << (TerrainData::ChunkShift * 2)) | ((uint32_t(y) & mask) << TerrainData::ChunkShift) | (uint32_t(x) & mask);
+		}
+		keys[i] = (uint64_t(key) << 32) | i;
+	}
+	std::sort(keys.begin(), keys.end());
+	for (uint32_t i = 0; i < count; ++i)
+		order[i] = uint32_t(keys[i]);
+}
+
+void VoxelRaycast::CastBatch(const TerrainData& data, const Ray* rays, uint32_t count, Hit* hits, const MaskOption& option)
+{
+	std::vector<uint32_t> order;
+	SortRays(data, rays, count, order);
+	for (uint32_t i : order)
+		hits[i] = Cast(data, rays[i], option);
+}
+
+void VoxelRaycast::CastBatch(ThreadPool& pool, const TerrainData& data, const Ray* rays, uint32_t count, Hit* hits, const MaskOption& option)
+{
+	std::vector<uint32_t> order;
+	SortRays(data, rays, count, order);
+	// 每段为排序后连续的射线, 各段写入不同的hits
+	pool.ParallelFor(count, 1024, [&](uint32_t begin, uint32_t end) {
+		for (uint32_t i = begin; i < end; ++i)
+			hits[order[i]] = Cast(data, rays[order[i]], option);
+	});
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <vector>
+#include <cfloat>
+#include "voxel.h"
+
+class ThreadPool;
+
+// 分层体素上的射线检测: 沿线段逐格遍历(Amanatides-Woo), 检查线段在每个格子内的高度区间
+// 是否落在同一段空隙内, 空隙为某个layer的上表面到上一个layer的下表面之间, 最高layer以上不封顶
+// 可选把TerrainInstance的掩码当作动态遮挡
+class VoxelRaycast
+{
+public:
+	struct Ray
+	{
+		Location from;
+		Location to;
+	};
+
+	struct Hit
+	{
+		// 是否被挡住
+		bool blocked;
+		// 挡住的位置在线段上的比例, 没挡住时为1
+		float t;
+		// 挡住的格子, 离开地图时为最后一个格子, 没挡住时为终点格子
+		uint32_t x;
+		uint32_t y;
+	};
+
+	// 掩码遮挡的设置, masks为空时只检查地形
+	struct MaskOption
+	{
+		const TerrainInstance* masks;
+		// 掩码只挡住离所在layer上表面不超过该高度的部分
+		float height;
+		// 起点和终点所在格子的掩码不算遮挡, 一般是观察者和目标自己
+		bool ignoreEnds;
+
+		MaskOption(const TerrainInstance* masks = nullptr, float height = FLT_MAX, bool ignoreEnds = true)
+			: masks(masks), height(height), ignoreEnds(ignoreEnds)
+		{
+		}
+	};
+
+	// 批量检测时少于该数量不排序
+	static const uint32_t SortThreshold = 64;
+
+private:
+	// 线段在 [t0, t1] 内经过格子 (x, y) 时是否被挡住, 挡住时hit为挡住的位置
+	static bool TestCell(const TerrainData& data, const Ray& ray, uint32_t x, uint32_t y, float t0, float t1, const MaskOption& option, bool end, float& hit);
+
+	// 按起点所在分块和格子排序, 相邻的射线读取相同的数据
+	static void SortRays(const TerrainData& data, const Ray* rays, uint32_t count, std::vector<uint32_t>& order);
+
+public:
+	// 单条射线, 离开地图视为被挡住
+	static Hit Cast(const TerrainData& data, const Ray& ray, const MaskOption& option = MaskOption());
+
+	// 两点之间是否可见
+	static bool IsVisible(const TerrainData& data, const Location& from, const Location& to, const MaskOption& option = MaskOption())
+	{
+		return !Cast(data, Ray{ from, to }, option).blocked;
+	}
+
+	// 批量检测, 结果按输入顺序写入hits; 内部按起点位置排序后处理
+	static void CastBatch(const TerrainData& data, const Ray* rays, uint32_t count, Hit* hits, const MaskOption& option = MaskOption());
+	// 排序后分段交给线程池
+	static void CastBatch(ThreadPool& pool, const TerrainData& data, const Ray* rays, uint32_t count, Hit* hits, const MaskOption& option = MaskOption());
+};
@@ -0,0 +1,329 @@
+#include "pch.h"
+#include "voxelRegion.h"
+#include "voxelAStar.h"
+#include <algorithm>
+
+VoxelRegion::VoxelRegion(const TerrainInstance& terr, uint8_t radius)
+	: m_terr(terr), m_radius(radius)
+{
+	Build();
+}
+
+VoxelRegion::Cell& VoxelRegion::GetCell(const VoxelPos& pos)
+{
+	const auto& data = m_terr.GetData();
+	return m_cells[data.ChunkIndex(pos.x, pos.y)][data.GetVoxels(pos.x, pos.y).slot + pos.layer];
+}
+
+const VoxelRegion::Cell& VoxelRegion::GetCell(const VoxelPos& pos) const
+{
+	const auto& data = m_terr.GetData();
+	return m_cells[data.ChunkIndex(pos.x, pos.y)][data.GetVoxels(pos.x, pos.y).slot + pos.layer];
+}
+
+uint32_t VoxelRegion::NewRegion()
+{
+	m_parent.push_back((uint32_t)m_parent.size());
+	return m_parent.back();
+}
+
+uint32_t VoxelRegion::Find(uint32_t region)
+{
+	while (m_parent[region] != region)
+	{
+		m_parent[region] = m_parent[m_parent[region]];
+		region = m_parent[region];
+	}
+	return region;
+}
+
+uint32_t VoxelRegion::FindGroup(uint32_t group)
+{
+	while (m_groups[group] != group)
+	{
+		m_groups[group] = m_groups[m_groups[group]];
+		group = m_groups[group];
+	}
+	return group;
+}
+
+bool VoxelRegion::IsNode(const VoxelPos& pos) const
+{
+	return !m_terr.IsMask(pos.x, pos.y, pos.layer, m_radius);
+}
+
+template<typename Fn>
+void VoxelRegion::ForEachLink(const VoxelPos& pos, Fn fn) const
+{
+	VoxelPos neighbors[8];
+	Direction dirs[8];
+	uint8_t count = VoxelAStar::GetWalkableNeighbors(m_terr, pos, m_radius, neighbors, dirs);
+	for (uint8_t i = 0; i < count; ++i)
+		fn(neighbors[i]);
+
+	// 反向: u沿dir走到pos, 规则同FlowField
+	const auto& data = m_terr.GetData();
+	for (uint8_t dir = 0; dir < 8; ++dir)
+	{
+		uint32_t ux = pos.x, uy = pos.y;
+		data.CalcDirectionGrid(Direction((dir + 4) & 7), ux, uy);
+		if (!data.IsValidGrid(ux, uy))
+			continue;
+		auto vols = data.GetVoxels(ux, uy);
+		for (uint8_t layer = 0; layer < vols.count; ++layer)
+		{
+			auto rel = data.GetNeighborLayerRelation(vols, layer, Direction(dir));
+			if (rel == LayerRelation::Unknow || TerrainData::RelationToLayer(layer, rel) != pos.layer)
+				continue;
+			VoxelPos u{ ux, uy, layer };
+			if (!IsNode(u))
+				continue;
+			// 斜向不能穿过墙角
+			if ((dir & 1) && !VoxelAStar::CornerFree(m_terr, u, dir, m_radius, pos))
+				continue;
+			fn(u);
+		}
+	}
+}
+
+void VoxelRegion::Fill(const VoxelPos& seed, uint32_t region, const GridRect* bounds)
+{
+	m_queue.clear();
+	GetCell(seed).region = region;
+	m_queue.push_back(seed);
+	for (size_t head = 0; head < m_queue.size(); ++head)
+	{
+		VoxelPos pos = m_queue[head];
+		ForEachLink(pos, [&](const VoxelPos& next) {
+			auto& cell = GetCell(next);
+			if (bounds && !bounds->Contains(next.x, next.y))
+			{
+				// 区域外的格子标记不变, 连通时合并区域号
+				if (cell.region == NoRegion)
+					return;
+				uint32_t a = Find(region), b = Find(cell.region);
+				if (a != b)
+					m_parent[b] = a;
+				return;
+			}
+			if (cell.region != NoRegion)
+				return;
+			cell.region = region;
+			m_queue.push_back(next);
+		});
+	}
+}
+
+void VoxelRegion::Build()
+{
+	const auto& data = m_terr.GetData();
+	m_cells.resize(data.ChunkCount());
+	for (uint32_t c = 0; c < data.ChunkCount(); ++c)
+		m_cells[c].assign(data.SlotCount(c), Cell{ NoRegion, 0, 0 });
+	m_parent.clear();
+	m_mark = 0;
+
+	for (uint32_t y = 0; y < data.Width(); ++y)
+		for (uint32_t x = 0; x < data.Length(); ++x)
+		{
+			auto vols = data.GetVoxels(x, y);
+			for (uint8_t layer = 0; layer < vols.count; ++layer)
+			{
+				VoxelPos pos{ x, y, layer };
+				if (GetCell(pos).region == NoRegion && IsNode(pos))
+					Fill(pos, NewRegion(), nullptr);
+			}
+		}
+}
+
+void VoxelRegion::Update(const GridRect& rect)
+{
+	if (rect.IsEmpty())
+		return;
+	const auto& data = m_terr.GetData();
+	if (m_cells.size() != data.ChunkCount())
+		return Build();
+
+	// 分块追加或整理layer后, 变化的格子都在rect内, 只需调整长度
+	size_t total = 0;
+	for (uint32_t c = 0; c < data.ChunkCount(); ++c)
+	{
+		m_cells[c].resize(data.SlotCount(c), Cell{ NoRegion, 0, 0 });
+		total += m_cells[c].size();
+	}
+	// 合并和拆分只增加区域号, 太多时整体重建
+	if (m_parent.size() > total * 2 + 1024)
+		return Build();
+
+	// 带半径的掩码影响周围radius格, 斜向移动还要检查两侧格子
+	GridRect dirty = rect.Expand(m_radius + 1, data.Length(), data.Width());
+	for (uint32_t y = dirty.minY; y <= dirty.maxY; ++y)
+		for (uint32_t x = dirty.minX; x <= dirty.maxX; ++x)
+		{
+			auto vols = data.GetVoxels(x, y);
+			for (uint8_t layer = 0; layer < vols.count; ++layer)
+				GetCell(VoxelPos{ x, y, layer }).region = NoRegion;
+		}
+
+	// 外围一圈格子按原区域分组, 去掉dirty后同一区域的各部分都至少包含其中一个格子
+	std::vector<std::pair<uint32_t, VoxelPos>> ring;
+	GridRect outer = dirty.Expand(1, data.Length(), data.Width());
+	for (uint32_t y = outer.minY; y <= outer.maxY; ++y)
+		for (uint32_t x = outer.minX; x <= outer.maxX; ++x)
+		{
+			if (dirty.Contains(x, y))
+				continue;
+			auto vols = data.GetVoxels(x, y);
+			for (uint8_t layer = 0; layer < vols.count; ++layer)
+			{
+				VoxelPos pos{ x, y, layer };
+				uint32_t region = GetCell(pos).region;
+				if (region != NoRegion)
+					ring.emplace_back(Find(region), pos);
+			}
+		}
+	std::stable_sort(ring.begin(), ring.end(), [](const std::pair<uint32_t, VoxelPos>& a, const std::pair<uint32_t, VoxelPos>& b) { return a.first < b.first; });
+	std::vector<VoxelPos> seeds;
+	for (size_t i = 0; i < ring.size(); )
+	{
+		size_t j = i;
+		seeds.clear();
+		for (; j < ring.size() && ring[j].first == ring[i].first; ++j)
+			seeds.push_back(ring[j].second);
+		if (seeds.size() > 1)
+			Split(ring[i].first, seeds, dirty);
+		i = j;
+	}
+
+	// 重新标记dirty, 连到外面的区域时合并
+	for (uint32_t y = dirty.minY; y <= dirty.maxY; ++y)
+		for (uint32_t x = dirty.minX; x <= dirty.maxX; ++x)
+		{
+			auto vols = data.GetVoxels(x, y);
+			for (uint8_t layer = 0; layer < vols.count; ++layer)
+			{
+				VoxelPos pos{ x, y, layer };
+				if (GetCell(pos).region == NoRegion && IsNode(pos))
+					Fill(pos, NewRegion(), &dirty);
+			}
+		}
+}
+
+void VoxelRegion::Split(uint32_t root, const std::vector<VoxelPos>& seeds, const GridRect& dirty)
+{
+	if (++m_mark == 0)
+	{
+		for (auto& cells : m_cells)
+			for (auto& cell : cells)
+				cell.mark = 0;
+		m_mark = 1;
+	}
+
+	uint32_t count = 0;
+	m_groups.clear();
+	m_groupLive.clear();
+	for (const auto& seed : seeds)
+	{
+		auto& cell = GetCell(seed);
+		if (cell.mark == m_mark)
+			continue;
+		cell.mark = m_mark;
+		cell.owner = count;
+		if (m_searches.size() <= count)
+			m_searches.emplace_back();
+		auto& search = m_searches[count];
+		search.cells.assign(1, seed);
+		search.head = 0;
+		search.group = count;
+		m_groups.push_back(count);
+		m_groupLive.push_back(1);
+		++count;
+	}
+
+	// 各搜索轮流扩展一个格子, 相遇的合并为一组; 一组搜索完时它就是断开的一部分
+	// 只剩一组时停止, 剩下的部分保留原区域号, 所以代价只与较小的部分有关
+	uint32_t active = count;
+	while (active > 1)
+	{
+		for (uint32_t i = 0; i < count && active > 1; ++i)
+		{
+			auto& search = m_searches[i];
+			if (search.head == search.cells.size())
+				continue;
+			VoxelPos pos = search.cells[search.head++];
+			ForEachLink(pos, [&](const VoxelPos& next) {
+				if (dirty.Contains(next.x, next.y))
+					return;
+				auto& cell = GetCell(next);
+				if (cell.region == NoRegion || Find(cell.region) != root)
+					return;
+				if (cell.mark != m_mark)
+				{
+					cell.mark = m_mark;
+					cell.owner = i;
+					search.cells.push_back(next);
+					return;
+				}
+				uint32_t a = FindGroup(i), b = FindGroup(cell.owner);
+				if (a == b)
+					return;
+				m_groups[b] = a;
+				m_groupLive[a] += m_groupLive[b];
+				--active;
+			});
+			if (search.head < search.cells.size())
+				continue;
+			uint32_t group = FindGroup(i);
+			if (--m_groupLive[group] > 0 || active <= 1)
+				continue;
+			uint32_t region = NewRegion();
+			for (uint32_t j = 0; j < count; ++j)
+			{
+				if (FindGroup(j) != group)
+					continue;
+				for (const auto& cellPos : m_searches[j].cells)
+					GetCell(cellPos).region = region;
+			}
+			--active;
+		}
+	}
+}
+
+uint32_t VoxelRegion::Region(const VoxelPos& pos) const
+{
+	const auto& data = m_terr.GetData();
+	if (!data.IsValidGrid(pos.x, pos.y) || pos.layer >= data.GetVoxels(pos.x, pos.y).count)
+		return NoRegion;
+	uint32_t region = GetCell(pos).region;
+	if (region == NoRegion)
+		return NoRegion;
+	while (m_parent[region] != region)
+		region = m_parent[region];
+	return region;
+}
+
+bool VoxelRegion::IsReachable(const VoxelPos& from, const VoxelPos& to) const
+{
+	const auto& data = m_terr.GetData();
+	if (!data.IsValidGrid(from.x, from.y) || from.layer >= data.GetVoxels(from.x, from.y).count)
+		return false;
+	if (from == to)
+		return true;
+	uint32_t region = Region(to);
+	if (region == NoRegion)
+		return false;
+	uint32_t start = Region(from);
+	if (start != NoRegion)
+		return start == region;
+
+	// 起点被掩码占住时仍可以走出去
+	VoxelPos neighbors[8];
+	Direction dirs[8];
+	uint8_t count = VoxelAStar::GetWalkableNeighbors(m_terr, from, m_radius, neighbors, dirs);
+	for (uint8_t i = 0; i < count; ++i)
+	{
+		if (Region(neighbors[i]) == region)
+			return true;
+	}
+	return false;
+}
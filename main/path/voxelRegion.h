@@ -0,0 +1,83 @@
+#pragma once
+
+#include <vector>
+#include "voxel.h"
+
+// 连通区域: 给每个可走的 (x, y, layer) 标记区域号, 寻路前O(1)判断两点是否可能连通
+// 附近关系不一定双向(高低差使一侧能走过去另一侧走不回来), 区域按无向图划分,
+// 所以IsReachable返回false时一定不可达, 返回true时仍可能找不到路径
+// 掩码或地形修改后调用Update, 只重新标记修改区域, 区域被切断或连通时拆分/合并区域号
+class VoxelRegion
+{
+public:
+	static const uint32_t NoRegion = 0xFFFFFFFF;
+
+private:
+	// 每个layer一项, 下标与分块的neighborLayerArr一致, 分块追加layer时只需扩展
+	struct Cell
+	{
+		uint32_t region;
+		// Update拆分区域时的访问标记
+		uint32_t mark;
+		uint32_t owner;
+	};
+
+	// 拆分区域时从一个边界格子出发的搜索
+	struct Search
+	{
+		std::vector<VoxelPos> cells;
+		uint32_t head;
+		uint32_t group;
+	};
+
+	const TerrainInstance& m_terr;
+	uint8_t m_radius;
+
+	std::vector<std::vector<Cell>> m_cells;
+	// 区域号并查集, 合并区域时只修改父节点
+	std::vector<uint32_t> m_parent;
+	uint32_t m_mark = 0;
+
+	std::vector<VoxelPos> m_queue;
+	std::vector<Search> m_searches;
+	std::vector<uint32_t> m_groups;
+	std::vector<uint32_t> m_groupLive;
+
+	Cell& GetCell(const VoxelPos& pos);
+	const Cell& GetCell(const VoxelPos& pos) const;
+
+	uint32_t NewRegion();
+	uint32_t Find(uint32_t region);
+	uint32_t FindGroup(uint32_t group);
+
+	// 没有被掩码占住的格子才是区域图的节点
+	bool IsNode(const VoxelPos& pos) const;
+
+	// 与pos在无向图中相邻的节点: pos能走到的, 以及能走到pos的
+	template<typename Fn>
+	void ForEachLink(const VoxelPos& pos, Fn fn) const;
+
+	// 从seed标记未标记的节点, bounds不为空时只标记区域内的格子, 碰到区域外已标记的格子时合并
+	void Fill(const VoxelPos& seed, uint32_t region, const GridRect* bounds);
+
+	// 去掉dirty后检查区域root是否断开, 从seeds同时搜索, 搜索完而没有与其它搜索相遇的部分分配新区域号
+	void Split(uint32_t root, const std::vector<VoxelPos>& seeds, const GridRect& dirty);
+
+public:
+	// radius为占用半径, 规则与VoxelAStar一致
+	explicit VoxelRegion(const TerrainInstance& terr, uint8_t radius = 0);
+
+	// 全部重新标记
+	void Build();
+
+	// rect内掩码或地形修改后调用, 地形修改时传入TerrainData::SetVoxels/RebuildNeighbor返回的区域
+	void Update(const GridRect& rect);
+
+	// pos所在的区域号, 不可走或被掩码占住返回NoRegion
+	uint32_t Region(const VoxelPos& pos) const;
+
+	// 返回false时from一定走不到to; from被掩码占住时按它能走到的邻居判断
+	bool IsReachable(const VoxelPos& from, const VoxelPos& to) const;
+
+	uint8_t Radius() const { return m_radius; }
+};
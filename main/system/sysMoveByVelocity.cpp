@@ -1,15 +1,99 @@
-
 #include "pch.h"
 #include "sysMoveByVelocity.h"
 #include "compVoxelProxy.h"
 #include "compScene.h"
+#include <limits.h>
+
+// 每个实体每tick打印位置, 调试时定义为1
+#ifndef VOXEL_MOVE_LOG
+#define VOXEL_MOVE_LOG 0
+#endif
+
+// x += vx * dt, y += vy * dt
+static void Integrate(float* x, float* y, const float* vx, const float* vy, uint32_t count, float dt)
+{
+	uint32_t i = 0;
+#ifdef VOXEL_AVX2
+	const __m256 t = _mm256_set1_ps(dt);
+	for (; i + 8 <= count; i += 8)
+	{
+		_mm256_storeu_ps(x + i, _mm256_add_ps(_mm256_loadu_ps(x + i), _mm256_mul_ps(_mm256_loadu_ps(vx + i), t)));
+		_mm256_storeu_ps(y + i, _mm256_add_ps(_mm256_loadu_ps(y + i), _mm256_mul_ps(_mm256_loadu_ps(vy + i), t)));
+	}
+#endif
+	for (; i < count; ++i)
+	{
+		x[i] += vx[i] * dt;
+		y[i] += vy[i] * dt;
+	}
+}
 
-void SysMoveByVelocity::Update(float dt, entt::registry &registry)
+// 坐标转格子, 与VoxelProxy::MoveTo一样用除法和向下取整, 超出int32范围的截断
+static void ToGrid(const float* v, uint32_t count, float size, int32_t* grid)
 {
-	registry.view<CompScene, CompVexelProxy>().each([dt](auto &scene, auto &vxl) {
-		Location pos = scene.m_loc + scene.m_velocity * dt;
-		bool res = vxl.m_pxy->MoveTo(pos);
-		scene.m_loc = vxl.m_pxy->GetLocation();
-		std::cout << scene.m_loc.x << scene.m_loc.y << scene.m_loc.z << std::endl;
+	const float limit = 2.0e9f;
+	uint32_t i = 0;
+#ifdef VOXEL_AVX2
+	const __m256 s = _mm256_set1_ps(size);
+	const __m256 hi = _mm256_set1_ps(limit);
+	const __m256 lo = _mm256_set1_ps(-limit);
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256 q = _mm256_floor_ps(_mm256_div_ps(_mm256_loadu_ps(v + i), s));
+		q = _mm256_max_ps(_mm256_min_ps(q, hi), lo);
+		_mm256_storeu_si256((__m256i*)(grid + i), _mm256_cvttps_epi32(q));
+	}
+#endif
+	for (; i < count; ++i)
+	{
+		float q = std::floor(v[i] / size);
+		grid[i] = int32_t(std::max(std::min(q, limit), -limit));
+	}
+}
+
+void SysMoveByVelocity::Update(float dt, entt::registry &registry, ThreadPool &pool, Scratch &soa)
+{
+	VOXEL_PROFILE_SCOPE("SysMoveByVelocity::Update");
+	auto view = registry.view<CompScene, CompVexelProxy>();
+	soa.entities.clear();
+	for (auto entity : view)
+		soa.entities.push_back(entity);
+	uint32_t count = (uint32_t)soa.entities.size();
+	soa.Resize(count);
+
+	// 每段实体独立: 读入SoA, 积分, 转格子, 再逐个移动
+	pool.ParallelFor(count, ChunkSize, [&soa, &view, dt](uint32_t begin, uint32_t end) {
+		VOXEL_PROFILE_SCOPE("SysMoveByVelocity::Chunk");
+		for (uint32_t i = begin; i < end; ++i)
+		{
+			const auto& scene = view.get<CompScene>(soa.entities[i]);
+			soa.x[i] = scene.m_loc.x;
+			soa.y[i] = scene.m_loc.y;
+			soa.vx[i] = scene.m_velocity.x;
+			soa.vy[i] = scene.m_velocity.y;
+		}
+		uint32_t n = end - begin;
+		Integrate(soa.x.data() + begin, soa.y.data() + begin, soa.vx.data() + begin, soa.vy.data() + begin, n, dt);
+
+		float size = view.get<CompVexelProxy>(soa.entities[begin]).m_pxy->GetTerrain()->GetData().GridSize();
+		ToGrid(soa.x.data() + begin, n, size, soa.gridX.data() + begin);
+		ToGrid(soa.y.data() + begin, n, size, soa.gridY.data() + begin);
+
+		// 没有离开格子的直接更新位置, 跨格子的逐格检查
+		for (uint32_t i = begin; i < end; ++i)
+		{
+			auto& scene = view.get<CompScene>(soa.entities[i]);
+			auto& pxy = *view.get<CompVexelProxy>(soa.entities[i]).m_pxy;
+			Location loc(soa.x[i], soa.y[i], scene.m_loc.z);
+			// 格子大小不同的地形单独计算
+			if (pxy.GetTerrain()->GetData().GridSize() == size)
+				scene.m_blocked = !pxy.MoveTo(loc, soa.gridX[i], soa.gridY[i]);
+			else
+				scene.m_blocked = !pxy.MoveTo(loc);
+			scene.m_loc = pxy.GetLocation();
+#if VOXEL_MOVE_LOG
+			std::cout << scene.m_loc.x << scene.m_loc.y << scene.m_loc.z << std::endl;
+#endif
+		}
 	});
 }
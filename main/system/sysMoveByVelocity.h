@@ -1,12 +1,37 @@
 #pragma once
 
 #include "single_include/entt/entt.hpp"
+#include <vector>
+
+class ThreadPool;
 
 class SysMoveByVelocity
 {
 public:
-	static void Update(float dt, entt::registry &registry);
-};
+	// 实体按ChunkSize个一段分给线程池
+	static const uint32_t ChunkSize = 1024;
 
+	// 位置和速度按分量分开存放, 便于向量化; 由调用方持有, 每tick复用避免重新分配
+	struct Scratch
+	{
+		std::vector<entt::entity> entities;
+		std::vector<float> x;
+		std::vector<float> y;
+		std::vector<float> vx;
+		std::vector<float> vy;
+		std::vector<int32_t> gridX;
+		std::vector<int32_t> gridY;
 
+		void Resize(uint32_t count)
+		{
+			x.resize(count);
+			y.resize(count);
+			vx.resize(count);
+			vy.resize(count);
+			gridX.resize(count);
+			gridY.resize(count);
+		}
+	};
 
+	static void Update(float dt, entt::registry &registry, ThreadPool &pool, Scratch &soa);
+};
@@ -0,0 +1,106 @@
+#include "pch.h"
+#include "sysScheduler.h"
+#include <algorithm>
+#include <chrono>
+
+std::atomic<uint32_t> SysScheduler::s_typeCount(0);
+
+SysScheduler::SysScheduler(ThreadPool& pool, float step, uint32_t maxSteps)
+	: m_pool(pool), m_done(0), m_step(step), m_maxSteps(std::max(1u, maxSteps))
+{
+}
+
+bool SysScheduler::Conflict(const Access& a, const Access& b)
+{
+	auto contains = [](const std::vector<uint32_t>& v, uint32_t id) {
+		return std::find(v.begin(), v.end(), id) != v.end();
+	};
+	for (uint32_t id : a.m_writes)
+	{
+		if (contains(b.m_reads, id) || contains(b.m_writes, id))
+			return true;
+	}
+	for (uint32_t id : b.m_writes)
+	{
+		if (contains(a.m_reads, id))
+			return true;
+	}
+	return false;
+}
+
+void SysScheduler::Add(const char* name, const Access& access, Func fn)
+{
+	uint32_t index = (uint32_t)m_systems.size();
+	System sys{ name, access, std::move(fn), {}, 0, 0. };
+	for (uint32_t i = 0; i < index; ++i)
+	{
+		if (!Conflict(m_systems[i].access, access))
+			continue;
+		m_systems[i].next.push_back(index);
+		++sys.depCount;
+	}
+	m_systems.push_back(std::move(sys));
+	m_remaining.reset(new std::atomic<uint32_t>[m_systems.size()]);
+}
+
+void SysScheduler::RunSystem(uint32_t index, float dt)
+{
+	auto& sys = m_systems[index];
+	if (m_profile)
+	{
+		auto start = std::chrono::steady_clock::now();
+		sys.fn(dt);
+		sys.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+	else
+		sys.fn(dt);
+	for (uint32_t next : sys.next)
+	{
+		if (--m_remaining[next] == 0)
+			m_pool.Post([this, next, dt] { RunSystem(next, dt); });
+	}
+	++m_done;
+}
+
+void SysScheduler::Run(float dt)
+{
+	uint32_t count = (uint32_t)m_systems.size();
+	m_done = 0;
+	for (uint32_t i = 0; i < count; ++i)
+		m_remaining[i] = m_systems[i].depCount;
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		if (m_systems[i].depCount == 0)
+			m_pool.Post([this, i, dt] { RunSystem(i, dt); });
+	}
+	while (m_done < count)
+	{
+		if (!m_pool.RunOne())
+			std::this_thread::yield();
+	}
+	++m_tickCount;
+	// 所有系统完成后合并各线程的统计
+	VOXEL_PROFILE_TICK();
+}
+
+void SysScheduler::ResetProfile()
+{
+	for (auto& sys : m_systems)
+		sys.seconds = 0.;
+}
+
+uint32_t SysScheduler::Advance(float elapsed)
+{
+	m_accum += elapsed;
+	uint32_t steps = 0;
+	while (m_accum >= m_step && steps < m_maxSteps)
+	{
+		Run(m_step);
+		m_accum -= m_step;
+		++steps;
+	}
+	// 补帧也追不上时丢掉积压的时间, 避免越来越慢
+	if (m_accum >= m_step)
+		m_accum = 0.f;
+	return steps;
+}
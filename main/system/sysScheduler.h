@@ -0,0 +1,108 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <functional>
+#include "utils/threadPool.h"
+#include "utils/profiler.h"
+
+// 系统调度: 每个系统声明读写的组件(或服务等资源), 按添加顺序建立依赖,
+// 互不冲突的系统在线程池上并行执行; 外部按固定步长推进, 落后时补帧
+class SysScheduler
+{
+public:
+	typedef std::function<void(float)> Func;
+
+	// 系统读写的类型, 类型只用于区分, 不需要是组件
+	class Access
+	{
+		friend class SysScheduler;
+		std::vector<uint32_t> m_reads;
+		std::vector<uint32_t> m_writes;
+
+	public:
+		template<typename... T>
+		Access& Read()
+		{
+			(m_reads.push_back(TypeId<T>()), ...);
+			return *this;
+		}
+
+		template<typename... T>
+		Access& Write()
+		{
+			(m_writes.push_back(TypeId<T>()), ...);
+			return *this;
+		}
+	};
+
+private:
+	struct System
+	{
+		std::string name;
+		Access access;
+		Func fn;
+		// 依赖本系统的后续系统
+		std::vector<uint32_t> next;
+		uint32_t depCount;
+		// 打开统计后累计的执行时间
+		double seconds;
+	};
+
+	ThreadPool& m_pool;
+	std::vector<System> m_systems;
+	// 本次执行中每个系统还未完成的依赖数
+	std::unique_ptr<std::atomic<uint32_t>[]> m_remaining;
+	std::atomic<uint32_t> m_done;
+
+	float m_step;
+	uint32_t m_maxSteps;
+	float m_accum = 0.f;
+	uint64_t m_tickCount = 0;
+	bool m_profile = false;
+
+	static std::atomic<uint32_t> s_typeCount;
+
+	template<typename T>
+	static uint32_t TypeId()
+	{
+		static const uint32_t id = s_typeCount++;
+		return id;
+	}
+
+	// 一方写另一方读或写的类型时冲突
+	static bool Conflict(const Access& a, const Access& b);
+
+	void RunSystem(uint32_t index, float dt);
+
+public:
+	// step为固定步长, 一次Advance最多执行maxSteps步
+	explicit SysScheduler(ThreadPool& pool, float step = 1.f / 60.f, uint32_t maxSteps = 4);
+	SysScheduler(const SysScheduler&) = delete;
+	SysScheduler& operator=(const SysScheduler&) = delete;
+
+	// 与之前添加的系统冲突时排在它们之后
+	void Add(const char* name, const Access& access, Func fn);
+
+	// 执行一帧, 阻塞直到所有系统完成, 等待时调用线程也执行任务
+	void Run(float dt);
+
+	// 累加真实经过的时间并按固定步长执行, 落后超过maxSteps步时丢弃多余的时间, 返回执行的步数
+	uint32_t Advance(float elapsed);
+
+	// 距离下一步还需要的时间
+	float Remaining() const { return m_step > m_accum ? m_step - m_accum : 0.f; }
+	float Step() const { return m_step; }
+	uint64_t TickCount() const { return m_tickCount; }
+	uint32_t SystemCount() const { return (uint32_t)m_systems.size(); }
+	ThreadPool& GetPool() const { return m_pool; }
+
+	// 打开后累计每个系统的执行时间, 并行执行的系统各自计时, 总和可能超过帧时间
+	void SetProfile(bool enable) { m_profile = enable; }
+	void ResetProfile();
+	const std::string& SystemName(uint32_t index) const { return m_systems[index].name; }
+	double SystemSeconds(uint32_t index) const { return m_systems[index].seconds; }
+};
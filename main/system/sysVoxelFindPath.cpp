@@ -1,10 +1,131 @@
 
 #include "pch.h"
-#include "SysVoxelFindPath.h"
+#include "sysVoxelFindPath.h"
 #include "compVoxelProxy.h"
 #include "compScene.h"
+#include "compDest.h"
+#include "compPath.h"
+#include "path/pathService.h"
+#include "path/pathSmooth.h"
+#include <cmath>
 
-void SysVoxelFindPath::Update(std::uint64_t dt, entt::registry &registry)
+// 提交寻路请求, 目标不在地图内返回0
+static uint32_t RequestPath(PathService& service, entt::entity entity, const VoxelProxy& pxy, const Location& dest, uint8_t priority)
 {
+	const auto& data = pxy.GetTerrain()->GetData();
+	if (dest.x < 0.f || dest.y < 0.f)
+		return 0;
+	uint32_t x = uint32_t(dest.x / data.GridSize());
+	uint32_t y = uint32_t(dest.y / data.GridSize());
+	if (!data.IsValidGrid(x, y))
+		return 0;
+	VoxelPos start{ pxy.GetGridX(), pxy.GetGridY(), pxy.GetLayer() };
+	VoxelPos goal{ x, y, data.GetLayer(data.GetVoxels(x, y), dest.z) };
+	return service.Submit(entity, start, goal, pxy.GetRadius(), priority);
+}
+
+// 格子序列转为路点: 平滑后跳过起点格子, 中间路点取格子中心, 终点取目标位置
+// 路径在寻路后被掩码挡住等原因走不通时路点无效, 下一tick从当前位置重新寻路
+static void ApplyPath(const VoxelProxy& pxy, const std::vector<VoxelPos>& cells, CompPath& path)
+{
+	const auto& terr = *pxy.GetTerrain();
+	path.m_index = 0;
+	path.m_points.clear();
+	if (!cells.empty())
+	{
+		// 等待结果时没有移动, 仍在起点格子时从当前位置出发
+		const auto& data = terr.GetData();
+		const auto& start = cells.front();
+		Location from = pxy.GetLocation();
+		if (pxy.GetGridX() != start.x || pxy.GetGridY() != start.y || pxy.GetLayer() != start.layer)
+			from = Location((start.x + 0.5f) * data.GridSize(), (start.y + 0.5f) * data.GridSize(), data.GetHight(data.GetVoxels(start.x, start.y), start.layer));
+		if (!PathSmooth::Smooth(terr, cells.data(), uint32_t(cells.size()), from, path.m_dest, pxy.GetRadius(), PathSmooth::Mode::Funnel, path.m_points))
+		{
+			path.m_valid = false;
+			return;
+		}
+	}
+	path.m_valid = true;
+}
+
+void SysVoxelFindPath::Update(float dt, entt::registry &registry, PathService &service)
+{
+	VOXEL_PROFILE_SCOPE("SysVoxelFindPath::Update");
+	// 同步点: 只接受实体当前等待的请求
+	service.Sync([&registry](PathService::Result& res) {
+		if (!registry.valid(res.entity) || !registry.has<CompScene, CompDest, CompVexelProxy, CompPath>(res.entity))
+			return;
+		auto& path = registry.get<CompPath>(res.entity);
+		if (path.m_request != res.id)
+			return;
+		path.m_request = 0;
+		if (res.result == VoxelAStar::Result::Found)
+		{
+			ApplyPath(*registry.get<CompVexelProxy>(res.entity).m_pxy, res.cells, path);
+			return;
+		}
+		registry.get<CompDest>(res.entity).m_arrived = true;
+		registry.get<CompScene>(res.entity).m_velocity.Zero();
+	});
+
+	registry.view<CompScene, CompDest, CompVexelProxy, CompPath>().each([dt, &service](auto entity, auto &scene, auto &dest, auto &vxl, auto &path) {
+		if (dest.m_arrived)
+			return;
+		// 沿路点移动时被挡住(如路上新增了掩码), 从当前格子重新寻路
+		if (scene.m_blocked && path.m_valid && path.m_request == 0)
+		{
+			path.m_valid = false;
+			scene.m_blocked = false;
+		}
+		// 目标变化时取消旧请求
+		if (path.m_dest != dest.m_loc || (!path.m_valid && path.m_request == 0))
+		{
+			if (path.m_request != 0)
+				service.Cancel(path.m_request);
+			path.m_dest = dest.m_loc;
+			path.m_points.clear();
+			path.m_index = 0;
+			path.m_valid = false;
+			path.m_request = RequestPath(service, entity, *vxl.m_pxy, dest.m_loc, path.m_priority);
+			if (path.m_request == 0)
+			{
+				dest.m_arrived = true;
+				scene.m_velocity.Zero();
+				return;
+			}
+		}
+		// 等待结果
+		if (path.m_request != 0)
+		{
+			scene.m_velocity.Zero();
+			return;
+		}
+
+		// 沿路点移动, 到达最后一个路点后停止
+		float step = path.m_speed * dt;
+		while (path.m_index < path.m_points.size())
+		{
+			const auto& target = path.m_points[path.m_index];
+			float dx = target.x - scene.m_loc.x;
+			float dy = target.y - scene.m_loc.y;
+			float dist = std::sqrt(dx * dx + dy * dy);
+			if (dist > step)
+			{
+				scene.m_velocity = Vector3(dx / dist * path.m_speed, dy / dist * path.m_speed, 0.f);
+				return;
+			}
+			if (path.m_index + 1 == path.m_points.size())
+			{
+				scene.m_velocity = Vector3(dx / dt, dy / dt, 0.f);
+				++path.m_index;
+				return;
+			}
+			++path.m_index;
+		}
+		dest.m_arrived = true;
+		path.m_valid = false;
+		scene.m_velocity.Zero();
+	});
 
+	service.Dispatch();
 }
@@ -2,10 +2,13 @@
 
 #include "single_include/entt/entt.hpp"
 
+class PathService;
+
 class SysVoxelFindPath
 {
 public:
-	static void Update(std::uint64_t dt, entt::registry &registry);
+	// 取回上一批寻路结果, 为目标变化的实体提交请求, 沿路点移动, 最后派发本tick的请求
+	static void Update(float dt, entt::registry &registry, PathService &service);
 };
 
 
@@ -0,0 +1,55 @@
+#include "pch.h"
+#include "sysVoxelFlowMove.h"
+#include "compVoxelProxy.h"
+#include "compScene.h"
+#include "compDest.h"
+#include "compFlow.h"
+#include "path/flowField.h"
+#include <cmath>
+
+void SysVoxelFlowMove::Update(float dt, entt::registry &registry, FlowFieldCache &cache)
+{
+	VOXEL_PROFILE_SCOPE("SysVoxelFlowMove::Update");
+	registry.view<CompScene, CompDest, CompVexelProxy, CompFlow>().each([dt, &cache](auto &scene, auto &dest, auto &vxl, auto &flow) {
+		if (dest.m_arrived)
+			return;
+		const auto& pxy = *vxl.m_pxy;
+		const auto& terr = *pxy.GetTerrain();
+		const auto& data = terr.GetData();
+		if (dest.m_loc.x < 0.f || dest.m_loc.y < 0.f || !data.IsValidGrid(uint32_t(dest.m_loc.x / data.GridSize()), uint32_t(dest.m_loc.y / data.GridSize())))
+		{
+			dest.m_arrived = true;
+			scene.m_velocity.Zero();
+			return;
+		}
+		uint32_t x = uint32_t(dest.m_loc.x / data.GridSize());
+		uint32_t y = uint32_t(dest.m_loc.y / data.GridSize());
+		VoxelPos goal{ x, y, data.GetLayer(data.GetVoxels(x, y), dest.m_loc.z) };
+		auto field = cache.Get(terr, goal, pxy.GetRadius());
+
+		// 下一格取格子中心, 到达目标格子后走向目标位置
+		VoxelPos cur{ pxy.GetGridX(), pxy.GetGridY(), pxy.GetLayer() };
+		VoxelPos next;
+		Location target = dest.m_loc;
+		uint8_t dir = field->GetDir(cur);
+		if (dir == FlowField::NoDir || (dir != FlowField::GoalDir && !field->Next(terr, cur, next)))
+		{
+			dest.m_arrived = true;
+			scene.m_velocity.Zero();
+			return;
+		}
+		if (dir != FlowField::GoalDir)
+			target = Location((next.x + 0.5f) * data.GridSize(), (next.y + 0.5f) * data.GridSize(), data.GetHight(data.GetVoxels(next.x, next.y), next.layer));
+
+		float dx = target.x - scene.m_loc.x;
+		float dy = target.y - scene.m_loc.y;
+		float dist = std::sqrt(dx * dx + dy * dy);
+		if (dir == FlowField::GoalDir && dist <= flow.m_speed * dt)
+		{
+			scene.m_velocity = Vector3(dx / dt, dy / dt, 0.f);
+			dest.m_arrived = true;
+			return;
+		}
+		scene.m_velocity = Vector3(dx / dist * flow.m_speed, dy / dist * flow.m_speed, 0.f);
+	});
+}
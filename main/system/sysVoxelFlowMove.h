@@ -0,0 +1,12 @@
+#pragma once
+
+#include "single_include/entt/entt.hpp"
+
+class FlowFieldCache;
+
+class SysVoxelFlowMove
+{
+public:
+	// 同一目标的实体共用流场, 每tick只查当前格子的方向
+	static void Update(float dt, entt::registry &registry, FlowFieldCache &cache);
+};
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdint.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+class Bits
+{
+public:
+	// 最低位1的位置, v不能为0
+	static uint32_t CountTrailingZero(uint32_t v)
+	{
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanForward(&index, v);
+		return index;
+#else
+		return __builtin_ctz(v);
+#endif
+	}
+
+	// 最低位1的位置, v不能为0
+	static uint32_t CountTrailingZero64(uint64_t v)
+	{
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanForward64(&index, v);
+		return index;
+#else
+		return __builtin_ctzll(v);
+#endif
+	}
+};
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <vector>
+#include <assert.h>
+
+// 可直接引用外部只读内存(如文件映射)的数组, 接口与std::vector一致
+// 引用外部内存时只读, 任何写操作前先复制到自有内存(写时复制)
+template<typename T>
+class CowArray
+{
+	std::vector<T> m_vec;
+	const T* m_ext = nullptr;
+	size_t m_extSize = 0;
+
+public:
+	// 引用外部内存, 外部内存生命周期由调用者保证
+	void Attach(const T* data, size_t size)
+	{
+		m_vec.clear();
+		m_vec.shrink_to_fit();
+		m_ext = data;
+		m_extSize = size;
+	}
+
+	// 复制外部内存到自有内存
+	void Detach()
+	{
+		if (!m_ext)
+			return;
+		m_vec.assign(m_ext, m_ext + m_extSize);
+		m_ext = nullptr;
+		m_extSize = 0;
+	}
+
+	bool IsAttached() const { return m_ext != nullptr; }
+
+	size_t size() const { return m_ext ? m_extSize : m_vec.size(); }
+	// 自有内存的容量, 引用外部内存时为0
+	size_t capacity() const { return m_vec.capacity(); }
+	bool empty() const { return size() == 0; }
+	const T* data() const { return m_ext ? m_ext : m_vec.data(); }
+	T* data() { Detach(); return m_vec.data(); }
+
+	const T& operator[](size_t i) const { assert(i < size()); return data()[i]; }
+	T& operator[](size_t i) { Detach(); return m_vec[i]; }
+
+	const T* begin() const { return data(); }
+	const T* end() const { return data() + size(); }
+	T* begin() { return data(); }
+	T* end() { return data() + size(); }
+
+	void clear() { m_ext = nullptr; m_extSize = 0; m_vec.clear(); }
+	void reserve(size_t n) { Detach(); m_vec.reserve(n); }
+	void shrink_to_fit() { m_vec.shrink_to_fit(); }
+	void resize(size_t n) { Detach(); m_vec.resize(n); }
+	void resize(size_t n, const T& v) { Detach(); m_vec.resize(n, v); }
+	void push_back(const T& v) { Detach(); m_vec.push_back(v); }
+	void assign(const T* first, const T* last) { m_ext = nullptr; m_extSize = 0; m_vec.assign(first, last); }
+};
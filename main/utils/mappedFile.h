@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stddef.h>
+
+// 只读文件映射, 多个进程映射同一文件时共享物理页
+class MappedFile
+{
+	const char* m_data = nullptr;
+	size_t m_size = 0;
+#ifdef _WIN32
+	void* m_file = nullptr;
+	void* m_mapping = nullptr;
+#else
+	int m_fd = -1;
+#endif
+
+public:
+	MappedFile() {}
+	~MappedFile() { Close(); }
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// 映射整个文件, 失败返回false
+	bool Open(const char* path);
+	void Close();
+
+	bool IsOpen() const { return m_data != nullptr; }
+	const char* Data() const { return m_data; }
+	size_t Size() const { return m_size; }
+};
@@ -0,0 +1,296 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include "bits.h"
+
+// 与voxel.h中VOXEL_AVX2的条件相同, 这里在voxel.h的定义之前被包含
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// 按16x16分块保存的占用计数, 没有占用的分块不分配, 视为共享的全0分块
+// 分块在副本之间共享, 写入时只复制被修改的分块(写时复制), 复制整个对象只复制分块指针
+// 每个分块一位的摘要记录哪些分块已分配, 区域查询先按摘要跳过空分块, 代价只与区域内有占用的分块数有关
+class MaskTiles
+{
+public:
+	static const uint32_t TileShift = 4;
+	static const uint32_t TileSize = 1 << TileShift;
+	static const uint32_t TileMask = TileSize - 1;
+	static const uint32_t TileCells = TileSize * TileSize;
+
+private:
+	struct Tile
+	{
+		// 有该layer的格子的占用计数
+		uint8_t mask[TileCells];
+		// 占用区域覆盖的计数, 包括没有该layer的格子, 用于区域查询
+		uint16_t cover[TileCells];
+		// 计数大于0的格子, 每行16位, 每个字4行, 整个分块256位按32字节对齐, 区域查询一次与运算
+		alignas(32) uint64_t maskBits[TileCells / 64];
+		alignas(32) uint64_t coverBits[TileCells / 64];
+		// mask或cover不为0的格子数量, 为0时释放分块
+		uint32_t used;
+	};
+
+	uint32_t m_length = 0;
+	uint32_t m_width = 0;
+	uint32_t m_tileLength = 0;
+	// 第一次写入时按地图分配
+	std::vector<std::shared_ptr<Tile>> m_tiles;
+	uint32_t m_tileCount = 0;
+	// 已分配的分块, 按分块序号每个一位
+	std::vector<uint64_t> m_tileBits;
+
+	static uint32_t CellIndex(uint32_t x, uint32_t y) { return ((y & TileMask) << TileShift) | (x & TileMask); }
+
+	const Tile* GetTile(uint32_t x, uint32_t y) const
+	{
+		return m_tiles.empty() ? nullptr : m_tiles[(y >> TileShift) * m_tileLength + (x >> TileShift)].get();
+	}
+
+	uint32_t TileNum() const { return m_tileLength * ((m_width + TileMask) >> TileShift); }
+
+	void AllocTiles()
+	{
+		if (m_tiles.empty())
+		{
+			m_tiles.resize(TileNum());
+			m_tileBits.resize((TileNum() + 63) >> 6);
+		}
+	}
+
+	// 从序号first起count个分块的摘要位, count不超过64
+	uint64_t TileBits(uint32_t first, uint32_t count) const
+	{
+		uint32_t shift = first & 63;
+		uint64_t bits = m_tileBits[first >> 6] >> shift;
+		if (shift + count > 64)
+			bits |= m_tileBits[(first >> 6) + 1] << (64 - shift);
+		return count < 64 ? bits & ((uint64_t(1) << count) - 1) : bits;
+	}
+
+	// 可写入的分块, 没有时分配全0分块, 与其他副本共享时复制
+	Tile& WritableTile(uint32_t index)
+	{
+		auto& tile = m_tiles[index];
+		if (!tile)
+		{
+			tile = std::make_shared<Tile>();
+			std::fill(std::begin(tile->mask), std::end(tile->mask), uint8_t(0));
+			std::fill(std::begin(tile->cover), std::end(tile->cover), uint16_t(0));
+			std::fill(std::begin(tile->maskBits), std::end(tile->maskBits), uint64_t(0));
+			std::fill(std::begin(tile->coverBits), std::end(tile->coverBits), uint64_t(0));
+			tile->used = 0;
+			++m_tileCount;
+			m_tileBits[index >> 6] |= uint64_t(1) << (index & 63);
+		}
+		else if (tile.use_count() > 1)
+			tile = std::make_shared<Tile>(*tile);
+		return *tile;
+	}
+
+	static void SetBit(uint64_t* bits, uint32_t cell, bool value)
+	{
+		uint64_t bit = uint64_t(1) << (cell & 63);
+		bits[cell >> 6] = value ? bits[cell >> 6] | bit : bits[cell >> 6] & ~bit;
+	}
+
+	// 修改一个格子的计数并维护位图和非0格子数
+	static void SetCell(Tile& tile, uint32_t cell, uint8_t mask, uint16_t cover)
+	{
+		bool used = tile.mask[cell] != 0 || tile.cover[cell] != 0;
+		tile.mask[cell] = mask;
+		tile.cover[cell] = cover;
+		tile.used += uint32_t(mask != 0 || cover != 0) - uint32_t(used);
+		SetBit(tile.maskBits, cell, mask != 0);
+		SetBit(tile.coverBits, cell, cover != 0);
+	}
+
+	// 全部格子回到0后释放分块
+	void ReleaseIfEmpty(uint32_t index)
+	{
+		if (m_tiles[index] && m_tiles[index]->used == 0)
+		{
+			m_tiles[index].reset();
+			--m_tileCount;
+			m_tileBits[index >> 6] &= ~(uint64_t(1) << (index & 63));
+		}
+	}
+
+	// [lo, hi)位为1的字, 区间超出[0, 64)的部分忽略
+	static uint64_t RangeBits(int32_t lo, int32_t hi)
+	{
+		lo = std::max(lo, 0);
+		hi = std::min(hi, 64);
+		if (lo >= hi)
+			return 0;
+		return (hi == 64 ? ~uint64_t(0) : (uint64_t(1) << hi) - 1) & ~((uint64_t(1) << lo) - 1);
+	}
+
+	// 256位的分块与区域掩码是否有交集
+	static bool TestRect(const uint64_t* words, const uint64_t* rect)
+	{
+#if defined(__AVX2__)
+		__m256i v = _mm256_load_si256(reinterpret_cast<const __m256i*>(words));
+		__m256i m = _mm256_load_si256(reinterpret_cast<const __m256i*>(rect));
+		return !_mm256_testz_si256(v, m);
+#else
+		return ((words[0] & rect[0]) | (words[1] & rect[1]) | (words[2] & rect[2]) | (words[3] & rect[3])) != 0;
+#endif
+	}
+
+	// 闭区间内是否有置位的格子, 每个分块与区域的256位掩码比较
+	template<typename GetBits>
+	bool AnyBits(uint32_t minX, uint32_t minY, uint32_t maxX, uint32_t maxY, GetBits bits) const
+	{
+		if (m_tileCount == 0)
+			return false;
+		const uint32_t tx0 = minX >> TileShift;
+		const uint32_t tx1 = maxX >> TileShift;
+		for (uint32_t ty = minY >> TileShift; ty <= maxY >> TileShift; ++ty)
+		{
+			int32_t y0 = int32_t(std::max(minY, ty << TileShift) & TileMask);
+			int32_t y1 = int32_t(std::min(maxY, (ty << TileShift) | TileMask) & TileMask);
+			for (uint32_t first = tx0; first <= tx1; first += 64)
+			{
+				// 只遍历摘要中已分配的分块
+				uint64_t tiles = TileBits(ty * m_tileLength + first, std::min(tx1 - first + 1, 64u));
+				for (; tiles; tiles &= tiles - 1)
+				{
+					uint32_t tx = first + Bits::CountTrailingZero64(tiles);
+					const Tile* tile = m_tiles[ty * m_tileLength + tx].get();
+					uint32_t x0 = std::max(minX, tx << TileShift) & TileMask;
+					uint32_t x1 = std::min(maxX, (tx << TileShift) | TileMask) & TileMask;
+					// 一行的列掩码复制到一个字的4行, 再按行范围截取
+					uint64_t row = ((uint64_t(2) << x1) - 1) & ~((uint64_t(1) << x0) - 1);
+					uint64_t rows = row * 0x0001000100010001ull;
+					alignas(32) uint64_t rect[TileCells / 64];
+					for (int32_t w = 0; w < int32_t(TileCells / 64); ++w)
+						rect[w] = rows & RangeBits(y0 * int32_t(TileSize) - w * 64, (y1 + 1) * int32_t(TileSize) - w * 64);
+					if (TestRect(bits(*tile), rect))
+						return true;
+				}
+			}
+		}
+		return false;
+	}
+
+public:
+	MaskTiles() = default;
+	MaskTiles(uint32_t length, uint32_t width)
+		: m_length(length), m_width(width), m_tileLength((length + TileMask) >> TileShift)
+	{
+	}
+
+	bool IsEmpty() const { return m_tileCount == 0; }
+	// 已分配的分块数量, 包括与其他副本共享的分块
+	uint32_t TileCount() const { return m_tileCount; }
+	size_t MemoryBytes() const { return m_tiles.capacity() * sizeof(std::shared_ptr<Tile>) + m_tileBits.capacity() * sizeof(uint64_t) + size_t(m_tileCount) * sizeof(Tile); }
+
+	bool Test(uint32_t x, uint32_t y) const
+	{
+		const Tile* tile = GetTile(x, y);
+		uint32_t cell = CellIndex(x, y);
+		return tile && ((tile->maskBits[cell >> 6] >> (cell & 63)) & 1);
+	}
+
+	// 闭区间内是否有计数大于0的格子, 调用者保证区间有效
+	bool Any(uint32_t minX, uint32_t minY, uint32_t maxX, uint32_t maxY) const
+	{
+		return AnyBits(minX, minY, maxX, maxY, [](const Tile& tile) { return tile.maskBits; });
+	}
+
+	// 闭区间是否与任何占用区域重叠, 包括没有该layer的格子
+	bool AnyCover(uint32_t minX, uint32_t minY, uint32_t maxX, uint32_t maxY) const
+	{
+		return AnyBits(minX, minY, maxX, maxY, [](const Tile& tile) { return tile.coverBits; });
+	}
+
+	// 闭区间内每个格子的覆盖计数加value, hasCell(x, y)为true的格子占用计数也加value
+	// 计数减少时不低于0, Clear过的格子之后再减少不会回绕
+	template<typename Fn>
+	void Add(uint32_t minX, uint32_t minY, uint32_t maxX, uint32_t maxY, int32_t value, Fn hasCell)
+	{
+		AllocTiles();
+		for (uint32_t ty = minY >> TileShift; ty <= maxY >> TileShift; ++ty)
+			for (uint32_t tx = minX >> TileShift; tx <= maxX >> TileShift; ++tx)
+			{
+				uint32_t index = ty * m_tileLength + tx;
+				Tile& tile = WritableTile(index);
+				uint32_t x1 = std::min(maxX, (tx << TileShift) | TileMask);
+				uint32_t y1 = std::min(maxY, (ty << TileShift) | TileMask);
+				for (uint32_t y = std::max(minY, ty << TileShift); y <= y1; ++y)
+					for (uint32_t x = std::max(minX, tx << TileShift); x <= x1; ++x)
+					{
+						uint32_t cell = CellIndex(x, y);
+						int32_t mask = hasCell(x, y) ? tile.mask[cell] + value : tile.mask[cell];
+						int32_t cover = tile.cover[cell] + value;
+						SetCell(tile, cell, uint8_t(std::max(mask, 0)), uint16_t(std::max(cover, 0)));
+					}
+				// 占用全部移除后回到全0分块
+				ReleaseIfEmpty(index);
+			}
+	}
+
+	// 闭区间内的格子计数清零
+	void Clear(uint32_t minX, uint32_t minY, uint32_t maxX, uint32_t maxY)
+	{
+		if (m_tiles.empty())
+			return;
+		for (uint32_t ty = minY >> TileShift; ty <= maxY >> TileShift; ++ty)
+			for (uint32_t tx = minX >> TileShift; tx <= maxX >> TileShift; ++tx)
+			{
+				uint32_t index = ty * m_tileLength + tx;
+				if (!m_tiles[index])
+					continue;
+				Tile& tile = WritableTile(index);
+				uint32_t x1 = std::min(maxX, (tx << TileShift) | TileMask);
+				uint32_t y1 = std::min(maxY, (ty << TileShift) | TileMask);
+				for (uint32_t y = std::max(minY, ty << TileShift); y <= y1; ++y)
+					for (uint32_t x = std::max(minX, tx << TileShift); x <= x1; ++x)
+						SetCell(tile, CellIndex(x, y), 0, 0);
+				ReleaseIfEmpty(index);
+			}
+	}
+
+	// 格子键为 分块序号*TileCells+块内序号, 同一分块的格子连续, 用于增量同步
+	uint32_t KeyCount() const { return TileNum() * TileCells; }
+
+	// 与base中计数不同的格子按键从小到大回调fn(key, mask, cover), 与base共享的分块直接跳过
+	// base需来自同样大小的地图
+	template<typename Fn>
+	void Diff(const MaskTiles& base, Fn fn) const
+	{
+		if (m_tiles.empty() && base.m_tiles.empty())
+			return;
+		for (uint32_t index = 0; index < TileNum(); ++index)
+		{
+			const Tile* cur = m_tiles.empty() ? nullptr : m_tiles[index].get();
+			const Tile* old = base.m_tiles.empty() ? nullptr : base.m_tiles[index].get();
+			if (cur == old)
+				continue;
+			for (uint32_t cell = 0; cell < TileCells; ++cell)
+			{
+				uint8_t mask = cur ? cur->mask[cell] : 0;
+				uint16_t cover = cur ? cur->cover[cell] : 0;
+				if (mask != (old ? old->mask[cell] : 0) || cover != (old ? old->cover[cell] : 0))
+					fn(index * TileCells + cell, mask, cover);
+			}
+		}
+	}
+
+	// 直接设置键对应格子的计数, 调用者保证key < KeyCount()
+	void Set(uint32_t key, uint8_t mask, uint16_t cover)
+	{
+		uint32_t index = key / TileCells;
+		if ((m_tiles.empty() || !m_tiles[index]) && mask == 0 && cover == 0)
+			return;
+		AllocTiles();
+		SetCell(WritableTile(index), key % TileCells, mask, cover);
+		ReleaseIfEmpty(index);
+	}
+};
@@ -0,0 +1,140 @@
+#include "pch.h"
+#include "profiler.h"
+#include <chrono>
+#include <algorithm>
+
+Profiler& Profiler::Instance()
+{
+	static Profiler profiler;
+	return profiler;
+}
+
+uint64_t Profiler::Now()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+const char* Profiler::CounterName(Counter counter)
+{
+	static const char* names[CounterCount] = {
+		"MoveToOk", "MoveToBlocked",
+		"MoveStepSame", "MoveStepAbove", "MoveStepLow", "MoveStepUnknow",
+		"MoveBlockSame", "MoveBlockAbove", "MoveBlockLow", "MoveBlockUnknow",
+		"IsMask", "GetLayerCompare", "PathExpanded", "HpaExpanded",
+	};
+	return counter < CounterCount ? names[counter] : "Unknown";
+}
+
+Profiler::ThreadBuffer* Profiler::Acquire()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	// 复用已退出线程的缓冲, 未合并的数据保留到下次Tick
+	for (auto& buffer : m_buffers)
+	{
+		bool expected = false;
+		if (buffer->active.compare_exchange_strong(expected, true, std::memory_order_acquire))
+			return buffer.get();
+	}
+	std::unique_ptr<ThreadBuffer> buffer(new ThreadBuffer);
+	for (auto& c : buffer->counters)
+		c.store(0, std::memory_order_relaxed);
+	std::fill(std::begin(buffer->merged), std::end(buffer->merged), uint64_t(0));
+	buffer->write.store(0, std::memory_order_relaxed);
+	buffer->read.store(0, std::memory_order_relaxed);
+	buffer->dropped.store(0, std::memory_order_relaxed);
+	buffer->active.store(true, std::memory_order_relaxed);
+	buffer->tid = (uint32_t)m_buffers.size() + 1;
+	m_buffers.push_back(std::move(buffer));
+	return m_buffers.back().get();
+}
+
+void Profiler::Tick()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	std::fill(std::begin(m_last), std::end(m_last), uint64_t(0));
+	uint64_t dropped = 0;
+	for (auto& buffer : m_buffers)
+	{
+		for (uint32_t c = 0; c < CounterCount; ++c)
+		{
+			uint64_t v = buffer->counters[c].load(std::memory_order_relaxed);
+			m_last[c] += v - buffer->merged[c];
+			buffer->merged[c] = v;
+		}
+		uint64_t read = buffer->read.load(std::memory_order_relaxed);
+		uint64_t write = buffer->write.load(std::memory_order_acquire);
+		if (m_tracing)
+		{
+			for (uint64_t i = read; i < write && m_events.size() < m_maxEvents; ++i)
+				m_events.push_back(buffer->events[i % RingSize]);
+		}
+		buffer->read.store(write, std::memory_order_release);
+		dropped += buffer->dropped.load(std::memory_order_relaxed);
+	}
+	for (uint32_t c = 0; c < CounterCount; ++c)
+		m_total[c] += m_last[c];
+	m_dropped = dropped;
+	++m_tickCount;
+	if (m_tracing)
+	{
+		TickSample sample;
+		sample.time = Now();
+		std::copy(std::begin(m_last), std::end(m_last), std::begin(sample.counters));
+		m_samples.push_back(sample);
+	}
+}
+
+void Profiler::Reset()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	std::fill(std::begin(m_last), std::end(m_last), uint64_t(0));
+	std::fill(std::begin(m_total), std::end(m_total), uint64_t(0));
+	m_tickCount = 0;
+	m_events.clear();
+	m_samples.clear();
+}
+
+void Profiler::StartTrace(size_t maxEvents)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_tracing = true;
+	m_maxEvents = maxEvents;
+	m_events.clear();
+	m_samples.clear();
+}
+
+void Profiler::WriteChromeTrace(std::ostream& os) const
+{
+	// 时间以第一个事件为起点, 单位us
+	uint64_t origin = UINT64_MAX;
+	for (const auto& e : m_events)
+		origin = std::min(origin, e.start);
+	for (const auto& s : m_samples)
+		origin = std::min(origin, s.time);
+	if (origin == UINT64_MAX)
+		origin = 0;
+
+	os << std::fixed;
+	os.precision(3);
+	os << "{\"traceEvents\":[";
+	bool first = true;
+	auto sep = [&]() {
+		os << (first ? "\n" : ",\n");
+		first = false;
+	};
+	for (const auto& e : m_events)
+	{
+		sep();
+		os << "{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << e.tid
+			<< ",\"ts\":" << (e.start - origin) / 1000. << ",\"dur\":" << e.duration / 1000. << '}';
+	}
+	for (const auto& s : m_samples)
+	{
+		sep();
+		os << "{\"name\":\"counters\",\"ph\":\"C\",\"pid\":1,\"ts\":" << (s.time - origin) / 1000. << ",\"args\":{";
+		for (uint32_t c = 0; c < CounterCount; ++c)
+			os << (c == 0 ? "" : ",") << '"' << CounterName(Counter(c)) << "\":" << s.counters[c];
+		os << "}}";
+	}
+	os << "\n],\"displayTimeUnit\":\"ms\"}\n";
+}
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <ostream>
+
+// 性能统计开关, 为0时下面的宏展开为空, 热点路径上没有任何代码; 编译选项中定义为1打开
+#ifndef VOXEL_PROFILE
+#define VOXEL_PROFILE 0
+#endif
+
+// 热点路径的计时和计数: 每个线程写自己的计数和事件环形缓冲, 不加锁
+// 每tick调用一次Tick合并所有线程的数据, 可导出为Chrome trace(chrome://tracing, Perfetto)
+class Profiler
+{
+public:
+	enum Counter : uint8_t
+	{
+		// MoveTo的结果, 顺序固定, 按是否被挡住偏移
+		MoveToOk,
+		MoveToBlocked,
+		// 逐格移动成功的步数, 按LayerRelation区分, 顺序与LayerRelation一致
+		MoveStepSame,
+		MoveStepAbove,
+		MoveStepLow,
+		MoveStepUnknow,
+		// 被挡住的格子的LayerRelation, Unknow为地形不通, 其余为layer不存在或有掩码
+		MoveBlockSame,
+		MoveBlockAbove,
+		MoveBlockLow,
+		MoveBlockUnknow,
+		IsMask,
+		// GetLayer在整数域比较的span数
+		GetLayerCompare,
+		// VoxelAStar扩展的节点数
+		PathExpanded,
+		// VoxelHpa抽象图扩展的节点数
+		HpaExpanded,
+		CounterCount,
+	};
+
+	// 一段计时, 时间为ns
+	struct Event
+	{
+		const char* name;
+		uint64_t start;
+		uint64_t duration;
+		uint32_t tid;
+	};
+
+	// 每个线程缓冲的事件数, 写满时丢弃新事件
+	static const uint32_t RingSize = 4096;
+
+private:
+	struct ThreadBuffer
+	{
+		// 只由所属线程写入, Tick时读取
+		std::atomic<uint64_t> counters[CounterCount];
+		Event events[RingSize];
+		std::atomic<uint64_t> write;
+		std::atomic<uint64_t> read;
+		std::atomic<uint64_t> dropped;
+		// 所属线程退出后为false, 新线程可以复用
+		std::atomic<bool> active;
+		uint32_t tid;
+		// 上次Tick时的计数, 只在Tick中访问
+		uint64_t merged[CounterCount];
+	};
+
+	// 线程退出时释放缓冲
+	struct ThreadSlot
+	{
+		ThreadBuffer* buffer = nullptr;
+		~ThreadSlot()
+		{
+			if (buffer)
+				buffer->active.store(false, std::memory_order_release);
+		}
+	};
+
+	std::mutex m_mutex;
+	std::vector<std::unique_ptr<ThreadBuffer>> m_buffers;
+
+	uint64_t m_last[CounterCount] = {};
+	uint64_t m_total[CounterCount] = {};
+	uint64_t m_dropped = 0;
+	uint64_t m_tickCount = 0;
+
+	// 记录trace时保存的事件和每tick的计数
+	struct TickSample
+	{
+		uint64_t time;
+		uint64_t counters[CounterCount];
+	};
+	bool m_tracing = false;
+	size_t m_maxEvents = 0;
+	std::vector<Event> m_events;
+	std::vector<TickSample> m_samples;
+
+	Profiler() = default;
+	ThreadBuffer* Acquire();
+
+	static ThreadBuffer& Local()
+	{
+		thread_local ThreadSlot slot;
+		if (!slot.buffer)
+			slot.buffer = Instance().Acquire();
+		return *slot.buffer;
+	}
+
+public:
+	Profiler(const Profiler&) = delete;
+	Profiler& operator=(const Profiler&) = delete;
+
+	static Profiler& Instance();
+	// 单调时钟, ns
+	static uint64_t Now();
+	static const char* CounterName(Counter counter);
+
+	static void Count(Counter counter, uint64_t n = 1)
+	{
+		auto& c = Local().counters[counter];
+		c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+	}
+
+	// 记录一段计时, 缓冲满时丢弃
+	static void Record(const char* name, uint64_t start, uint64_t end)
+	{
+		auto& buffer = Local();
+		uint64_t write = buffer.write.load(std::memory_order_relaxed);
+		if (write - buffer.read.load(std::memory_order_acquire) >= RingSize)
+		{
+			buffer.dropped.store(buffer.dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			return;
+		}
+		buffer.events[write % RingSize] = Event{ name, start, end - start, buffer.tid };
+		buffer.write.store(write + 1, std::memory_order_release);
+	}
+
+	// 作用域计时, name需在Tick合并前保持有效, 一般为字符串常量
+	class Scope
+	{
+		const char* m_name;
+		uint64_t m_start;
+
+	public:
+		explicit Scope(const char* name) : m_name(name), m_start(Now()) {}
+		~Scope() { Record(m_name, m_start, Now()); }
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+	};
+
+	// 合并所有线程的计数和事件, 每tick调用一次
+	void Tick();
+	// 清空累计的计数和trace, 不影响线程缓冲
+	void Reset();
+
+	// 最近一次Tick合并的计数增量
+	uint64_t Last(Counter counter) const { return m_last[counter]; }
+	// Reset以来的累计
+	uint64_t Total(Counter counter) const { return m_total[counter]; }
+	uint64_t TickCount() const { return m_tickCount; }
+	// 因缓冲写满丢弃的事件数
+	uint64_t Dropped() const { return m_dropped; }
+
+	// 开始保存Tick合并的事件和计数, 最多maxEvents个事件
+	void StartTrace(size_t maxEvents = 1 << 22);
+	void StopTrace() { m_tracing = false; }
+	// 导出Chrome trace-event格式, 计时为完整事件(ph X), 每tick的计数为计数事件(ph C)
+	void WriteChromeTrace(std::ostream& os) const;
+};
+
+#if VOXEL_PROFILE
+#define VOXEL_PROFILE_JOIN2(a, b) a##b
+#define VOXEL_PROFILE_JOIN(a, b) VOXEL_PROFILE_JOIN2(a, b)
+#define VOXEL_PROFILE_SCOPE(name) Profiler::Scope VOXEL_PROFILE_JOIN(profileScope, __LINE__)(name)
+#define VOXEL_COUNT(counter, n) Profiler::Count(Profiler::counter, n)
+#define VOXEL_COUNT_AT(counter, offset, n) Profiler::Count(Profiler::Counter(Profiler::counter + (offset)), n)
+#define VOXEL_PROFILE_TICK() Profiler::Instance().Tick()
+#else
+#define VOXEL_PROFILE_SCOPE(name)
+#define VOXEL_COUNT(counter, n)
+#define VOXEL_COUNT_AT(counter, offset, n)
+#define VOXEL_PROFILE_TICK()
+#endif
@@ -0,0 +1,205 @@
+#include "pch.h"
+#include "spatialIndex.h"
+#include <algorithm>
+#include <cmath>
+
+SpatialIndex::SpatialIndex(uint32_t length, uint32_t width, float gridSize)
+	: m_length(length), m_width(width), m_gridSize(gridSize), m_locks(new std::mutex[LockCount])
+{
+	m_cells.resize(size_t(length) * width);
+}
+
+uint32_t SpatialIndex::ClampGrid(float v, uint32_t count) const
+{
+	float g = std::floor(v / m_gridSize);
+	if (!(g > 0.f))
+		return 0;
+	return g >= float(count - 1) ? count - 1 : uint32_t(g);
+}
+
+void SpatialIndex::Insert(uint32_t cell, const Entry& entry)
+{
+	auto& bucket = m_cells[cell];
+	auto& item = m_items[entry.handle];
+	item.cell = cell;
+	item.slot = (uint32_t)bucket.size();
+	bucket.push_back(entry);
+}
+
+void SpatialIndex::Erase(uint32_t cell, uint32_t slot)
+{
+	auto& bucket = m_cells[cell];
+	if (slot + 1 < bucket.size())
+	{
+		bucket[slot] = bucket.back();
+		m_items[bucket[slot].handle].slot = slot;
+	}
+	bucket.pop_back();
+}
+
+uint32_t SpatialIndex::Add(uint64_t id, const Location& loc, uint32_t gridX, uint32_t gridY, uint8_t layer)
+{
+	uint32_t handle = m_freeHead;
+	if (handle != Invalid)
+		m_freeHead = m_items[handle].slot;
+	else
+	{
+		handle = (uint32_t)m_items.size();
+		m_items.push_back(Item{ Invalid, Invalid });
+	}
+	++m_size;
+	Insert(CellIndex(gridX, gridY), Entry{ loc.x, loc.y, id, handle, layer });
+	return handle;
+}
+
+void SpatialIndex::Move(uint32_t handle, const Location& loc, uint32_t gridX, uint32_t gridY, uint8_t layer)
+{
+	auto& item = m_items[handle];
+	uint32_t from = item.cell;
+	uint32_t to = CellIndex(gridX, gridY);
+	uint32_t lockFrom = from % LockCount;
+	uint32_t lockTo = to % LockCount;
+
+	// 同一格子内只改位置
+	if (from == to)
+	{
+		std::lock_guard<std::mutex> lock(m_locks[lockFrom]);
+		auto& entry = m_cells[from][item.slot];
+		entry.x = loc.x;
+		entry.y = loc.y;
+		entry.layer = layer;
+		return;
+	}
+
+	// 按序号加锁, 避免两个实体反向移动时死锁
+	std::unique_lock<std::mutex> first(m_locks[std::min(lockFrom, lockTo)]);
+	std::unique_lock<std::mutex> second;
+	if (lockFrom != lockTo)
+		second = std::unique_lock<std::mutex>(m_locks[std::max(lockFrom, lockTo)]);
+	Entry entry = m_cells[from][item.slot];
+	entry.x = loc.x;
+	entry.y = loc.y;
+	entry.layer = layer;
+	Erase(from, item.slot);
+	Insert(to, entry);
+}
+
+void SpatialIndex::Remove(uint32_t handle)
+{
+	auto& item = m_items[handle];
+	Erase(item.cell, item.slot);
+	item.cell = Invalid;
+	item.slot = m_freeHead;
+	m_freeHead = handle;
+	--m_size;
+}
+
+template<typename Fn>
+void SpatialIndex::ForEachCell(const Location& min, const Location& max, Fn fn) const
+{
+	if (m_cells.empty() || max.x < min.x || max.y < min.y)
+		return;
+	uint32_t minX = ClampGrid(min.x, m_length);
+	uint32_t minY = ClampGrid(min.y, m_width);
+	uint32_t maxX = ClampGrid(max.x, m_length);
+	uint32_t maxY = ClampGrid(max.y, m_width);
+	for (uint32_t y = minY; y <= maxY; ++y)
+		for (uint32_t x = minX; x <= maxX; ++x)
+			fn(m_cells[CellIndex(x, y)]);
+}
+
+uint32_t SpatialIndex::QueryBox(const Location& min, const Location& max, uint8_t layer, std::vector<uint64_t>& out) const
+{
+	size_t count = out.size();
+	ForEachCell(min, max, [&](const std::vector<Entry>& bucket) {
+		for (const auto& entry : bucket)
+		{
+			if ((layer == AnyLayer || entry.layer == layer) && entry.x >= min.x && entry.x <= max.x && entry.y >= min.y && entry.y <= max.y)
+				out.push_back(entry.id);
+		}
+	});
+	return uint32_t(out.size() - count);
+}
+
+uint32_t SpatialIndex::QueryRadius(const Location& center, float radius, uint8_t layer, std::vector<uint64_t>& out) const
+{
+	size_t count = out.size();
+	float r2 = radius * radius;
+	Location min(center.x - radius, center.y - radius, 0.f);
+	Location max(center.x + radius, center.y + radius, 0.f);
+	ForEachCell(min, max, [&](const std::vector<Entry>& bucket) {
+		for (const auto& entry : bucket)
+		{
+			float dx = entry.x - center.x;
+			float dy = entry.y - center.y;
+			if ((layer == AnyLayer || entry.layer == layer) && dx * dx + dy * dy <= r2)
+				out.push_back(entry.id);
+		}
+	});
+	return uint32_t(out.size() - count);
+}
+
+uint32_t SpatialIndex::QueryNearest(const Location& center, uint32_t k, uint8_t layer, std::vector<uint64_t>& out, float maxRadius) const
+{
+	if (k == 0 || m_cells.empty())
+		return 0;
+	// 距离最大的在堆顶
+	std::vector<std::pair<float, uint64_t>> heap;
+	heap.reserve(k);
+	float limit = maxRadius < FLT_MAX ? maxRadius * maxRadius : FLT_MAX;
+	auto visit = [&](uint32_t x, uint32_t y) {
+		for (const auto& entry : m_cells[CellIndex(x, y)])
+		{
+			if (layer != AnyLayer && entry.layer != layer)
+				continue;
+			float dx = entry.x - center.x;
+			float dy = entry.y - center.y;
+			float d2 = dx * dx + dy * dy;
+			if (d2 > limit)
+				continue;
+			if (heap.size() < k)
+			{
+				heap.emplace_back(d2, entry.id);
+				std::push_heap(heap.begin(), heap.end());
+			}
+			else if (d2 < heap.front().first)
+			{
+				std::pop_heap(heap.begin(), heap.end());
+				heap.back() = std::make_pair(d2, entry.id);
+				std::push_heap(heap.begin(), heap.end());
+			}
+		}
+	};
+
+	// 从中心格子一圈圈向外, 第r+1圈离中心至少r格
+	int64_t cx = ClampGrid(center.x, m_length);
+	int64_t cy = ClampGrid(center.y, m_width);
+	int64_t maxRing = std::max(std::max(cx, int64_t(m_length) - 1 - cx), std::max(cy, int64_t(m_width) - 1 - cy));
+	for (int64_t r = 0; r <= maxRing; ++r)
+	{
+		if (r > 0)
+		{
+			float near = (r - 1) * m_gridSize;
+			float near2 = near * near;
+			if (near2 > limit || (heap.size() == k && near2 >= heap.front().first))
+				break;
+		}
+		for (int64_t y = cy - r; y <= cy + r; ++y)
+		{
+			if (y < 0 || y >= int64_t(m_width))
+				continue;
+			// 第一行和最后一行整行, 中间只有两端
+			int64_t step = (y == cy - r || y == cy + r) ? 1 : std::max<int64_t>(1, 2 * r);
+			for (int64_t x = cx - r; x <= cx + r; x += step)
+			{
+				if (x >= 0 && x < int64_t(m_length))
+					visit(uint32_t(x), uint32_t(y));
+			}
+		}
+	}
+
+	std::sort_heap(heap.begin(), heap.end());
+	for (const auto& item : heap)
+		out.push_back(item.second);
+	return (uint32_t)heap.size();
+}
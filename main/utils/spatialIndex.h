@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <mutex>
+#include <memory>
+#include <cfloat>
+#include "typedef.h"
+
+// 按地形格子分桶的实体索引, 每个格子一个连续数组存放位置和id, 不为单个实体分配节点
+// Move可以多线程调用(不同实体), Add/Remove和查询需在没有Move的阶段调用
+class SpatialIndex
+{
+public:
+	static const uint32_t Invalid = 0xFFFFFFFF;
+	// 查询时不过滤layer
+	static const uint8_t AnyLayer = 0xFF;
+
+private:
+	struct Entry
+	{
+		float x;
+		float y;
+		uint64_t id;
+		uint32_t handle;
+		uint8_t layer;
+	};
+
+	struct Item
+	{
+		uint32_t cell;
+		// 在格子数组中的位置, 空闲时为下一个空闲句柄
+		uint32_t slot;
+	};
+
+	static const uint32_t LockCount = 256;
+
+	uint32_t m_length;
+	uint32_t m_width;
+	float m_gridSize;
+
+	std::vector<std::vector<Entry>> m_cells;
+	std::vector<Item> m_items;
+	uint32_t m_freeHead = Invalid;
+	uint32_t m_size = 0;
+	// 按格子分组的锁, 多线程Move时使用
+	std::unique_ptr<std::mutex[]> m_locks;
+
+	uint32_t CellIndex(uint32_t x, uint32_t y) const { return y * m_length + x; }
+	// 坐标所在格子, 超出地图时取边上的格子
+	uint32_t ClampGrid(float v, uint32_t count) const;
+
+	void Insert(uint32_t cell, const Entry& entry);
+	// 从格子中删除slot处的元素, 用最后一个元素填补
+	void Erase(uint32_t cell, uint32_t slot);
+
+	template<typename Fn>
+	void ForEachCell(const Location& min, const Location& max, Fn fn) const;
+
+public:
+	SpatialIndex(uint32_t length, uint32_t width, float gridSize);
+	SpatialIndex(const SpatialIndex&) = delete;
+	SpatialIndex& operator=(const SpatialIndex&) = delete;
+
+	// 返回句柄, 用于Move和Remove
+	uint32_t Add(uint64_t id, const Location& loc, uint32_t gridX, uint32_t gridY, uint8_t layer);
+	void Move(uint32_t handle, const Location& loc, uint32_t gridX, uint32_t gridY, uint8_t layer);
+	void Remove(uint32_t handle);
+
+	uint32_t Size() const { return m_size; }
+
+	// 查询结果追加到out, 返回追加的数量; layer为AnyLayer时不过滤
+	uint32_t QueryBox(const Location& min, const Location& max, uint8_t layer, std::vector<uint64_t>& out) const;
+	uint32_t QueryRadius(const Location& center, float radius, uint8_t layer, std::vector<uint64_t>& out) const;
+	// 最近的k个, 按距离从近到远追加, 只考虑maxRadius以内的
+	uint32_t QueryNearest(const Location& center, uint32_t k, uint8_t layer, std::vector<uint64_t>& out, float maxRadius = FLT_MAX) const;
+};
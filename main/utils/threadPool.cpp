@@ -0,0 +1,150 @@
+#include "pch.h"
+#include "threadPool.h"
+#include <algorithm>
+
+// 当前线程所属的线程池及序号
+static thread_local const ThreadPool* t_pool = nullptr;
+static thread_local uint32_t t_index = 0;
+
+ThreadPool::ThreadPool(uint32_t threadNum)
+	: m_pending(0), m_next(0)
+{
+	if (threadNum == 0)
+		threadNum = std::max(1u, std::thread::hardware_concurrency());
+	m_threadNum = threadNum;
+	m_workers.reserve(threadNum);
+	for (uint32_t i = 0; i < threadNum; ++i)
+		m_workers.emplace_back(new Worker());
+	m_threads.reserve(threadNum);
+	for (uint32_t i = 0; i < threadNum; ++i)
+		m_threads.emplace_back(&ThreadPool::WorkerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_cond.notify_all();
+	for (auto& t : m_threads)
+		t.join();
+}
+
+uint32_t ThreadPool::CurrentIndex() const
+{
+	return t_pool == this ? t_index : ThreadNum();
+}
+
+bool ThreadPool::Pop(uint32_t index, std::function<void()>& task)
+{
+	uint32_t num = ThreadNum();
+	if (index < num)
+	{
+		auto& worker = *m_workers[index];
+		std::lock_guard<std::mutex> lock(worker.mutex);
+		if (!worker.tasks.empty())
+		{
+			task = std::move(worker.tasks.front());
+			worker.tasks.pop_front();
+			--m_pending;
+			return true;
+		}
+	}
+	for (uint32_t i = 1; i <= num; ++i)
+	{
+		auto& victim = *m_workers[(index + i) % num];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (victim.tasks.empty())
+			continue;
+		task = std::move(victim.tasks.back());
+		victim.tasks.pop_back();
+		--m_pending;
+		return true;
+	}
+	return false;
+}
+
+void ThreadPool::WorkerLoop(uint32_t index)
+{
+	t_pool = this;
+	t_index = index;
+	for (;;)
+	{
+		std::function<void()> task;
+		if (Pop(index, task))
+		{
+			task();
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_cond.wait(lock, [this] { return m_stop || m_pending > 0; });
+		if (m_stop && m_pending == 0)
+			return;
+	}
+}
+
+void ThreadPool::Post(std::function<void()> task)
+{
+	uint32_t index = CurrentIndex();
+	if (index >= ThreadNum())
+		index = m_next++ % ThreadNum();
+	{
+		auto& worker = *m_workers[index];
+		std::lock_guard<std::mutex> lock(worker.mutex);
+		worker.tasks.push_back(std::move(task));
+		++m_pending;
+	}
+	// 加锁保证等待中的线程不会错过通知
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+	}
+	m_cond.notify_one();
+}
+
+bool ThreadPool::RunOne()
+{
+	std::function<void()> task;
+	if (!Pop(CurrentIndex(), task))
+		return false;
+	task();
+	return true;
+}
+
+void ThreadPool::ParallelFor(uint32_t count, const std::function<void(uint32_t)>& fn)
+{
+	ParallelFor(count, 1, [&fn](uint32_t begin, uint32_t end) {
+		for (uint32_t i = begin; i < end; ++i)
+			fn(i);
+	});
+}
+
+void ThreadPool::ParallelFor(uint32_t count, uint32_t grain, const std::function<void(uint32_t, uint32_t)>& fn)
+{
+	if (count == 0)
+		return;
+	grain = std::max(1u, grain);
+	uint32_t chunks = (count + grain - 1) / grain;
+
+	std::atomic<uint32_t> next(0);
+	std::atomic<uint32_t> running(0);
+
+	auto run = [&]() {
+		for (uint32_t i = next++; i < chunks; i = next++)
+			fn(i * grain, std::min(count, (i + 1) * grain));
+		--running;
+	};
+
+	uint32_t helpers = std::min(ThreadNum(), chunks - 1);
+	running = helpers + 1;
+	for (uint32_t i = 0; i < helpers; ++i)
+		Post(run);
+	run();
+
+	// 等待时执行其它任务, 工作线程里嵌套调用也不会全部阻塞
+	while (running > 0)
+	{
+		if (!RunOne())
+			std::this_thread::yield();
+	}
+}
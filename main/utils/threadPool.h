@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+
+// 固定数量的工作线程池, 每个线程有自己的任务队列, 自己的队列空了从其它线程的队列尾部偷任务
+class ThreadPool
+{
+	struct Worker
+	{
+		std::deque<std::function<void()>> tasks;
+		std::mutex mutex;
+	};
+
+	std::vector<std::thread> m_threads;
+	std::vector<std::unique_ptr<Worker>> m_workers;
+	// 线程启动前确定, 工作线程不读m_threads
+	uint32_t m_threadNum;
+	// 所有队列中的任务数, 线程在m_mutex上等待它不为0
+	std::atomic<uint32_t> m_pending;
+	// 外部线程投递时轮流选择队列
+	std::atomic<uint32_t> m_next;
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+	bool m_stop = false;
+
+	void WorkerLoop(uint32_t index);
+	// 先取index自己的队列头部, 再从其它队列尾部偷
+	bool Pop(uint32_t index, std::function<void()>& task);
+	// 当前线程是本线程池的工作线程时返回它的序号, 否则返回线程数
+	uint32_t CurrentIndex() const;
+
+public:
+	// threadNum为0时使用硬件线程数
+	explicit ThreadPool(uint32_t threadNum = 0);
+	~ThreadPool();
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	uint32_t ThreadNum() const { return m_threadNum; }
+
+	// 投递任务, 不等待; 工作线程投递的任务放入自己的队列
+	void Post(std::function<void()> task);
+
+	// 取一个任务在当前线程执行, 没有任务返回false; 等待其它任务时调用, 避免工作线程互相等待
+	bool RunOne();
+
+	// 把 [0, count) 分给工作线程和调用线程执行, 阻塞直到全部完成
+	void ParallelFor(uint32_t count, const std::function<void(uint32_t)>& fn);
+
+	// 按grain个一段把 [0, count) 分段执行, fn参数为 [begin, end)
+	void ParallelFor(uint32_t count, uint32_t grain, const std::function<void(uint32_t, uint32_t)>& fn);
+};
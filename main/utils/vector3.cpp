@@ -10,29 +10,29 @@
 
 using namespace std;
 
-//ĬϹ캯,ʼһ
+//默认构造函数,初始一个零向量
 Vector3::Vector3() {
 	x = 0;
 	y = 0;
 	z = 0;
 }
-//ƹ캯
+//复制构造函数
 Vector3::Vector3(const Vector3 &a) {
 	x = a.x;
 	y = a.y;
 	z = a.z;
 }
-//Ĺ캯ֵɳʼ
+//带参数的构造函数，用三个值完成初始化
 Vector3::Vector3(float nx, float ny, float nz) {
 	x = nx;
 	y = ny;
 	z = nz;
 }
-//
+//析构函数
 Vector3::~Vector3() {};
 
-//׼
-//ظֵãʵֵ
+//标准对象操作
+//重载赋值运算符，并返回引用，以实现左值。
 Vector3& Vector3::operator=(const Vector3 &a) {
 	x = a.x;
 	y = a.y;
@@ -40,27 +40,27 @@ Vector3& Vector3::operator=(const Vector3 &a) {
 	return *this;
 }
 
-//"=="
+//重载"=="操作符
 bool Vector3::operator==(const Vector3 &a) const {
 	return x == a.x && y == a.y && z == a.z;
 }
 
-//"!="
+//重载"!="操作符
 bool Vector3::operator!=(const Vector3 &a) const {
 	return x != a.x || y != a.y || z != a.z;
 }
 
-//Ϊ
+//置为零向量
 void Vector3::Zero() {
 	x = y = z = 0.0f;
 }
-//һԪ"-"
+//重载一元"-"运算符
 Vector3 Vector3::operator-()const
 {
 	return Vector3(-x, -y, -z);
 }
 
-//ضԪ"+""-"
+//重载二元"+"和"-"运算符
 Vector3 Vector3::operator+(const Vector3 &a) const {
 
 	return Vector3(x + a.x, y + a.y, z + a.z);
@@ -69,17 +69,17 @@ Vector3 Vector3::operator-(const Vector3 &a) const {
 	return Vector3(x - a.x, y - a.y, z - a.z);
 }
 
-//ĳˡ
+//标量的乘、除法
 Vector3 Vector3::operator*(float a) const {
 	return Vector3(x*a, y*a, z*a);
 
 }
 Vector3 Vector3::operator/(float a) const {
-	float oneOverA = 1.0f / a;//עﲻ""д
+	float oneOverA = 1.0f / a;//注意这里不对"除零"进行处理
 	return Vector3(x*oneOverA, y*oneOverA, z*oneOverA);
 }
 
-//Է
+//重载自反运算符
 Vector3& Vector3::operator +=(const Vector3 &a) {
 
 	x += a.x;
@@ -108,10 +108,10 @@ Vector3& Vector3::operator /=(float a) {
 	return *this;
 }
 
-//׼
+//向量标准化
 void Vector3::Normalize() {
 	float magSq = x * x + y * y + z * z;
-	if (magSq > 0.0f) {//
+	if (magSq > 0.0f) {//检查除零
 		float oneOverMag = 1.0f / sqrt(magSq);
 		x *= oneOverMag;
 		y *= oneOverMag;
@@ -119,7 +119,7 @@ void Vector3::Normalize() {
 	}
 }
 
-//ˣر׼ĳ˷
+//向量点乘，重载标准的乘法运算符
 float Vector3::operator *(const Vector3 &a) const {
 	return x * a.x + y * a.y + z * a.z;
 }
@@ -127,19 +127,19 @@ void Vector3::PrintVector3() {
 	std::cout << "(" << x << "," << y << "," << z << ")" << std::endl;
 
 }
-//ģ
+//求向量模
 float Vector3::VectorMag(const Vector3 &a) {
 	return sqrt(a.x * a.x + a.y * a.y + a.z * a.z);
 }
 
 /*
-Cross Product˹ʽ
+Cross Product叉乘公式
 aXb = | i   j   k  |
 	  | a.x a.y a.z|
 	  | b.x b.y b.z| = (a.y*b.z -a.z*b.y)i + (a.z*b.x - a.x*b.z)j + (a.x+b.y - a.y*b.x)k
 */
 
-//Ĳ
+//计算两向量的叉乘
 Vector3 Vector3::CrossProduct(const Vector3 &a, const Vector3 &b) {
 	return Vector3(
 		a.y * b.z - a.z * b.y,
@@ -148,7 +148,7 @@ Vector3 Vector3::CrossProduct(const Vector3 &a, const Vector3 &b) {
 	);
 }
 
-//ľ
+//计算两点间的距离
 float Vector3::Distance(const Vector3 &a, const Vector3 &b) {
 
 	float dx = a.x - b.x;
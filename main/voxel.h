@@ -2,14 +2,38 @@
 
 #include <iostream>
 #include <vector>
+#include <algorithm>
 #include <assert.h>
 #include "typedef.h"
 #include <functional>
+#include <memory>
+#include <stdint.h>
+#include <cmath>
+#include <cfloat>
+#include <unordered_map>
+#include "utils/cowArray.h"
+#include "utils/mappedFile.h"
+#include "utils/threadPool.h"
+#include "utils/bits.h"
+#include "utils/maskTiles.h"
+#include "utils/spatialIndex.h"
+#include "utils/profiler.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VOXEL_SSE2
+#include <emmintrin.h>
+#endif
+
+// 需要编译选项打开(/arch:AVX2, -mavx2)
+#if defined(__AVX2__)
+#define VOXEL_AVX2
+#include <immintrin.h>
+#endif
 
 //namespace vpx
 
 
-// 
+// 方向编号
 enum class Direction : uint8_t
 {
 	Front = 0,
@@ -22,7 +46,7 @@ enum class Direction : uint8_t
 	LF = 7,
 };
 
-// 8
+// 8方向掩码
 enum class DirectionMask : uint16_t
 {
 	DirectionMaskFront = 0x0003,
@@ -35,7 +59,7 @@ enum class DirectionMask : uint16_t
 	DirectionMaskLF = 0xC000,
 };
 
-// layerھӹϵ
+// layer邻居关系
 enum class LayerRelation : uint8_t
 {
 	Same = 0x00,
@@ -44,80 +68,324 @@ enum class LayerRelation : uint8_t
 	Unknow = 0x03
 };
 
+// 格子矩形区域, 包含边界
+struct GridRect
+{
+	uint32_t minX;
+	uint32_t minY;
+	uint32_t maxX;
+	uint32_t maxY;
+
+	static GridRect Empty() { return GridRect{ 1, 1, 0, 0 }; }
+	bool IsEmpty() const { return minX > maxX || minY > maxY; }
+	bool Contains(uint32_t x, uint32_t y) const { return x >= minX && x <= maxX && y >= minY && y <= maxY; }
+	bool Intersects(const GridRect& o) const { return !IsEmpty() && !o.IsEmpty() && minX <= o.maxX && o.minX <= maxX && minY <= o.maxY && o.minY <= maxY; }
+
+	// 合并另一个区域
+	void Merge(const GridRect& other)
+	{
+		if (other.IsEmpty())
+			return;
+		if (IsEmpty())
+		{
+			*this = other;
+			return;
+		}
+		minX = std::min(minX, other.minX);
+		minY = std::min(minY, other.minY);
+		maxX = std::max(maxX, other.maxX);
+		maxY = std::max(maxY, other.maxY);
+	}
+
+	// 向外扩展n格, 限制在 length*width 地图内
+	GridRect Expand(uint32_t n, uint32_t length, uint32_t width) const
+	{
+		if (IsEmpty())
+			return *this;
+		return GridRect{ minX > n ? minX - n : 0, minY > n ? minY - n : 0,
+			std::min(maxX + n, length - 1), std::min(maxY + n, width - 1) };
+	}
+};
+
+// 体素格子坐标
+struct VoxelPos
+{
+	uint32_t x;
+	uint32_t y;
+	uint8_t layer;
+
+	bool operator==(const VoxelPos& o) const { return x == o.x && y == o.y && layer == o.layer; }
+	bool operator!=(const VoxelPos& o) const { return !(*this == o); }
+};
+
 class TerrainData
 {
 public:
-	// ÿGridϵϢ
-	struct Voxels
+	// 记录体素高度的数组元素, 体素高度=VoxelSpan*m_spanMeasure;
+	typedef uint16_t VoxelSpan;
+
+	// 记录每个体素的8方向邻近关系
+	// 每两个bit表示一个方向, 使用DirctionMask筛选LayerRelation, 00表示位移相同layer, 01表示layer+1, 10表示layer-1, 11表示未知需遍历判断
+	typedef uint16_t NeighborLayer;
+
+	// Column内保存上表面副本的层数
+	static const uint32_t InlineLayers = 5;
+
+	// 每个Grid在分块内的记录, spanIndex和neighborLayerIndex为所在Chunk内的局部索引
+	// 前InlineLayers个layer的上表面复制在记录开头, 按高度找layer时读取记录本身即可, 不再访问分块的span数组
+	struct Column
 	{
+		VoxelSpan uppers[InlineLayers];
 		uint16_t spanIndex;
 		uint16_t neighborLayerIndex;
 		uint8_t count;
+		uint8_t reserved;
 	};
+	static_assert(sizeof(Column) == 16, "Column is stored as is in binary terrain files, 4 per cache line");
+
+	// 一个Grid上的体素, 由GetVoxels根据Column和所在分块生成的只读视图
+	// 指向分块的数组, 修改地形后需重新获取
+	struct Voxels
+	{
+		const VoxelSpan* spans;
+		const NeighborLayer* neighbors;
+		// Column内的上表面副本, count不超过InlineLayers时有效
+		const VoxelSpan* uppers;
+		// 从spans起可以安全读取的span数量, 不少于SpanCount(count)
+		uint32_t readable;
+		// 分块内的槽位, slot + layer 是每个体素在分块内唯一的序号, 寻路等模块按此保存体素数据
+		uint32_t slot;
+		uint8_t count;
+	};
+
+	// Chunk边长(列数), x y 按 ChunkSize 分块
+	static const uint32_t ChunkShift = 6;
+	static const uint32_t ChunkSize = 1 << ChunkShift;
+	static const uint32_t ChunkMask = ChunkSize - 1;
+	// 分块内span和附近关系数组的最大长度, 受Column的16位索引限制
+	static const uint32_t ChunkArrayLimit = 1 << 16;
+
+	// 固定大小的地图分块, 拥有独立的span和邻接关系数组, 可单独加载或重建
+	// 数组可直接引用映射文件, 修改时复制到自有内存
+	struct Chunk
+	{
+		// 每列的记录, 根据局部x, y定位, 地图边缘的分块只包含地图内的列
+		CowArray<Column> gridArr;
+		// gridArr每行的列数
+		uint32_t stride = 0;
+		// 用Column的spanIndex和count索引
+		CowArray<VoxelSpan> spanArr;
+		// 用Column的neighborLayerIndex和count索引
+		CowArray<NeighborLayer> neighborLayerArr;
+
+		uint32_t LocalIndex(uint32_t x, uint32_t y) const { return (y & ChunkMask) * stride + (x & ChunkMask); }
+
+		// 分块内最多的层数, 列的槽位为 LocalIndex * maxLayers
+		uint8_t maxLayers = 0;
+		// 所有列的层数之和, 不超过ChunkArrayLimit, 保证不合并的附近关系总能放下
+		uint32_t voxelCount = 0;
+
+		// 修改后不再被引用的元素数量, 超过一半时整理
+		uint32_t spanGarbage = 0;
+		uint32_t neighborGarbage = 0;
+		// 多列共用相同的span或附近关系, 修改时不能原地写入, 整理时保持合并
+		bool sharedSpans = false;
+		bool sharedNeighbors = false;
+		// 添加体素时整理过或maxLayers增加, 槽位已变化, 由RebuildNeighbor报告后清除
+		bool relocated = false;
+	};
+
+	// 地图数据占用的内存, 自有内存按容量计算
+	struct MemoryStats
+	{
+		size_t gridBytes = 0;
+		size_t spanBytes = 0;
+		size_t neighborBytes = 0;
+		// 引用映射文件的部分, 多个进程共享物理页
+		size_t mappedBytes = 0;
+
+		size_t Total() const { return gridBytes + spanBytes + neighborBytes; }
+	};
+
+	// 二进制映射格式: BinaryHeader, ChunkCount个BinaryChunk, 之后为各分块数组, 偏移均按BinaryAlign对齐
+	// 保存构建好的分块数组, 映射后原地使用, 无需逐列解析和重建邻接关系
+	static const uint32_t BinaryMagic = 0x44545856; // "VXTD"
+	static const uint32_t BinaryVersion = 3;
+	static const uint32_t BinaryAlign = 16;
+	// 按高度找不到layer
+	static const uint8_t NoLayer = 0xFF;
+
+	struct BinaryHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t length;
+		uint32_t width;
+		uint32_t height;
+		float spanMeasure;
+		float gridSize;
+		uint32_t chunkShift;
+		uint32_t chunkCount;
+		uint32_t voxelsSize;
+	};
+
+	struct BinaryChunk
+	{
+		uint64_t gridOffset;
+		uint64_t spanOffset;
+		uint64_t neighborOffset;
+		uint32_t gridCount;
+		uint32_t spanCount;
+		uint32_t neighborCount;
+		// BinaryChunkSharedSpans等标记
+		uint32_t flags;
+	};
+	// 分块的span, 附近关系在列之间共用
+	static const uint32_t BinaryChunkSharedSpans = 1;
+	static const uint32_t BinaryChunkSharedNeighbors = 2;
 
 private:
-	// õͼĳ
+	// 该地图的长宽高
 	uint32_t m_length;
 	uint32_t m_width;
 	uint32_t m_height;
 	float m_spanMeasure;
 	float m_gridSize;
+	// 1/m_spanMeasure, 不能按span比较时为0
+	float m_spanInv;
 
-	// ص, x, yλ
-	std::vector<Voxels> m_gridArr;
+	// 分块数量, x y 方向
+	uint32_t m_chunkLength;
+	uint32_t m_chunkWidth;
 
-	// ¼ظ߶ȵ, VoxelsspanIndexcount, ظ߶=VoxelSpan*m_spanMeasure;
-	typedef uint16_t VoxelSpan;
-	std::vector<VoxelSpan> m_spanArr;
+	// 分块数组, 根据 x>>ChunkShift, y>>ChunkShift 定位
+	std::vector<Chunk> m_chunkArr;
 
-	// ¼ÿص8ڽϵ, VoxelsneighborLayerIndexCount
-	// ÿbitʾһ, ʹDirctionMaskɸѡLayerRelation, 00ʾλͬlayer, 01ʾlayer+1, 10ʾlayer-1, 11ʾδ֪ж
-	typedef uint16_t NeighborLayer;
-	std::vector<NeighborLayer> m_neighborLayerArr;
+	// 分块引用的映射文件
+	std::shared_ptr<MappedFile> m_file;
+
+	// 紧凑构建时每个分块span序列的哈希到spanIndex, AddVoxels据此复用相同的序列
+	bool m_compactBuild = false;
+	std::vector<std::unordered_multimap<uint64_t, uint32_t>> m_spanTable;
 
 	void StreamRead(std::istream& is, uint32_t& v) { is.read((char*)&v, sizeof(uint32_t)); }
 	void StreamWrite(std::ostream& os, uint32_t v) { os.write((char*)&v, sizeof(uint32_t)); }
 	void StreamRead(std::istream& is, uint8_t& v) { is.read((char*)&v, sizeof(uint8_t)); }
 	void StreamWrite(std::ostream& os, uint8_t v) { os.write((char*)&v, sizeof(uint8_t)); }
+
+	// 第index个分块在长度为total的方向上的列数, 地图边缘的分块不足ChunkSize
+	static uint32_t ChunkExtent(uint32_t total, uint32_t index)
+	{
+		uint32_t rest = total - (index << ChunkShift);
+		return rest < ChunkSize ? rest : ChunkSize;
+	}
+
+	// 按地图大小初始化分块, allocGrid为false时分块数组留空, 由调用者填充
+	void InitChunks(bool allocGrid = true)
+	{
+		m_chunkLength = (m_length + ChunkMask) >> ChunkShift;
+		m_chunkWidth = (m_width + ChunkMask) >> ChunkShift;
+		m_chunkArr.clear();
+		m_chunkArr.resize(m_chunkLength*m_chunkWidth);
+		m_file.reset();
+		m_spanTable.clear();
+		if (m_compactBuild)
+			m_spanTable.resize(m_chunkArr.size());
+		for (uint32_t c = 0; c < m_chunkArr.size(); ++c)
+		{
+			auto& chunk = m_chunkArr[c];
+			chunk.stride = ChunkExtent(m_length, c % m_chunkLength);
+			if (allocGrid)
+				chunk.gridArr.resize(chunk.stride * ChunkExtent(m_width, c / m_chunkLength), Column{});
+		}
+	}
+
+	// 只含span的视图, 不读取附近关系数组, 多线程构建时其他分块的附近关系可能正在重新分配
+	Voxels GetSpanVoxels(uint32_t x, uint32_t y) const
+	{
+		const auto& chunk = m_chunkArr[ChunkIndex(x, y)];
+		uint32_t local = chunk.LocalIndex(x, y);
+		const auto& col = chunk.gridArr[local];
+		return Voxels{ chunk.spanArr.data() + col.spanIndex, nullptr, col.uppers, uint32_t(chunk.spanArr.size() - col.spanIndex), local * chunk.maxLayers, col.count };
+	}
+
+	static uint64_t BinaryAlignUp(uint64_t v) { return (v + BinaryAlign - 1) & ~uint64_t(BinaryAlign - 1); }
+
+	template<typename T>
+	static bool BinaryCheckArray(const char* data, size_t size, uint64_t offset, uint32_t count)
+	{
+		return offset <= size && uint64_t(count) * sizeof(T) <= size - offset && uintptr_t(data + offset) % alignof(T) == 0;
+	}
+
+	// 每列的span和附近关系范围都在分块数组内, 读取时不再检查, 上表面副本与span数组一致; 同时统计分块的层数, 写入chunk
+	static bool BinaryCheckColumns(const Column* cols, const VoxelSpan* spans, const BinaryChunk& bc, Chunk& chunk)
+	{
+		if (bc.spanCount > ChunkArrayLimit || bc.neighborCount > ChunkArrayLimit)
+			return false;
+		for (uint32_t i = 0; i < bc.gridCount; ++i)
+		{
+			if (uint32_t(cols[i].spanIndex) + SpanCount(cols[i].count) > bc.spanCount
+				|| uint32_t(cols[i].neighborLayerIndex) + cols[i].count > bc.neighborCount)
+				return false;
+			for (uint32_t l = 0; l < cols[i].count && l < InlineLayers; ++l)
+			{
+				if (cols[i].uppers[l] != spans[cols[i].spanIndex + l * 2])
+					return false;
+			}
+			chunk.maxLayers = std::max(chunk.maxLayers, cols[i].count);
+			chunk.voxelCount += cols[i].count;
+		}
+		return chunk.voxelCount <= ChunkArrayLimit;
+	}
+
 public:
 	TerrainData(uint32_t length, uint32_t width, uint32_t height, float spanMeasure = 1.f, float gridSize = 50.f)
 		: m_length(length), m_width(width), m_height(height), m_spanMeasure(spanMeasure), m_gridSize(gridSize)
 	{
-		m_gridArr.resize(m_length*m_width);
+		m_spanInv = CanCompareBySpan() ? 1.f / m_spanMeasure : 0.f;
+		InitChunks();
 	}
 
-	// 
-	void Import(std::istream& is)
+	// 导入, 数据不完整, 坐标越界或列超出分块的16位索引时返回false且不修改当前数据
+	bool Import(std::istream& is)
 	{
-		StreamRead(is, m_length);
-		StreamRead(is, m_width);
-		StreamRead(is, m_height);
-		m_gridArr.resize(m_length*m_width);
+		uint32_t length = 0, width = 0, height = 0;
+		StreamRead(is, length);
+		StreamRead(is, width);
+		StreamRead(is, height);
+		if (!is || length == 0 || width == 0)
+			return false;
+		TerrainData terr(length, width, height, m_spanMeasure, m_gridSize);
+		terr.m_compactBuild = m_compactBuild;
 		uint32_t dataCount = 0;
 		StreamRead(is, dataCount);
+		std::vector<uint16_t> spans;
 		for (uint32_t i = 0; i < dataCount; i++)
 		{
-			uint32_t x, y;
-			uint8_t layerNum;
+			uint32_t x = 0, y = 0;
+			uint8_t layerNum = 0;
 			StreamRead(is, x);
 			StreamRead(is, y);
 			StreamRead(is, layerNum);
-			auto spanCount = SpanCount(layerNum);
-			uint16_t* spans = new uint16_t[spanCount];
-			is.read((char*)spans, spanCount * sizeof(uint16_t));
-			AddVoxels(x, y, layerNum, spans);
-			delete[] spans;
+			if (!is || !terr.IsValidGrid(x, y))
+				return false;
+			spans.resize(SpanCount(layerNum));
+			is.read((char*)spans.data(), spans.size() * sizeof(uint16_t));
+			if (!is || !terr.AddVoxels(x, y, layerNum, spans.data()))
+				return false;
 		}
-		BuildNeighbor();
+		terr.BuildNeighbor();
+		*this = std::move(terr);
+		return true;
 	}
 
-	// 
+	// 导出
 	void Export(std::ostream& os)
 	{
 		StreamWrite(os, m_length);
 		StreamWrite(os, m_width);
 		StreamWrite(os, m_height);
-		uint32_t dataCount = (uint32_t)m_gridArr.size();
+		uint32_t dataCount = m_length * m_width;
 		StreamWrite(os, dataCount);
 		for (uint32_t j = 0; j < Width(); ++j)
 			for (uint32_t i = 0; i < Length(); ++i)
@@ -126,73 +394,234 @@ public:
 				StreamWrite(os, i);
 				StreamWrite(os, j);
 				StreamWrite(os, vols.count);
-				uint16_t* spans = &m_spanArr[vols.spanIndex];
+				const VoxelSpan* spans = GetSpans(vols);
 				os.write((char*)spans, SpanCount(vols.count) * sizeof(uint16_t));
 			}
 	}
 
-	// һ, ߶Ϊֵ
-	void AddVoxels(uint32_t x, uint32_t y, uint8_t layerNum, uint16_t* spans)
+	// 导出二进制映射格式, 需先BuildNeighbor
+	void ExportBinary(std::ostream& os) const
 	{
-		auto& vols = GetVoxels(x, y);
-		vols.spanIndex = (uint16_t)m_spanArr.size();
-		vols.count = layerNum;
-		m_spanArr.reserve(m_spanArr.size() + SpanCount(layerNum));
-		for (uint8_t i = 0; i < SpanCount(layerNum); ++i)
+		BinaryHeader header = {};
+		header.magic = BinaryMagic;
+		header.version = BinaryVersion;
+		header.length = m_length;
+		header.width = m_width;
+		header.height = m_height;
+		header.spanMeasure = m_spanMeasure;
+		header.gridSize = m_gridSize;
+		header.chunkShift = ChunkShift;
+		header.chunkCount = ChunkCount();
+		header.voxelsSize = sizeof(Column);
+
+		std::vector<BinaryChunk> table(ChunkCount());
+		uint64_t offset = BinaryAlignUp(sizeof(BinaryHeader) + sizeof(BinaryChunk) * table.size());
+		for (uint32_t c = 0; c < ChunkCount(); ++c)
+		{
+			const auto& chunk = m_chunkArr[c];
+			auto& bc = table[c];
+			bc = {};
+			bc.gridCount = (uint32_t)chunk.gridArr.size();
+			bc.spanCount = (uint32_t)chunk.spanArr.size();
+			bc.neighborCount = (uint32_t)chunk.neighborLayerArr.size();
+			bc.flags = (chunk.sharedSpans ? BinaryChunkSharedSpans : 0) | (chunk.sharedNeighbors ? BinaryChunkSharedNeighbors : 0);
+			bc.gridOffset = offset;
+			offset = BinaryAlignUp(offset + sizeof(Column) * bc.gridCount);
+			bc.spanOffset = offset;
+			offset = BinaryAlignUp(offset + sizeof(VoxelSpan) * bc.spanCount);
+			bc.neighborOffset = offset;
+			offset = BinaryAlignUp(offset + sizeof(NeighborLayer) * bc.neighborCount);
+		}
+
+		uint64_t pos = 0;
+		auto write = [&os, &pos](uint64_t at, const void* data, size_t size) {
+			static const char zero[BinaryAlign] = {};
+			for (; pos < at; ++pos)
+				os.write(zero, 1);
+			os.write((const char*)data, size);
+			pos += size;
+		};
+		write(0, &header, sizeof(header));
+		write(pos, table.data(), sizeof(BinaryChunk) * table.size());
+		for (uint32_t c = 0; c < ChunkCount(); ++c)
+		{
+			const auto& chunk = m_chunkArr[c];
+			write(table[c].gridOffset, chunk.gridArr.data(), sizeof(Column) * chunk.gridArr.size());
+			write(table[c].spanOffset, chunk.spanArr.data(), sizeof(VoxelSpan) * chunk.spanArr.size());
+			write(table[c].neighborOffset, chunk.neighborLayerArr.data(), sizeof(NeighborLayer) * chunk.neighborLayerArr.size());
+		}
+	}
+
+	// 原地引用二进制映射格式的内存, data需在TerrainData使用期间有效, 格式不符返回false且不修改当前数据
+	// 读取只通过const接口, 不会复制; AddVoxels, SetVoxels等修改时复制被修改分块的数组
+	bool ImportBinary(const char* data, size_t size)
+	{
+		if (size < sizeof(BinaryHeader) || uintptr_t(data) % alignof(BinaryHeader) != 0)
+			return false;
+		const auto& header = *(const BinaryHeader*)data;
+		if (header.magic != BinaryMagic || header.version != BinaryVersion
+			|| header.chunkShift != ChunkShift || header.voxelsSize != sizeof(Column))
+			return false;
+		uint32_t chunkLength = (header.length + ChunkMask) >> ChunkShift;
+		uint32_t chunkWidth = (header.width + ChunkMask) >> ChunkShift;
+		if (uint64_t(chunkLength) * chunkWidth != header.chunkCount
+			|| !BinaryCheckArray<BinaryChunk>(data, size, sizeof(BinaryHeader), header.chunkCount))
+			return false;
+		const auto* table = (const BinaryChunk*)(data + sizeof(BinaryHeader));
+		std::vector<Chunk> counts(header.chunkCount);
+		for (uint32_t c = 0; c < header.chunkCount; ++c)
+		{
+			const auto& bc = table[c];
+			if (bc.gridCount != ChunkExtent(header.length, c % chunkLength) * ChunkExtent(header.width, c / chunkLength)
+				|| !BinaryCheckArray<Column>(data, size, bc.gridOffset, bc.gridCount)
+				|| !BinaryCheckArray<VoxelSpan>(data, size, bc.spanOffset, bc.spanCount)
+				|| !BinaryCheckArray<NeighborLayer>(data, size, bc.neighborOffset, bc.neighborCount)
+				|| !BinaryCheckColumns((const Column*)(data + bc.gridOffset), (const VoxelSpan*)(data + bc.spanOffset), bc, counts[c]))
+				return false;
+		}
+
+		m_length = header.length;
+		m_width = header.width;
+		m_height = header.height;
+		m_spanMeasure = header.spanMeasure;
+		m_gridSize = header.gridSize;
+		m_spanInv = CanCompareBySpan() ? 1.f / m_spanMeasure : 0.f;
+		InitChunks(false);
+		for (uint32_t c = 0; c < header.chunkCount; ++c)
+		{
+			const auto& bc = table[c];
+			auto& chunk = m_chunkArr[c];
+			chunk.gridArr.Attach((const Column*)(data + bc.gridOffset), bc.gridCount);
+			chunk.spanArr.Attach((const VoxelSpan*)(data + bc.spanOffset), bc.spanCount);
+			chunk.neighborLayerArr.Attach((const NeighborLayer*)(data + bc.neighborOffset), bc.neighborCount);
+			chunk.sharedSpans = (bc.flags & BinaryChunkSharedSpans) != 0;
+			chunk.sharedNeighbors = (bc.flags & BinaryChunkSharedNeighbors) != 0;
+			chunk.maxLayers = counts[c].maxLayers;
+			chunk.voxelCount = counts[c].voxelCount;
+		}
+		return true;
+	}
+
+	// 映射二进制格式文件并原地使用, 多进程共享同一文件的物理页
+	bool ImportMapped(const char* path)
+	{
+		auto file = std::make_shared<MappedFile>();
+		if (!file->Open(path) || !ImportBinary(file->Data(), file->Size()))
+			return false;
+		m_file = file;
+		return true;
+	}
+
+	// 添加一列体素, 高度为换算值
+	// 层数不增加时复用原有的span和附近关系位置, 增加时在分块末尾重新分配, 附近关系需重新构建
+	// 紧凑构建时span复用分块内相同的序列
+	// 分块数组超出16位索引时先整理分块, 仍放不下时返回false且不修改
+	bool AddVoxels(uint32_t x, uint32_t y, uint8_t layerNum, const uint16_t* spans)
+	{
+		uint32_t c = ChunkIndex(x, y);
+		auto& chunk = m_chunkArr[c];
+		uint32_t spanCount = SpanCount(layerNum);
+		auto fits = [&]() {
+			uint8_t count = GetSpanVoxels(x, y).count;
+			bool growSpan = m_compactBuild || layerNum > count || chunk.sharedSpans;
+			return chunk.voxelCount - count + layerNum <= ChunkArrayLimit
+				&& (layerNum <= count || chunk.neighborLayerArr.size() + layerNum <= ChunkArrayLimit)
+				&& (!growSpan || chunk.spanArr.size() + spanCount <= ChunkArrayLimit);
+		};
+		if (!fits())
+		{
+			CompactChunk(c);
+			chunk.relocated = true;
+			if (!fits())
+				return false;
+		}
+
+		if (layerNum > chunk.maxLayers)
+		{
+			chunk.maxLayers = layerNum;
+			chunk.relocated = true;
+		}
+		auto& vols = chunk.gridArr[chunk.LocalIndex(x, y)];
+		if (layerNum > vols.count)
+		{
+			chunk.neighborGarbage += vols.count;
+			vols.neighborLayerIndex = (uint16_t)chunk.neighborLayerArr.size();
+			chunk.neighborLayerArr.resize(chunk.neighborLayerArr.size() + layerNum, 0);
+		}
+		else
+			chunk.neighborGarbage += vols.count - layerNum;
+		chunk.spanGarbage += SpanCount(vols.count);
+		if (m_compactBuild)
+			vols.spanIndex = (uint16_t)InternSpans(c, spans, spanCount);
+		else
 		{
-			m_spanArr.push_back(spans[i]);
+			// 共用的span可能被其他列引用, 总是重新分配
+			if (layerNum > vols.count || chunk.sharedSpans)
+			{
+				vols.spanIndex = (uint16_t)chunk.spanArr.size();
+				chunk.spanArr.resize(chunk.spanArr.size() + spanCount);
+			}
+			else
+				chunk.spanGarbage -= spanCount;
+			std::copy(spans, spans + spanCount, chunk.spanArr.data() + vols.spanIndex);
 		}
+		chunk.voxelCount += layerNum - vols.count;
+		vols.count = layerNum;
+		for (uint32_t l = 0; l < layerNum && l < InlineLayers; ++l)
+			vols.uppers[l] = spans[l * 2];
+		return true;
 	}
 
-	// һ, ߶Ϊֵ
-	void AddVoxels(uint32_t x, uint32_t y, uint8_t layerNum, float* spans)
+	// 添加一列体素, 高度为浮点值
+	bool AddVoxels(uint32_t x, uint32_t y, uint8_t layerNum, const float* spans)
 	{
 		auto sz = new uint16_t[SpanCount(layerNum)];
-		for (uint8_t i = 0; i < SpanCount(layerNum); ++i)
+		for (uint32_t i = 0; i < SpanCount(layerNum); ++i)
 		{
 			sz[i] = uint16_t(spans[i]/SpanMeasure());
 		}
-		AddVoxels(x, y, layerNum, sz);
+		bool res = AddVoxels(x, y, layerNum, sz);
 		delete[] sz;
+		return res;
 	}
 private:
-	// ϵ
-	void CalcNeighborRelation(uint32_t x, uint32_t y, Direction dir, uint8_t layer, float hight, uint16_t arrIndex)
+	// 构建附近关系
+	void CalcNeighborRelation(uint32_t x, uint32_t y, Direction dir, uint8_t layer, float hight, NeighborLayer& neighbor)
 	{
 		uint8_t dstLayer = 255;
 		switch (dir)
 		{
 		case Direction::Front:
 			if (x < Length() - 1)
-				dstLayer = GetLayer(GetVoxels(x + 1, y), hight);
+				dstLayer = GetLayer(GetSpanVoxels(x + 1, y), hight);
 			break;
 		case Direction::RF:
 			if (x < Length() - 1 && y < Width() - 1)
-				dstLayer = GetLayer(GetVoxels(x + 1, y + 1), hight);
+				dstLayer = GetLayer(GetSpanVoxels(x + 1, y + 1), hight);
 			break;
 		case Direction::Right:
 			if (y < Width() - 1)
-				dstLayer = GetLayer(GetVoxels(x, y + 1), hight);
+				dstLayer = GetLayer(GetSpanVoxels(x, y + 1), hight);
 			break;
 		case Direction::RB:
 			if (y < Width() - 1 && x > 0)
-				dstLayer = GetLayer(GetVoxels(x - 1, y + 1), hight);
+				dstLayer = GetLayer(GetSpanVoxels(x - 1, y + 1), hight);
 			break;
 		case Direction::Back:
 			if (x > 0)
-				dstLayer = GetLayer(GetVoxels(x - 1, y), hight);
+				dstLayer = GetLayer(GetSpanVoxels(x - 1, y), hight);
 			break;
 		case Direction::LB:
 			if (x > 0 && y > 0)
-				dstLayer = GetLayer(GetVoxels(x - 1, y - 1), hight);
+				dstLayer = GetLayer(GetSpanVoxels(x - 1, y - 1), hight);
 			break;
 		case Direction::Left:
 			if (y > 0)
-				dstLayer = GetLayer(GetVoxels(x, y - 1), hight);
+				dstLayer = GetLayer(GetSpanVoxels(x, y - 1), hight);
 			break;
 		case Direction::LF:
 			if (y > 0 && x < Length() - 1)
-				dstLayer = GetLayer(GetVoxels(x + 1, y - 1), hight);
+				dstLayer = GetLayer(GetSpanVoxels(x + 1, y - 1), hight);
 			break;
 		default:
 			break;
@@ -200,70 +629,503 @@ private:
 		auto rel = dstLayer == layer ? LayerRelation::Same
 			: dstLayer == layer + 1 ? LayerRelation::Above 
 			: dstLayer == layer - 1 ? LayerRelation::Low : LayerRelation::Unknow;
-		m_neighborLayerArr[arrIndex + layer] |= uint32_t(rel) << (uint8_t(dir)*2);
+		neighbor |= uint32_t(rel) << (uint8_t(dir)*2);
+	}
+
+	// span序列的哈希, FNV-1a
+	static uint64_t HashSpans(const VoxelSpan* spans, uint32_t count)
+	{
+		uint64_t hash = 14695981039346656037ull ^ count;
+		for (uint32_t i = 0; i < count; ++i)
+			hash = (hash ^ spans[i]) * 1099511628211ull;
+		return hash;
+	}
+
+	// 在table中查找与spans相同的序列, table的值为序列在arr中的位置, arr共有arrSize个span
+	static bool FindSpans(const std::unordered_multimap<uint64_t, uint32_t>& table, const VoxelSpan* arr, size_t arrSize, uint64_t hash, const VoxelSpan* spans, uint32_t count, uint32_t& index)
+	{
+		auto range = table.equal_range(hash);
+		for (auto it = range.first; it != range.second; ++it)
+		{
+			if (it->second + size_t(count) <= arrSize && std::equal(spans, spans + count, arr + it->second))
+			{
+				index = it->second;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// 在分块内查找或追加span序列, 返回spanIndex
+	uint32_t InternSpans(uint32_t chunkIndex, const VoxelSpan* spans, uint32_t count)
+	{
+		if (count == 0)
+			return 0;
+		auto& chunk = m_chunkArr[chunkIndex];
+		auto& table = m_spanTable[chunkIndex];
+		uint64_t hash = HashSpans(spans, count);
+		uint32_t index = 0;
+		if (FindSpans(table, chunk.spanArr.data(), chunk.spanArr.size(), hash, spans, count, index))
+		{
+			chunk.sharedSpans = true;
+			return index;
+		}
+		index = (uint32_t)chunk.spanArr.size();
+		chunk.spanArr.resize(chunk.spanArr.size() + count);
+		std::copy(spans, spans + count, chunk.spanArr.data() + index);
+		table.emplace(hash, index);
+		return index;
+	}
+
+	// 在arr末尾追加长度为count的序列并返回位置; table不为空时先在其中查找相同的序列, 找到时复用并把shared置为true
+	static uint32_t AppendRun(std::vector<uint16_t>& arr, std::unordered_multimap<uint64_t, uint32_t>* table, const uint16_t* run, uint32_t count, bool& shared)
+	{
+		if (count == 0)
+			return 0;
+		uint64_t hash = 0;
+		uint32_t index = 0;
+		if (table)
+		{
+			hash = HashSpans(run, count);
+			if (FindSpans(*table, arr.data(), arr.size(), hash, run, count, index))
+			{
+				shared = true;
+				return index;
+			}
+		}
+		index = (uint32_t)arr.size();
+		arr.insert(arr.end(), run, run + count);
+		if (table)
+			table->emplace(hash, index);
+		return index;
 	}
 
 public:
-	// ԭlayer  LayerRelation õ Ŀlayer;
+	// 根据原layer 和 LayerRelation 得到 目标layer;
 	static uint8_t RelationToLayer(uint8_t layer, LayerRelation rel)
 	{
 		check(rel != LayerRelation::Unknow);
 		return rel == LayerRelation::Same ? layer : rel == LayerRelation::Above ? layer + 1 : rel == LayerRelation::Low ? layer - 1 : 0;
 	}
 
-	// תspan
-	static uint8_t SpanCount(uint8_t layerNum) { return layerNum * 2 - 1; }
+	// 体素数量转span数量
+	static uint32_t SpanCount(uint8_t layerNum) { return layerNum > 0 ? layerNum * 2 - 1 : 0; }
 
-	// ϵ
+	// 方向对应的 x y 偏移
+	static constexpr int8_t DirectionOffsetX[8] = { 1, 1, 0, -1, -1, -1, 0, 1 };
+	static constexpr int8_t DirectionOffsetY[8] = { 0, 1, 1, 1, 0, -1, -1, -1 };
+
+	// 构建附近关系
 	void BuildNeighbor()
 	{
-		for (uint32_t j = 0; j < Width(); ++j)
-			for (uint32_t i = 0; i < Length(); ++i)
+		for (uint32_t c = 0; c < ChunkCount(); ++c)
+			BuildChunkNeighbor(c);
+	}
+
+	// 多线程构建附近关系, 按分块分给线程池, 结果与BuildNeighbor()逐位一致
+	void BuildNeighbor(ThreadPool& pool)
+	{
+		// 线程间只读其他分块, 先把会写入的数组复制出来
+		for (auto& chunk : m_chunkArr)
+			chunk.gridArr.Detach();
+		bool bySpan = CanCompareBySpan();
+		pool.ParallelFor(ChunkCount(), [this, bySpan](uint32_t c) {
+			if (bySpan)
+				BuildChunkNeighborBySpan(c);
+			else
+				BuildChunkNeighbor(c);
+		});
+	}
+
+	// 在整数域比较高度构建单个分块的附近关系, 8个方向的关系用SIMD并行计算
+	void BuildChunkNeighborBySpan(uint32_t chunkIndex)
+	{
+		auto& chunk = m_chunkArr[chunkIndex];
+		const auto& grid = chunk.gridArr;
+		uint32_t baseX = (chunkIndex % m_chunkLength) << ChunkShift;
+		uint32_t baseY = (chunkIndex / m_chunkLength) << ChunkShift;
+		uint32_t endX = std::min(baseX + ChunkSize, Length());
+		uint32_t endY = std::min(baseY + ChunkSize, Width());
+
+		uint32_t neighborCount = 0;
+		for (uint32_t j = baseY; j < endY; ++j)
+			for (uint32_t i = baseX; i < endX; ++i)
+			{
+				auto& vols = chunk.gridArr[chunk.LocalIndex(i, j)];
+				vols.neighborLayerIndex = (uint16_t)neighborCount;
+				neighborCount += vols.count;
+			}
+		chunk.neighborLayerArr.clear();
+		chunk.neighborLayerArr.resize(neighborCount);
+		chunk.neighborLayerArr.shrink_to_fit();
+		chunk.neighborGarbage = 0;
+		NeighborLayer* neighbors = chunk.neighborLayerArr.data();
+
+		for (uint32_t j = baseY; j < endY; ++j)
+			for (uint32_t i = baseX; i < endX; ++i)
+				BuildColumnNeighborBySpan(i, j, neighbors + grid[chunk.LocalIndex(i, j)].neighborLayerIndex);
+		if (chunk.sharedSpans || chunk.sharedNeighbors)
+			RelayNeighbors(chunk, true);
+	}
+
+	// 在整数域比较高度计算一列的附近关系, 写入 neighbors[0, count)
+	void BuildColumnNeighborBySpan(uint32_t x, uint32_t y, NeighborLayer* neighbors) const
+	{
+		auto vols = GetSpanVoxels(x, y);
+		const VoxelSpan* dirSpans[8];
+		uint32_t dirCount[8];
+		uint32_t dirReadable[8];
+		for (uint8_t dir = 0; dir < 8; ++dir)
+		{
+			uint32_t dx = x + DirectionOffsetX[dir];
+			uint32_t dy = y + DirectionOffsetY[dir];
+			dirSpans[dir] = nullptr;
+			if (dx < Length() && dy < Width())
+			{
+				auto dirVols = GetSpanVoxels(dx, dy);
+				dirSpans[dir] = dirVols.spans;
+				dirCount[dir] = dirVols.count;
+				dirReadable[dir] = dirVols.readable;
+			}
+		}
+		const VoxelSpan* spans = vols.spans;
+		for (uint8_t layer = 0; layer < vols.count; ++layer)
+		{
+			uint16_t dstLayer[8];
+			for (uint8_t dir = 0; dir < 8; ++dir)
+				dstLayer[dir] = dirSpans[dir] ? GetLayerBySpan(dirSpans[dir], dirCount[dir], dirReadable[dir], spans[layer * 2]) : 255;
+			neighbors[layer] = PackNeighborRelation(dstLayer, layer);
+		}
+	}
+
+	// m_spanMeasure为正常正数时, span的大小关系与换算后高度的大小关系一致
+	bool CanCompareBySpan() const
+	{
+		return std::isnormal(m_spanMeasure) && m_spanMeasure > 0.f && m_spanMeasure < FLT_MAX / 65536.f;
+	}
+
+	// 8个方向的目标layer转为LayerRelation并合并, 规则与CalcNeighborRelation一致
+	static NeighborLayer PackNeighborRelation(const uint16_t dstLayer[8], uint8_t layer)
+	{
+#ifdef VOXEL_SSE2
+		const __m128i one = _mm_set1_epi16(1);
+		__m128i dst = _mm_loadu_si128((const __m128i*)dstLayer);
+		__m128i src = _mm_set1_epi16(layer);
+		__m128i same = _mm_cmpeq_epi16(dst, src);
+		__m128i above = _mm_cmpeq_epi16(dst, _mm_add_epi16(src, one));
+		__m128i low = _mm_cmpeq_epi16(dst, _mm_sub_epi16(src, one));
+		__m128i rel = _mm_andnot_si128(_mm_or_si128(_mm_or_si128(same, above), low), _mm_set1_epi16(short(LayerRelation::Unknow)));
+		rel = _mm_or_si128(rel, _mm_and_si128(above, _mm_set1_epi16(short(LayerRelation::Above))));
+		rel = _mm_or_si128(rel, _mm_and_si128(low, _mm_set1_epi16(short(LayerRelation::Low))));
+		rel = _mm_mullo_epi16(rel, _mm_setr_epi16(1 << 0, 1 << 2, 1 << 4, 1 << 6, 1 << 8, 1 << 10, 1 << 12, short(1 << 14)));
+		rel = _mm_or_si128(rel, _mm_srli_si128(rel, 8));
+		rel = _mm_or_si128(rel, _mm_srli_si128(rel, 4));
+		rel = _mm_or_si128(rel, _mm_srli_si128(rel, 2));
+		return NeighborLayer(_mm_cvtsi128_si32(rel));
+#else
+		NeighborLayer neighbor = 0;
+		for (uint8_t dir = 0; dir < 8; ++dir)
+		{
+			auto rel = dstLayer[dir] == layer ? LayerRelation::Same
+				: dstLayer[dir] == layer + 1 ? LayerRelation::Above
+				: dstLayer[dir] == layer - 1 ? LayerRelation::Low : LayerRelation::Unknow;
+			neighbor |= uint32_t(rel) << (dir * 2);
+		}
+		return neighbor;
+#endif
+	}
+
+	// 构建单个分块的附近关系, 邻居可跨分块读取
+	void BuildChunkNeighbor(uint32_t chunkIndex)
+	{
+		auto& chunk = m_chunkArr[chunkIndex];
+		chunk.neighborLayerArr.clear();
+		chunk.neighborGarbage = 0;
+		uint32_t baseX = (chunkIndex % m_chunkLength) << ChunkShift;
+		uint32_t baseY = (chunkIndex / m_chunkLength) << ChunkShift;
+		uint32_t endX = std::min(baseX + ChunkSize, Length());
+		uint32_t endY = std::min(baseY + ChunkSize, Width());
+		for (uint32_t j = baseY; j < endY; ++j)
+			for (uint32_t i = baseX; i < endX; ++i)
 			{
-				auto& vols = GetVoxels(i, j);
-				vols.neighborLayerIndex = (uint16_t)m_neighborLayerArr.size();
-				m_neighborLayerArr.resize(m_neighborLayerArr.size() + vols.count);
+				auto& col = chunk.gridArr[chunk.LocalIndex(i, j)];
+				col.neighborLayerIndex = (uint16_t)chunk.neighborLayerArr.size();
+				chunk.neighborLayerArr.resize(chunk.neighborLayerArr.size() + col.count);
+				auto vols = GetSpanVoxels(i, j);
 				for (uint8_t layer = 0; layer < vols.count; ++layer)
 				{
 					auto hight = GetHight(vols, layer);
 					for (auto dir = uint8_t(Direction::Front); dir <= uint8_t(Direction::LF); ++dir)
-						CalcNeighborRelation(i, j, Direction(dir), layer, hight, vols.neighborLayerIndex);
+						CalcNeighborRelation(i, j, Direction(dir), layer, hight, chunk.neighborLayerArr[col.neighborLayerIndex + layer]);
 				}
 			}
+		chunk.neighborLayerArr.shrink_to_fit();
+		if (chunk.sharedSpans || chunk.sharedNeighbors)
+			RelayNeighbors(chunk, true);
+	}
+
+	// 修改一列体素并增量更新附近关系, 返回附近关系或体素索引有变化的区域
+	GridRect SetVoxels(uint32_t x, uint32_t y, uint8_t layerNum, const uint16_t* spans)
+	{
+		AddVoxels(x, y, layerNum, spans);
+		return RebuildNeighbor(GridRect{ x, y, x, y });
+	}
+
+	// 把矩形区域内的每一列修改为相同的体素并增量更新附近关系
+	GridRect SetVoxels(const GridRect& rect, uint8_t layerNum, const uint16_t* spans)
+	{
+		for (uint32_t j = rect.minY; j <= rect.maxY; ++j)
+			for (uint32_t i = rect.minX; i <= rect.maxX; ++i)
+				AddVoxels(i, j, layerNum, spans);
+		return RebuildNeighbor(rect);
+	}
+
+	// 重算区域及外围一圈格子的附近关系, 可在多次AddVoxels后统一调用
+	// 返回区域内的Voxels副本需重新获取(分块整理时区域扩展到整个分块)
+	GridRect RebuildNeighbor(const GridRect& rect)
+	{
+		GridRect dirty = rect.Expand(1, Length(), Width());
+		if (dirty.IsEmpty())
+			return dirty;
+
+		// 整理垃圾过多的分块
+		for (uint32_t cy = dirty.minY >> ChunkShift; cy <= dirty.maxY >> ChunkShift; ++cy)
+			for (uint32_t cx = dirty.minX >> ChunkShift; cx <= dirty.maxX >> ChunkShift; ++cx)
+			{
+				uint32_t c = cy * m_chunkLength + cx;
+				auto& chunk = m_chunkArr[c];
+				if (chunk.spanGarbage * 2 > chunk.spanArr.size() || chunk.neighborGarbage * 2 > chunk.neighborLayerArr.size())
+				{
+					CompactChunk(c);
+					chunk.relocated = true;
+				}
+				if (chunk.relocated)
+				{
+					dirty.Merge(ChunkRect(c));
+					chunk.relocated = false;
+				}
+			}
+
+		bool bySpan = CanCompareBySpan();
+		GridRect rebuild = rect.Expand(1, Length(), Width());
+		for (uint32_t j = rebuild.minY; j <= rebuild.maxY; ++j)
+			for (uint32_t i = rebuild.minX; i <= rebuild.maxX; ++i)
+			{
+				NeighborLayer neighbors[256];
+				auto vols = GetSpanVoxels(i, j);
+				if (bySpan)
+					BuildColumnNeighborBySpan(i, j, neighbors);
+				else
+				{
+					for (uint8_t layer = 0; layer < vols.count; ++layer)
+					{
+						neighbors[layer] = 0;
+						auto hight = GetHight(vols, layer);
+						for (auto dir = uint8_t(Direction::Front); dir <= uint8_t(Direction::LF); ++dir)
+							CalcNeighborRelation(i, j, Direction(dir), layer, hight, neighbors[layer]);
+					}
+				}
+				WriteNeighbors(i, j, neighbors, vols.count);
+			}
+		return dirty;
+	}
+
+	// 写入一列的附近关系, 共用的序列不原地修改, 改为追加到分块末尾; 放不下时展开分块的附近关系
+	void WriteNeighbors(uint32_t x, uint32_t y, const NeighborLayer* neighbors, uint8_t count)
+	{
+		auto& chunk = m_chunkArr[ChunkIndex(x, y)];
+		uint32_t local = chunk.LocalIndex(x, y);
+		const auto& grid = chunk.gridArr;
+		const auto& arr = chunk.neighborLayerArr;
+		uint32_t index = grid[local].neighborLayerIndex;
+		if (std::equal(neighbors, neighbors + count, arr.data() + index))
+			return;
+		if (chunk.sharedNeighbors && arr.size() + count > ChunkArrayLimit)
+			RelayNeighbors(chunk, false);
+		auto& col = chunk.gridArr[local];
+		if (chunk.sharedNeighbors)
+		{
+			chunk.neighborGarbage += count;
+			col.neighborLayerIndex = (uint16_t)arr.size();
+			chunk.neighborLayerArr.resize(arr.size() + count);
+		}
+		std::copy(neighbors, neighbors + count, chunk.neighborLayerArr.data() + col.neighborLayerIndex);
+	}
+
+	// 按列顺序重新排列分块的span和附近关系, 去掉不再引用的元素并释放多余容量
+	// dedup时合并相同的span和附近关系序列, 已合并的分块和紧凑构建时总是合并
+	void CompactChunk(uint32_t chunkIndex, bool dedup = false)
+	{
+		auto& chunk = m_chunkArr[chunkIndex];
+		dedup = dedup || chunk.sharedSpans || chunk.sharedNeighbors || m_compactBuild;
+		std::vector<VoxelSpan> spanArr;
+		std::vector<NeighborLayer> neighborLayerArr;
+		std::unordered_multimap<uint64_t, uint32_t> spanTable;
+		std::unordered_multimap<uint64_t, uint32_t> neighborTable;
+		// 共用的分块按列累计的垃圾数可能多于实际
+		spanArr.reserve(chunk.spanArr.size() - std::min<size_t>(chunk.spanGarbage, chunk.spanArr.size()));
+		neighborLayerArr.reserve(chunk.neighborLayerArr.size() - std::min<size_t>(chunk.neighborGarbage, chunk.neighborLayerArr.size()));
+		bool hasNeighbor = !chunk.neighborLayerArr.empty();
+		bool sharedSpans = false;
+		bool sharedNeighbors = false;
+		for (auto& vols : chunk.gridArr)
+		{
+			vols.spanIndex = (uint16_t)AppendRun(spanArr, dedup ? &spanTable : nullptr, chunk.spanArr.data() + vols.spanIndex, SpanCount(vols.count), sharedSpans);
+			if (hasNeighbor)
+				vols.neighborLayerIndex = (uint16_t)AppendRun(neighborLayerArr, dedup ? &neighborTable : nullptr, chunk.neighborLayerArr.data() + vols.neighborLayerIndex, vols.count, sharedNeighbors);
+			else
+				vols.neighborLayerIndex = 0;
+		}
+		chunk.spanArr.assign(spanArr.data(), spanArr.data() + spanArr.size());
+		chunk.neighborLayerArr.assign(neighborLayerArr.data(), neighborLayerArr.data() + neighborLayerArr.size());
+		chunk.spanArr.shrink_to_fit();
+		chunk.neighborLayerArr.shrink_to_fit();
+		chunk.spanGarbage = 0;
+		chunk.neighborGarbage = 0;
+		chunk.sharedSpans = sharedSpans;
+		chunk.sharedNeighbors = sharedNeighbors;
+		chunk.maxLayers = 0;
+		for (const auto& vols : chunk.gridArr)
+			chunk.maxLayers = std::max(chunk.maxLayers, vols.count);
+		if (m_compactBuild)
+			m_spanTable[chunkIndex].swap(spanTable);
+	}
+
+	// 按列顺序重新排列附近关系, dedup时合并相同的序列
+	// 只修改附近关系数组和列的neighborLayerIndex, 多线程构建时不影响其他分块读取span
+	void RelayNeighbors(Chunk& chunk, bool dedup)
+	{
+		std::vector<NeighborLayer> neighborLayerArr;
+		std::unordered_multimap<uint64_t, uint32_t> neighborTable;
+		bool shared = false;
+		for (auto& vols : chunk.gridArr)
+			vols.neighborLayerIndex = (uint16_t)AppendRun(neighborLayerArr, dedup ? &neighborTable : nullptr, chunk.neighborLayerArr.data() + vols.neighborLayerIndex, vols.count, shared);
+		chunk.neighborLayerArr.assign(neighborLayerArr.data(), neighborLayerArr.data() + neighborLayerArr.size());
+		chunk.neighborLayerArr.shrink_to_fit();
+		chunk.neighborGarbage = 0;
+		chunk.sharedNeighbors = shared;
+	}
+
+	// 紧凑构建: 之后的AddVoxels在分块内复用相同的span序列, 相同的列很多时不会先占用再合并
+	// 应在添加体素前打开, 关闭时释放查找表, 已合并的span保持合并
+	void SetCompactBuild(bool enable)
+	{
+		m_compactBuild = enable;
+		m_spanTable.clear();
+		m_spanTable.shrink_to_fit();
+		if (enable)
+			m_spanTable.resize(ChunkCount());
+	}
+
+	bool IsCompactBuild() const { return m_compactBuild; }
+
+	// 合并每个分块内相同的span和附近关系序列并释放多余容量, 返回节省的字节数
+	// span和附近关系的索引会改变, 按槽位保存的寻路数据需重建; 引用映射文件的分块不处理
+	size_t Dedup()
+	{
+		size_t before = GetMemoryStats().Total();
+		for (uint32_t c = 0; c < ChunkCount(); ++c)
+		{
+			const auto& chunk = m_chunkArr[c];
+			if (!chunk.gridArr.IsAttached() && !chunk.spanArr.IsAttached() && !chunk.neighborLayerArr.IsAttached())
+				CompactChunk(c, true);
+		}
+		size_t after = GetMemoryStats().Total();
+		return before > after ? before - after : 0;
 	}
 
-	// ܳ
+	MemoryStats GetMemoryStats() const
+	{
+		MemoryStats stats;
+		auto count = [&stats](const auto& arr, size_t& bytes) {
+			size_t size = sizeof(*arr.data());
+			if (arr.IsAttached())
+				stats.mappedBytes += arr.size() * size;
+			else
+				bytes += arr.capacity() * size;
+		};
+		for (const auto& chunk : m_chunkArr)
+		{
+			count(chunk.gridArr, stats.gridBytes);
+			count(chunk.spanArr, stats.spanBytes);
+			count(chunk.neighborLayerArr, stats.neighborBytes);
+		}
+		return stats;
+	}
+
+	// 分块覆盖的格子区域
+	GridRect ChunkRect(uint32_t chunkIndex) const
+	{
+		uint32_t baseX = (chunkIndex % m_chunkLength) << ChunkShift;
+		uint32_t baseY = (chunkIndex / m_chunkLength) << ChunkShift;
+		return GridRect{ baseX, baseY, std::min(baseX + ChunkSize, Length()) - 1, std::min(baseY + ChunkSize, Width()) - 1 };
+	}
+
+	// 地形总长宽高
 	uint32_t Length() const { return m_length; }
 	uint32_t Width() const { return m_width; }
 	uint32_t Height() const { return m_height; }
 	float SpanMeasure() const { return m_spanMeasure; }
 	float GridSize() const { return m_gridSize; }
 
-	// ȡӦб
-	const Voxels& GetVoxels(uint32_t x, uint32_t y) const { assert(x < m_length && y < m_width); return m_gridArr[y*m_width + x]; }
-	//const Voxels& GetVoxels(float x, float y) const { return GetVoxels(uint32_t(x / m_gridSize), uint32_t(y / m_gridSize)); }
-	Voxels& GetVoxels(uint32_t x, uint32_t y) { assert(x < m_length && y < m_width); return m_gridArr[y*m_width + x]; }
+	// 分块
+	uint32_t ChunkLength() const { return m_chunkLength; }
+	uint32_t ChunkWidth() const { return m_chunkWidth; }
+	uint32_t ChunkCount() const { return (uint32_t)m_chunkArr.size(); }
+	uint32_t ChunkIndex(uint32_t x, uint32_t y) const { return (y >> ChunkShift) * m_chunkLength + (x >> ChunkShift); }
+	const Chunk& GetChunk(uint32_t chunkIndex) const { return m_chunkArr[chunkIndex]; }
+	// 分块内的槽位数, Voxels.slot + layer 小于该值
+	uint32_t SlotCount(uint32_t chunkIndex) const { return (uint32_t)m_chunkArr[chunkIndex].gridArr.size() * m_chunkArr[chunkIndex].maxLayers; }
+
+	// 获取坐标对应的体素列表, 只读视图, 修改地形后失效
+	Voxels GetVoxels(uint32_t x, uint32_t y) const
+	{
+		assert(x < m_length && y < m_width);
+		const auto& chunk = m_chunkArr[ChunkIndex(x, y)];
+		uint32_t local = chunk.LocalIndex(x, y);
+		const auto& col = chunk.gridArr[local];
+		return Voxels{ chunk.spanArr.data() + col.spanIndex, chunk.neighborLayerArr.data() + col.neighborLayerIndex, col.uppers,
+			uint32_t(chunk.spanArr.size() - col.spanIndex), local * chunk.maxLayers, col.count };
+	}
 
-	// spanIndex  Voxelsṹ, layerΪgridڼ, עlayer<Voxels.count
-	float GetVoxelUpper(uint16_t spanIndex, uint8_t layer) const { return m_spanArr[spanIndex + layer * 2] * m_spanMeasure; }
-	float GetVoxelDown(uint16_t spanIndex, uint8_t layer) const { return layer == 0 ? 0.f : m_spanArr[spanIndex + layer * 2 - 1] * m_spanMeasure; }
+	// vols 来自 GetVoxels, layer为grid第几个体素, 注意layer必须<Voxels.count
+	const VoxelSpan* GetSpans(const Voxels& vols) const { return vols.spans; }
+	float GetVoxelUpper(const Voxels& vols, uint8_t layer) const { return GetSpans(vols)[layer * 2] * m_spanMeasure; }
+	float GetVoxelDown(const Voxels& vols, uint8_t layer) const { return layer == 0 ? 0.f : GetSpans(vols)[layer * 2 - 1] * m_spanMeasure; }
 
-	// ȡٽlayer
+	// 获取临近对象的layer
 	LayerRelation GetNeighborLayerRelation(const Voxels& vols, uint8_t layer, Direction dir) const
 	{
 		uint16_t offset = uint8_t(dir) * 2;
-		auto relation = m_neighborLayerArr[vols.neighborLayerIndex + layer] & (0x03 << offset);
+		auto relation = vols.neighbors[layer] & (0x03 << offset);
 		
 		return LayerRelation(relation >> offset);
 	}
 
-	// layerѰҸݸ߶Ⱥʵlayer
+	// 8个方向的关系, 每个方向2位, 为0表示各方向都是同层可走
+	NeighborLayer GetNeighborLayer(const Voxels& vols, uint8_t layer) const
+	{
+		return vols.neighbors[layer];
+	}
+
+	// 根据高度查找合适的layer, 即上表面不高于hight的最高layer, 都高于hight时为0
 	uint8_t GetLayer(const Voxels& vols, float hight) const
+	{
+		if (!(m_spanInv > 0.f))
+			return GetLayerByScan(vols, hight);
+		if (!(hight >= 0.f))
+			return 0;
+		VoxelSpan h = SpanFloor(hight);
+		return vols.count <= InlineLayers ? GetLayerByUpper(vols.uppers, vols.count, h) : GetLayerBySpan(vols, h);
+	}
+
+	// 逐个layer换算为高度比较, m_spanMeasure异常时使用
+	uint8_t GetLayerByScan(const Voxels& vols, float hight) const
 	{
 		uint8_t layer = 0;
 		for (uint8_t i = 0; i < vols.count; ++i)
 		{
-			float v = GetVoxelUpper(vols.spanIndex, i);
+			float v = GetVoxelUpper(vols, i);
 			if (v <= hight)
 				layer = i;
 			else
@@ -272,118 +1134,429 @@ public:
 		return layer;
 	}
 
-	// ѰΧڵlayer
+	// 不大于hight的最大span, 即 span <= 结果 与 span*m_spanMeasure <= hight 等价, 要求CanCompareBySpan()且hight >= 0
+	VoxelSpan SpanFloor(float hight) const
+	{
+		float q = hight * m_spanInv;
+		if (q >= 65535.f)
+			return 65535;
+		// 倒数相乘有舍入误差, 按GetVoxelUpper相同的乘法修正一次
+		uint32_t span = uint32_t(q);
+		if (span < 65535 && float(span + 1) * m_spanMeasure <= hight)
+			++span;
+		else if (span > 0 && float(span) * m_spanMeasure > hight)
+			--span;
+		return VoxelSpan(span);
+	}
+
+	// 寻找误差范围内的layer, 没有时返回NoLayer
 	uint8_t GetLayer(const Voxels& vols, float hight, float up, float down) const
 	{
 		for (uint8_t i = 0; i < vols.count; ++i)
 		{
-			float v = GetVoxelUpper(vols.spanIndex, i);
+			float v = GetVoxelUpper(vols, i);
 			if (v + up >= hight && v - down <= hight)
 				return i;
 		}
+		return NoLayer;
 	}
 
-	// layer
-	float GetHight(const Voxels& vols, uint8_t layer) const { return GetVoxelUpper(vols.spanIndex, layer); }
+	// 整数域按高度查找layer, m_spanMeasure为正常正数时与GetLayer(vols, hight*m_spanMeasure)结果一致
+	uint8_t GetLayerBySpan(const Voxels& vols, VoxelSpan hight) const
+	{
+		return GetLayerBySpan(vols.spans, vols.count, vols.readable, hight);
+	}
+
+	// uppers为Column开头的上表面副本, count不超过InlineLayers; 一次读取整个Column的16字节, 多出的部分按count屏蔽
+	static uint8_t GetLayerByUpper(const VoxelSpan* uppers, uint32_t count, VoxelSpan hight)
+	{
+		VOXEL_COUNT(GetLayerCompare, count);
+		uint32_t above = 0;
+#ifdef VOXEL_SSE2
+		__m128i v = _mm_loadu_si128((const __m128i*)uppers);
+		uint32_t le = uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_subs_epu16(v, _mm_set1_epi16(short(hight))), _mm_setzero_si128())));
+		uint32_t bound = 1u << (count * 2);
+		above = Bits::CountTrailingZero((~le & (bound - 1)) | bound) >> 1;
+#else
+		while (above < count && uppers[above] <= hight)
+			++above;
+#endif
+		return above == 0 ? 0 : uint8_t(above - 1);
+	}
 
+	// readable为spans起可安全读取的span数量, 不少于SpanCount(count)
+	static uint8_t GetLayerBySpan(const VoxelSpan* spans, uint32_t count, uint32_t readable, VoxelSpan hight)
+	{
+		VOXEL_COUNT(GetLayerCompare, count);
+		// 第一个高于hight的layer
+		uint32_t above = count;
+		uint32_t i = 0;
+#ifdef VOXEL_SSE2
+		// 不超过8层时一次比较所有layer的上表面, 没有循环和分支, 第count层的位作为找不到时的哨兵
+		if (count <= 8 && readable >= 16)
+		{
+#ifdef VOXEL_AVX2
+			const __m256i h8 = _mm256_set1_epi16(short(hight));
+			__m256i v = _mm256_loadu_si256((const __m256i*)spans);
+			uint32_t le = uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi16(_mm256_subs_epu16(v, h8), _mm256_setzero_si256())));
+#else
+			const __m128i h8 = _mm_set1_epi16(short(hight));
+			const __m128i zero8 = _mm_setzero_si128();
+			__m128i lo = _mm_cmpeq_epi16(_mm_subs_epu16(_mm_loadu_si128((const __m128i*)spans), h8), zero8);
+			__m128i hi = _mm_cmpeq_epi16(_mm_subs_epu16(_mm_loadu_si128((const __m128i*)(spans + 8)), h8), zero8);
+			uint32_t le = uint32_t(_mm_movemask_epi8(lo)) | (uint32_t(_mm_movemask_epi8(hi)) << 16);
+#endif
+			uint64_t bound = uint64_t(1) << (count * 4);
+			uint64_t gt = (uint64_t(~le & 0x33333333u) & (bound - 1)) | bound;
+			above = Bits::CountTrailingZero64(gt) >> 2;
+			return above == 0 ? 0 : uint8_t(above - 1);
+		}
+#endif
+#ifdef VOXEL_AVX2
+		// 层数多的格子每次比较8个layer的上表面
+		const __m256i h16 = _mm256_set1_epi16(short(hight));
+		const __m256i zero16 = _mm256_setzero_si256();
+		for (; i < count && i * 2 + 16 <= readable; i += 8)
+		{
+			__m256i v = _mm256_loadu_si256((const __m256i*)(spans + i * 2));
+			uint32_t gt = ~uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi16(_mm256_subs_epu16(v, h16), zero16))) & 0x33333333u;
+			if (count - i < 8)
+				gt &= (1u << ((count - i) * 4)) - 1;
+			if (gt)
+			{
+				above = i + (Bits::CountTrailingZero(gt) >> 2);
+				break;
+			}
+		}
+#endif
+#ifdef VOXEL_SSE2
+		// 每次比较4个layer的上表面
+		const __m128i h = _mm_set1_epi16(short(hight));
+		const __m128i zero = _mm_setzero_si128();
+		for (; above == count && i < count && i * 2 + 8 <= readable; i += 4)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i*)(spans + i * 2));
+			uint32_t gt = ~uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_subs_epu16(v, h), zero))) & 0x3333;
+			if (count - i < 4)
+				gt &= (1u << ((count - i) * 4)) - 1;
+			if (gt)
+			{
+				above = i + (Bits::CountTrailingZero(gt) >> 2);
+				break;
+			}
+		}
+#endif
+		for (; above == count && i < count; ++i)
+		{
+			if (spans[i * 2] > hight)
+			{
+				above = i;
+				break;
+			}
+		}
+		return above == 0 ? 0 : uint8_t(above - 1);
+	}
+
+	// layer计算高
+	float GetHight(const Voxels& vols, uint8_t layer) const { return GetVoxelUpper(vols, layer); }
+
+	// x y 移动到 dir 方向的格子, 越界时结果不小于Length()或Width()
 	void CalcDirectionGrid(Direction dir, uint32_t& x, uint32_t& y) const
 	{
+		x += DirectionOffsetX[uint8_t(dir)];
+		y += DirectionOffsetY[uint8_t(dir)];
 	}
+
+	bool IsValidGrid(uint32_t x, uint32_t y) const { return x < m_length && y < m_width; }
 };
 
 
 class TerrainInstance
 {
 public:
-	struct Grid
+	// 掩码状态的快照, 与实例共享分块, 复制代价与已分配的分块数有关
+	struct Snapshot
 	{
-		uint16_t maskIndex;
+		uint32_t version = 0;
+		std::vector<MaskTiles> maskTiles;
 	};
 
+	// 增量格式: 魔数, 基准版本, 目标版本, layer数, 每个layer: layer, 段数, 每段: 与上一段末尾的键间隔, 长度, 每个格子的mask和cover
+	// 除mask外都是变长整数, 每字节7位, 最高位表示后面还有
+	static const uint32_t DeltaMagic = 0x444D5856; // "VXMD"
+
 private:
 	TerrainData* m_terr;
-	// ̬, maskIndex
-	std::vector<uint8_t> m_maskArr;
 
-	// ʵ, x y λ
-	std::vector<Grid> m_gridArr;
+	// 掩码或布局每次修改加1, 用于判断快照是否过期
+	uint32_t m_maskVersion = 0;
+
+	// 每个layer一组占用分块, 按需分配, 只为有占用的区域分配内存
+	// 实例之间复制时共享分块, 修改时复制单个分块
+	std::vector<MaskTiles> m_maskTiles;
+
+	// 最近的掩码和地形修改区域, 第i次修改保存在 i % ChangeLogSize, 第一次修改时分配
+	static const uint32_t ChangeLogSize = 256;
+	uint32_t m_changeCount = 0;
+	std::vector<GridRect> m_changeLog;
+
+	void LogChange(const GridRect& rect)
+	{
+		if (m_changeLog.empty())
+			m_changeLog.resize(ChangeLogSize, GridRect::Empty());
+		m_changeLog[m_changeCount % ChangeLogSize] = rect;
+		++m_changeCount;
+	}
+
+	GridRect WholeMap() const { return GridRect{ 0, 0, GetData().Length() - 1, GetData().Width() - 1 }; }
 
 public:
+	// 不分配与地图大小相关的内存
 	TerrainInstance(TerrainData* terr) : m_terr(terr)
 	{
-		m_gridArr.resize(terr->Length()*terr->Width());
-		for(uint32_t x=0;x<terr->Length();++x)
-			for (uint32_t y=0;y<terr->Width();++y)
-			{
-				const auto& vx = terr->GetVoxels(x, y);
-				m_gridArr[y*GetData().Width() + x].maskIndex = (uint8_t)m_maskArr.size();
-				m_maskArr.resize(m_maskArr.size() + vx.count, 0);
-			}
+	}
+
+	// 地形修改后调用, columns为修改了体素的列, 即传给SetVoxels的区域, 不是返回的附近关系区域
+	// 掩码按layer序号保存, 列的layer变化后原来的序号可能指向别的高度, 这些列各layer的掩码和覆盖计数清零
+	// 站在其中的代理需Update后重新AddMask; 之前按旧layer的DecMask在清零的格子上停在0
+	void OnTerrainChanged(const GridRect& columns)
+	{
+		GridRect rect = columns.Expand(0, GetData().Length(), GetData().Width());
+		if (!rect.IsEmpty())
+		{
+			for (auto& tiles : m_maskTiles)
+				tiles.Clear(rect.minX, rect.minY, rect.maxX, rect.maxY);
+		}
+		++m_maskVersion;
+		LogChange(rect);
 	}
 
 	const TerrainData& GetData() const { assert(m_terr); return *m_terr; }
-	const Grid& GetGrid(uint32_t x, uint32_t y) const { return m_gridArr[y*GetData().Width()+x]; }
-	//const Grid& GetGrid(float x, float y) { return GetGrid(x/m_terr->GridSize(), y/m_terr->GridSize()); }
+	uint32_t MaskVersion() const { return m_maskVersion; }
+
+	// 累计的掩码和地形修改次数, 回滚和应用增量时也只增不减
+	uint32_t ChangeCount() const { return m_changeCount; }
 
-	// 
-	bool IsMask(const Grid& grid, uint8_t layer)
+	// 把第since次之后每次修改的区域传给fn, 地形修改为传给OnTerrainChanged的列, 掩码修改含半径
+	// 回滚和应用增量按整个地图计; 记录已被覆盖时返回false, 调用者应视为全部失效
+	template<typename Fn>
+	bool ForEachChange(uint32_t since, Fn fn) const
 	{
-		return m_maskArr[grid.maskIndex + layer]>0;
+		if (m_changeCount - since > ChangeLogSize)
+			return false;
+		for (uint32_t i = since; i != m_changeCount; ++i)
+			fn(m_changeLog[i % ChangeLogSize]);
+		return true;
 	}
 
-	bool IsMask(uint32_t x, uint32_t y, uint8_t layer, uint8_t radius = 0)
+	// 掩码占用的内存, 与其他实例共享的分块也计入
+	size_t MaskMemoryBytes() const
 	{
-		if (radius < 1)
-			return IsMask(GetGrid(x, y), layer);
-		const auto& t = GetData();
-		auto ystart = y > radius ? y - radius : 0;
-		auto yend = t.Width() - radius > y ? y + radius : t.Width() - 1;
-		auto xstart = x > radius ? x - radius : 0;
-		auto xend = t.Length() - radius > x ? x + radius : t.Length() - 1;
-		for (auto j = ystart; j <= yend; ++j)
-			for (auto i = xstart; i < xend; ++i)
-			{
-				float hight = t.GetHight(t.GetVoxels(x, y), layer);
-				if (IsMask(GetGrid(i, j), t.GetLayer(t.GetVoxels(i, j), hight)))
-					return true;
-			}
-		return false;
+		size_t bytes = m_maskTiles.capacity() * sizeof(MaskTiles);
+		for (const auto& tiles : m_maskTiles)
+			bytes += tiles.MemoryBytes();
+		return bytes;
 	}
 
-	void AddMask(const Grid& grid, uint8_t layer)
+	// 保存当前掩码状态, 用于回滚和作为增量的基准
+	Snapshot TakeSnapshot() const
 	{
-		auto& mask = m_maskArr[grid.maskIndex + layer];
-		mask += 1;
+		return Snapshot{ m_maskVersion, m_maskTiles };
 	}
 
-	// todo: 뾶ûʵ
-	void AddMask(uint32_t x, uint32_t y, uint8_t layer, uint8_t radius = 0)
+	// 回滚到快照的掩码状态, 版本号继续增加, 不会与回滚前的版本重复
+	void Restore(const Snapshot& snapshot)
+	{
+		m_maskTiles = snapshot.maskTiles;
+		++m_maskVersion;
+		LogChange(WholeMap());
+	}
+
+	// 编码从base到当前状态的增量, 只包含计数变化的格子, 追加到out
+	void EncodeDelta(const Snapshot& base, std::vector<uint8_t>& out) const
+	{
+		WriteVarint(out, DeltaMagic);
+		WriteVarint(out, base.version);
+		WriteVarint(out, m_maskVersion);
+		uint32_t layerCount = (uint32_t)std::max(m_maskTiles.size(), base.maskTiles.size());
+		MaskTiles empty(GetData().Length(), GetData().Width());
+		std::vector<uint8_t> runs;
+		std::vector<uint8_t> layers;
+		uint32_t changedLayers = 0;
+		for (uint32_t layer = 0; layer < layerCount; ++layer)
+		{
+			const MaskTiles& cur = layer < m_maskTiles.size() ? m_maskTiles[layer] : empty;
+			const MaskTiles& old = layer < base.maskTiles.size() ? base.maskTiles[layer] : empty;
+			// 连续的键合并为一段, 先缓存段内的值
+			std::vector<uint8_t> values;
+			uint32_t runCount = 0, runStart = 0, runLength = 0, runEnd = 0;
+			runs.clear();
+			auto flush = [&]() {
+				if (runLength == 0)
+					return;
+				WriteVarint(runs, runStart - runEnd);
+				WriteVarint(runs, runLength);
+				runs.insert(runs.end(), values.begin(), values.end());
+				values.clear();
+				runEnd = runStart + runLength;
+				++runCount;
+			};
+			cur.Diff(old, [&](uint32_t key, uint8_t mask, uint16_t cover) {
+				if (runLength == 0 || key != runStart + runLength)
+				{
+					flush();
+					runStart = key;
+					runLength = 0;
+				}
+				++runLength;
+				values.push_back(mask);
+				WriteVarint(values, cover);
+			});
+			flush();
+			if (runCount == 0)
+				continue;
+			WriteVarint(layers, layer);
+			WriteVarint(layers, runCount);
+			layers.insert(layers.end(), runs.begin(), runs.end());
+			++changedLayers;
+		}
+		WriteVarint(out, changedLayers);
+		out.insert(out.end(), layers.begin(), layers.end());
+	}
+
+	// 应用EncodeDelta的结果, 当前版本需等于增量的基准版本
+	// 格式错误或版本不符时返回false且不修改状态, 成功后版本号为增量的目标版本
+	bool ApplyDelta(const uint8_t* data, size_t size)
+	{
+		uint32_t target = 0;
+		if (!ParseDelta(data, size, false, target))
+			return false;
+		ParseDelta(data, size, true, target);
+		m_maskVersion = target;
+		LogChange(WholeMap());
+		return true;
+	}
+
+	// radius大于0时查询以 (x, y) 为中心边长2*radius+1的区域内同一layer是否有占用
+	bool IsMask(uint32_t x, uint32_t y, uint8_t layer, uint8_t radius = 0) const
 	{
+		VOXEL_COUNT(IsMask, 1);
+		if (layer >= m_maskTiles.size())
+			return false;
 		if (radius < 1)
-			return AddMask(GetGrid(x, y), layer);
+			return m_maskTiles[layer].Test(x, y);
+		GridRect rect = GridRect{ x, y, x, y }.Expand(radius, GetData().Length(), GetData().Width());
+		return m_maskTiles[layer].AnyCover(rect.minX, rect.minY, rect.maxX, rect.maxY);
+	}
+
+	// 矩形内同一layer是否有格子被占用, 与逐格调用IsMask(x, y, layer)结果一致
+	bool IsMaskRect(const GridRect& rect, uint8_t layer) const
+	{
+		if (rect.IsEmpty() || layer >= m_maskTiles.size())
+			return false;
+		return m_maskTiles[layer].Any(rect.minX, rect.minY, rect.maxX, rect.maxY);
+	}
+
+	// 第y行 [minX, maxX] 内同一layer是否有格子被占用
+	bool IsMaskRow(uint32_t y, uint32_t minX, uint32_t maxX, uint8_t layer) const
+	{
+		return IsMaskRect(GridRect{ minX, y, maxX, y }, layer);
 	}
 
-	void DecMask(const Grid& grid, uint8_t layer)
+	// 占用以 (x, y) 为中心边长2*radius+1的区域, 区域内有该layer的格子掩码加1
+	// 没有该layer的格子也计入区域查询, 两个占用范围在空中重叠同样视为碰撞
+	void AddMask(uint32_t x, uint32_t y, uint8_t layer, uint8_t radius = 0)
 	{
-		auto& mask = m_maskArr[grid.maskIndex + layer];
-		mask -= 1;
+		AddMask(x, y, layer, radius, 1);
 	}
 
-	// todo: 뾶ûʵ
 	void DecMask(uint32_t x, uint32_t y, uint8_t layer, uint8_t radius = 0)
 	{
-		if (radius < 1)
-			return DecMask(GetGrid(x, y), layer);
+		AddMask(x, y, layer, radius, -1);
+	}
+
+private:
+	static void WriteVarint(std::vector<uint8_t>& out, uint32_t v)
+	{
+		for (; v >= 0x80; v >>= 7)
+			out.push_back(uint8_t(v | 0x80));
+		out.push_back(uint8_t(v));
+	}
+
+	static bool ReadVarint(const uint8_t*& data, const uint8_t* end, uint32_t& v)
+	{
+		v = 0;
+		for (uint32_t shift = 0; shift < 35 && data < end; shift += 7)
+		{
+			uint8_t b = *data++;
+			v |= uint32_t(b & 0x7F) << shift;
+			if (!(b & 0x80))
+				return true;
+		}
+		return false;
+	}
+
+	// apply为false时只检查格式和版本, 为true时写入
+	bool ParseDelta(const uint8_t* data, size_t size, bool apply, uint32_t& target)
+	{
+		const uint8_t* end = data + size;
+		uint32_t magic = 0, base = 0, layerCount = 0;
+		if (!ReadVarint(data, end, magic) || magic != DeltaMagic
+			|| !ReadVarint(data, end, base) || base != m_maskVersion
+			|| !ReadVarint(data, end, target) || !ReadVarint(data, end, layerCount))
+			return false;
+		const auto& t = GetData();
+		uint32_t keyCount = MaskTiles(t.Length(), t.Width()).KeyCount();
+		for (uint32_t i = 0; i < layerCount; ++i)
+		{
+			uint32_t layer = 0, runCount = 0;
+			if (!ReadVarint(data, end, layer) || layer > 0xFF || !ReadVarint(data, end, runCount))
+				return false;
+			if (apply && layer >= m_maskTiles.size())
+				m_maskTiles.resize(layer + 1, MaskTiles(t.Length(), t.Width()));
+			MaskTiles* tiles = apply ? &m_maskTiles[layer] : nullptr;
+			uint64_t key = 0;
+			for (uint32_t r = 0; r < runCount; ++r)
+			{
+				uint32_t gap = 0, length = 0;
+				if (!ReadVarint(data, end, gap) || !ReadVarint(data, end, length) || key + gap + length > keyCount)
+					return false;
+				key += gap;
+				for (uint32_t k = 0; k < length; ++k, ++key)
+				{
+					uint32_t cover = 0;
+					if (data >= end)
+						return false;
+					uint8_t mask = *data++;
+					if (!ReadVarint(data, end, cover) || cover > 0xFFFF)
+						return false;
+					if (tiles)
+						tiles->Set(uint32_t(key), mask, uint16_t(cover));
+				}
+			}
+		}
+		return data == end;
+	}
+
+	void AddMask(uint32_t x, uint32_t y, uint8_t layer, uint8_t radius, int32_t value)
+	{
+		const auto& t = GetData();
+		if (layer >= m_maskTiles.size())
+			m_maskTiles.resize(layer + 1, MaskTiles(t.Length(), t.Width()));
+		GridRect rect = GridRect{ x, y, x, y }.Expand(radius, t.Length(), t.Width());
+		m_maskTiles[layer].Add(rect.minX, rect.minY, rect.maxX, rect.maxY, value, [&t, layer](uint32_t i, uint32_t j) {
+			return layer < t.GetVoxels(i, j).count;
+		});
+		++m_maskVersion;
+		LogChange(rect);
 	}
 };
 
 
-// װAPI
+// 封装体素API
 class VoxelProxy
 {
 	TerrainInstance* m_terr;
-	TerrainInstance::Grid m_grid;
-	TerrainData::Voxels m_vols;
 
 	uint8_t m_layer;
 	uint8_t m_radius;
@@ -391,73 +1564,211 @@ class VoxelProxy
 	Location m_loc;
 	uint32_t m_gridX;
 	uint32_t m_gridY;
+
+	// 加入的实体索引, 位置变化时同步
+	SpatialIndex* m_index = nullptr;
+	uint32_t m_handle = SpatialIndex::Invalid;
+
+	void SyncIndex()
+	{
+		if (m_index)
+			m_index->Move(m_handle, m_loc, m_gridX, m_gridY, m_layer);
+	}
+
+	// 当前格子的体素, 视图在地形修改后失效, 不缓存
+	TerrainData::Voxels CurVoxels() const { return m_terr->GetData().GetVoxels(m_gridX, m_gridY); }
+
 public:
 	VoxelProxy(TerrainInstance* terr, const Location& loc, uint8_t radius=0)
 		: m_terr(terr), m_radius(radius) { Update(loc);	}
+	~VoxelProxy() { Detach(); }
+	VoxelProxy(const VoxelProxy&) = delete;
+	VoxelProxy& operator=(const VoxelProxy&) = delete;
 
-	const Location& GetLocation() const { return m_loc; }
+	// 加入实体索引, id为查询时返回的值; 一个代理只能加入一个索引
+	void Attach(SpatialIndex* index, uint64_t id)
+	{
+		Detach();
+		m_index = index;
+		m_handle = index->Add(id, m_loc, m_gridX, m_gridY, m_layer);
+	}
 
-	// ȡǰ
-	float GetUpper() const { return m_terr->GetData().GetVoxelUpper(m_vols.spanIndex, m_layer); }
-	float GetDown() const { return m_terr->GetData().GetVoxelDown(m_vols.spanIndex, m_layer); }
+	void Detach()
+	{
+		if (!m_index)
+			return;
+		m_index->Remove(m_handle);
+		m_index = nullptr;
+		m_handle = SpatialIndex::Invalid;
+	}
+
+	SpatialIndex* GetIndex() const { return m_index; }
 
-	// 
-	bool IsMask() const { return m_terr->IsMask(m_grid, m_layer); }
-	void AddMask() { m_terr->AddMask(m_grid, m_layer); }
-	void DecMask() { m_terr->DecMask(m_grid, m_layer); }
+	const Location& GetLocation() const { return m_loc; }
+	TerrainInstance* GetTerrain() const { return m_terr; }
+	uint32_t GetGridX() const { return m_gridX; }
+	uint32_t GetGridY() const { return m_gridY; }
+	uint8_t GetLayer() const { return m_layer; }
+	uint8_t GetRadius() const { return m_radius; }
+
+	// 取当前体素上下
+	float GetUpper() const { return m_terr->GetData().GetVoxelUpper(CurVoxels(), m_layer); }
+	float GetDown() const { return m_terr->GetData().GetVoxelDown(CurVoxels(), m_layer); }
+
+	// 掩码
+	bool IsMask() const { return m_terr->IsMask(m_gridX, m_gridY, m_layer); }
+	void AddMask() { m_terr->AddMask(m_gridX, m_gridY, m_layer); }
+	void DecMask() { m_terr->DecMask(m_gridX, m_gridY, m_layer); }
 	
-	// λ
+	// 更新位置
 	void Update(const Location& loc)
 	{
 		m_loc = loc;
 		m_gridX = uint32_t(loc.x / m_terr->GetData().GridSize());
 		m_gridY = uint32_t(loc.y / m_terr->GetData().GridSize());
 
-		m_vols = m_terr->GetData().GetVoxels(m_gridX, m_gridY);
-		m_grid = m_terr->GetGrid(m_gridX, m_gridY);
-		m_layer = GetLayer(m_vols, loc.z);
+		m_layer = GetLayer(CurVoxels(), loc.z);
+		SyncIndex();
 	}
 
-	// λʧܷfalse, bug: мܿԽ˶
+	// 沿线段逐格移动(Amanatides-Woo遍历), 检查经过的每个格子的layer关系和掩码
+	// 被挡住时停在挡住的格子前并返回false, 只检查格子本身的掩码, 不会被自己的掩码挡住
 	bool MoveTo(const Location& loc)
 	{
-		auto gridX = uint32_t(loc.x / m_terr->GetData().GridSize());
-		auto gridY = uint32_t(loc.y / m_terr->GetData().GridSize());
-		const auto& vols = m_terr->GetData().GetVoxels(gridX, gridY);
-		auto rel = GetRelation(gridX, gridY);
-		if (rel == LayerRelation::Unknow)
+		float size = m_terr->GetData().GridSize();
+		return MoveTo(loc, (int64_t)std::floor(loc.x / size), (int64_t)std::floor(loc.y / size));
+	}
+
+	// endX endY为loc所在的格子, 由调用者批量算好
+	bool MoveTo(const Location& loc, int64_t endX, int64_t endY)
+	{
+		// 没有离开当前格子
+		if (endX == (int64_t)m_gridX && endY == (int64_t)m_gridY)
 		{
-			return false;
+			m_loc = loc;
+			m_loc.z = GetUpper();
+			SyncIndex();
+			VOXEL_COUNT(MoveToOk, 1);
+			return true;
 		}
-		m_loc = loc;
-		m_gridX = gridX;
-		m_gridY = gridY;
-		m_vols = vols;
-		m_grid = m_terr->GetGrid(gridX, gridY);
-		m_layer = m_terr->GetData().RelationToLayer(m_layer, rel);
-		m_loc.z = GetUpper();
-		return true;
+
+		const auto& data = m_terr->GetData();
+		float size = data.GridSize();
+		float dx = loc.x - m_loc.x;
+		float dy = loc.y - m_loc.y;
+
+		// 下一次跨过x, y边界时的线段参数t, 以及跨过一格t的增量
+		int stepX = dx > 0.f ? 1 : dx < 0.f ? -1 : 0;
+		int stepY = dy > 0.f ? 1 : dy < 0.f ? -1 : 0;
+		float maxX = stepX > 0 ? ((m_gridX + 1) * size - m_loc.x) / dx : stepX < 0 ? (m_gridX * size - m_loc.x) / dx : FLT_MAX;
+		float maxY = stepY > 0 ? ((m_gridY + 1) * size - m_loc.y) / dy : stepY < 0 ? (m_gridY * size - m_loc.y) / dy : FLT_MAX;
+		float deltaX = stepX != 0 ? size / std::fabs(dx) : FLT_MAX;
+		float deltaY = stepY != 0 ? size / std::fabs(dy) : FLT_MAX;
+
+		uint32_t x = m_gridX, y = m_gridY;
+		TerrainData::Voxels vols = CurVoxels();
+		uint8_t layer = m_layer;
+		bool blocked = false;
+		float hit = 1.f;
+		while ((int64_t)x != endX || (int64_t)y != endY)
+		{
+			// 同时跨过两条边界时先走x, 相当于经过侧面的格子, 不会从墙角穿过
+			bool alongX = maxX <= maxY;
+			float t = alongX ? maxX : maxY;
+			// 浮点误差使终点格子与遍历结果不一致, 停在已走到的格子, 位置在下面收进该格子
+			if (t > 1.f)
+				break;
+			uint32_t nx = x, ny = y;
+			Direction dir;
+			if (alongX)
+			{
+				nx += stepX;
+				dir = stepX > 0 ? Direction::Front : Direction::Back;
+			}
+			else
+			{
+				ny += stepY;
+				dir = stepY > 0 ? Direction::Right : Direction::Left;
+			}
+			auto rel = data.IsValidGrid(nx, ny) ? data.GetNeighborLayerRelation(vols, layer, dir) : LayerRelation::Unknow;
+			uint8_t nextLayer = rel != LayerRelation::Unknow ? TerrainData::RelationToLayer(layer, rel) : 0;
+			TerrainData::Voxels next = {};
+			if (rel != LayerRelation::Unknow)
+				next = data.GetVoxels(nx, ny);
+			if (rel == LayerRelation::Unknow || nextLayer >= next.count || m_terr->IsMask(nx, ny, nextLayer))
+			{
+				VOXEL_COUNT_AT(MoveBlockSame, uint8_t(rel), 1);
+				blocked = true;
+				hit = t;
+				break;
+			}
+			VOXEL_COUNT_AT(MoveStepSame, uint8_t(rel), 1);
+			x = nx;
+			y = ny;
+			vols = next;
+			layer = nextLayer;
+			if (alongX)
+				maxX += deltaX;
+			else
+				maxY += deltaY;
+		}
+
+		Location to = loc;
+		if (blocked)
+		{
+			to.x = m_loc.x + dx * hit;
+			to.y = m_loc.y + dy * hit;
+		}
+		if (blocked || (int64_t)x != endX || (int64_t)y != endY)
+		{
+			// 停在边界上或终点不在走到的格子里, 收回一点留在当前格子内, 位置与格子和layer保持一致
+			float margin = size * 0.001f;
+			to.x = std::min(std::max(to.x, x * size), (x + 1) * size - margin);
+			to.y = std::min(std::max(to.y, y * size), (y + 1) * size - margin);
+		}
+		m_loc = to;
+		m_gridX = x;
+		m_gridY = y;
+		m_layer = layer;
+		m_loc.z = data.GetVoxelUpper(vols, layer);
+		SyncIndex();
+		VOXEL_COUNT_AT(MoveToOk, blocked ? 1 : 0, 1);
+		return !blocked;
+	}
+
+	// 批量移动, 结果写入moved(可为空), 返回被挡住的数量
+	static uint32_t MoveTo(VoxelProxy* const* proxies, const Location* locs, uint32_t count, bool* moved = nullptr)
+	{
+		uint32_t blocked = 0;
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			bool res = proxies[i]->MoveTo(locs[i]);
+			if (moved)
+				moved[i] = res;
+			blocked += res ? 0 : 1;
+		}
+		return blocked;
 	}
 
-	// x y 
-	const TerrainData::Voxels& GetVoxels(uint32_t x, uint32_t y) const
+	// x y 计算体素
+	TerrainData::Voxels GetVoxels(uint32_t x, uint32_t y) const
 	{
 		return m_terr->GetData().GetVoxels(x, y);
 	}
 
-	//   dir Ӧ X Y
+	//  计算 dir 对应 X Y
 	void CalcDirectionGrid(Direction dir, uint32_t& x, uint32_t& y) const
 	{
 		m_terr->GetData().CalcDirectionGrid(dir, x, y);
 	}
 
-	// ȡص layer
+	// 获取体素的 layer
 	uint8_t GetLayer(const TerrainData::Voxels& vol, float hight) const
 	{
 		return m_terr->GetData().GetLayer(vol, hight);
 	}
 
-	// ȡ Ӧlayerϵ
+	// 取得 对应的layer关系
 	LayerRelation GetRelation(uint32_t x, uint32_t y) const
 	{
 		LayerRelation rel = LayerRelation::Unknow;
@@ -506,11 +1817,11 @@ public:
 				}
 				break;
 			}
-			return m_terr->GetData().GetNeighborLayerRelation(m_vols, m_layer, dir);
+			return m_terr->GetData().GetNeighborLayerRelation(CurVoxels(), m_layer, dir);
 		}
 	}
 
-	// ȡλöӦĹϵ
+	// 获取位置对应的关系
 	LayerRelation GetRelation(const Location& loc) const
 	{
 		auto gridX = uint32_t(loc.x / m_terr->GetData().GridSize());
@@ -520,14 +1831,15 @@ public:
 	}
 
 
-	//  Χ
+	// 遍历 周围体素
 	void GetNeighborGrid(std::function<void(uint32_t, uint32_t, uint8_t/*layer*/)> cb) const
 	{
 		for (uint8_t i = 0; i <= uint8_t(Direction::LF); ++i)
 		{
-			m_terr->GetData().GetNeighborLayerRelation(m_vols, m_layer, Direction(i));
-			uint32_t x, y;
+			uint32_t x = m_gridX, y = m_gridY;
 			CalcDirectionGrid(Direction(i), x, y);
+			if (!m_terr->GetData().IsValidGrid(x, y))
+				continue;
 			const auto& vols = GetVoxels(x, y);
 			cb(x, y, GetLayer(vols, m_loc.z));
 		}